@@ -65,6 +65,7 @@
 void NMI_Handler(void);
 void HardFault_Handler(void);
 void EXTI0_1_IRQHandler(void);
+void DMA1_Channel2_3_IRQHandler(void);
 void TIM1_BRK_UP_TRG_COM_IRQHandler(void);
 /* USER CODE BEGIN EFP */
 
@@ -66,12 +66,17 @@
 #include "shared.h"
 #include "constants.h"
 #include "logging/logging.h"
+#include "timing/timing.h"
+#include "profiler/profiler.h"
+#include "codec/codec.h"
+#include "control/control.h"
 #include "eeprom/eeprom.h"
 #include "opt3002/opt3002.h"
 #include "bme280/bme280.h"
 #include "w5500/w5500.h"
 #include "w5500/dhcp.h"
 #include "w5500/mqtt.h"
+#include "w5500/mcast.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -96,13 +101,68 @@ static const char* SAMPLE_TYPE[TYPE_LAST] =
   "/home/bedroom/"DEVICE_NAME"/luminosity",
 };
 
+//! sampling settings commands, see control/control.h, sent straight from
+//! flash by MQTT_Subscribe so it must be aligned like any other SPI buffer
+static const char COMMAND_TOPIC[] __attribute__((aligned(16))) = "/home/bedroom/"DEVICE_NAME"/set";
+//! wait before subscribing again after the broker refused or did not answer
+static const TickType_t SUBSCRIBE_RETRY = 60 * configTICK_RATE_HZ;
+
+#if USE_MQTT_BATCH
+//! sample field names in the state message
+static const char* SAMPLE_FIELD[TYPE_LAST] =
+{
+  "temperature",
+  "humidity",
+  "pressure",
+  "luminosity",
+};
+
+#if USE_MQTT_BINARY
+//! state topic, packed sample records
+static const char*      STATE_TOPIC       = "/home/bedroom/"DEVICE_NAME"/state/packed";
+#else
+//! state topic, one JSON object with the latest samples
+static const char*      STATE_TOPIC       = "/home/bedroom/"DEVICE_NAME"/state";
+#endif
+static const uint8_t    STATE_MAX_SAMPLES = TYPE_LAST; //!< samples per state message
+static const TickType_t STATE_DEADLINE    = 50;        //!< ticks to wait for more samples
+#endif
+
+#if PROFILER_ENABLE
+//! bus profiler diagnostics topic
+static const char* DIAGNOSTICS_BUS_TOPIC = "/home/bedroom/"DEVICE_NAME"/diagnostics/bus";
+#endif
+#if MQTT_BENCHMARK
+//! publish rate benchmark topic and message count
+static const char*    DIAGNOSTICS_BENCH_TOPIC = "/home/bedroom/"DEVICE_NAME"/diagnostics/benchmark";
+static const uint16_t BENCHMARK_PUBLISHES     = 1000;
+#endif
+
 //! sample object
 typedef struct sample_t
 {
   float         value;  //!< sample value
   sample_type_t type;   //!< sample type
+  TickType_t    tick;   //!< tick when the sample was queued
 } sample_t;
 
+//! samples are formatted as text unless every consumer takes packed records
+#define SAMPLE_FORMAT_TEXT (USE_MQTT_FIELDS || !USE_MQTT_BATCH || !USE_MQTT_BINARY)
+
+#if USE_MQTT_BATCH
+#define STATE_BUF_SIZE 128 //!< room for one sample of each type as JSON
+
+//! state message, holds at most one sample of each type
+typedef struct state_batch_t
+{
+  char       buf[STATE_BUF_SIZE]; //!< JSON object or packed records
+  size_t     len;                 //!< characters in the buffer
+  uint8_t    types;               //!< bit mask of sample types in the buffer
+  uint8_t    count;               //!< samples in the buffer
+  TickType_t start;               //!< tick of the first sample
+} state_batch_t;
+#endif
+
 /* USER CODE END PTD */
 
 /* Private define ------------------------------------------------------------*/
@@ -119,7 +179,30 @@ typedef struct sample_t
 /* USER CODE BEGIN Variables */
 static const UBaseType_t SAMPLE_QUEUE_SIZE = 16;
 QueueHandle_t sampleQueue;
+#if USE_MCAST_TRANSPORT
+QueueHandle_t castQueue;
+osThreadId castTaskHandle;
+#endif
 SemaphoreHandle_t i2c1Mutex;
+SemaphoreHandle_t spi1Mutex;
+osThreadId linkTaskHandle;
+#if USE_MQTT_BATCH
+static state_batch_t state; // state message being filled by the MQTT task
+#endif
+#if USE_MQTT_FIELDS
+static mqtt_topic_t sampleTopic[TYPE_LAST]; // publish templates of the sample topics
+#endif
+#if USE_MQTT_BATCH
+static mqtt_topic_t stateTopic;             // publish template of the state topic
+#endif
+#if PROFILER_ENABLE
+static mqtt_topic_t diagTopic;              // publish template of the bus diagnostics topic
+#endif
+#if MQTT_BENCHMARK
+static mqtt_topic_t benchTopic;             // publish template of the benchmark topic
+#endif
+static volatile uint32_t wizIntCycles;  // timestamp of the last W5500 interrupt
+static timing_stats_t    wizIntLatency; // W5500 interrupt to event group latency in us
 /* USER CODE END Variables */
 osThreadId defaultTaskHandle;
 osThreadId luxTaskHandle;
@@ -138,11 +221,58 @@ void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
   if (GPIO_Pin & WIZ_INT_Pin)
   {
     ASSERT(wizTaskHandle != NULL);
-    vTaskNotifyGiveFromISR(wizTaskHandle, &xHigherPriorityTaskWoken);
+    wizIntCycles = Timing_GetCycles();
+    xTaskNotifyFromISR(wizTaskHandle, W5500_NOTIFY_INT, eSetBits, &xHigherPriorityTaskWoken);
+  }
+
+  portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+}
+
+static void SPI_TransferCallback(SPI_HandleTypeDef* hspi)
+{
+  BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+
+  // W5500 DMA transfer
+  if (hspi == wiz.hspix)
+  {
+    W5500_TransferCompleteFromISR(&wiz, &xHigherPriorityTaskWoken);
   }
 
   portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
 }
+
+void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef* hspi)
+{
+  SPI_TransferCallback(hspi);
+}
+
+void HAL_SPI_RxCpltCallback(SPI_HandleTypeDef* hspi)
+{
+  SPI_TransferCallback(hspi);
+}
+
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef* hspi)
+{
+  SPI_TransferCallback(hspi);
+}
+
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef* hspi)
+{
+  SPI_TransferCallback(hspi);
+}
+
+static void QueueSample(sample_t* sample);
+static void QueueSampleTo(QueueHandle_t queue, const sample_t* sample);
+static TickType_t BatchWait(void);
+static void OnCommand(const char* topic, uint16_t topicLen, const uint8_t* payload, uint16_t payloadLen);
+static bool CommandSubscribe(void);
+#if USE_MQTT_BATCH
+static bool StateAppend(const sample_t* sample, const char* value);
+static w5500_status_t StatePublish(void);
+#endif
+#if USE_MCAST_TRANSPORT
+void StartCastTask(void const * argument);
+#endif
    
 /* USER CODE END FunctionPrototypes */
 
@@ -156,8 +286,21 @@ void StartWizTask(void const * argument);
 void MX_FREERTOS_Init(void); /* (MISRA C 2004 rule 8.1) */
 
 /* Hook prototypes */
+void vApplicationTickHook(void);
 void vApplicationStackOverflowHook(TaskHandle_t xTask, signed char *pcTaskName);
 
+/* USER CODE BEGIN 3 */
+void vApplicationTickHook( void )
+{
+   /* This function will be called by each tick interrupt if
+   configUSE_TICK_HOOK is set to 1 in FreeRTOSConfig.h. User code can be
+   added here, but the tick hook is called from an interrupt context, so
+   code must not attempt to block, and only the interrupt safe FreeRTOS API
+   functions can be used (those that end in FromISR()). */
+  Clock_TickHook();
+}
+/* USER CODE END 3 */
+
 /* USER CODE BEGIN 4 */
 void vApplicationStackOverflowHook(TaskHandle_t xTask, signed char *pcTaskName)
 {
@@ -180,6 +323,7 @@ void MX_FREERTOS_Init(void) {
 
   /* USER CODE BEGIN RTOS_MUTEX */
   i2c1Mutex = xSemaphoreCreateMutex();
+  spi1Mutex = xSemaphoreCreateMutex();
   /* USER CODE END RTOS_MUTEX */
 
   /* USER CODE BEGIN RTOS_SEMAPHORES */
@@ -192,6 +336,9 @@ void MX_FREERTOS_Init(void) {
 
   /* USER CODE BEGIN RTOS_QUEUES */
   sampleQueue = xQueueCreate(SAMPLE_QUEUE_SIZE, sizeof(sample_t));
+#if USE_MCAST_TRANSPORT
+  castQueue = xQueueCreate(SAMPLE_QUEUE_SIZE, sizeof(sample_t));
+#endif
   /* USER CODE END RTOS_QUEUES */
 
   /* Create the thread(s) */
@@ -220,7 +367,29 @@ void MX_FREERTOS_Init(void) {
   wizTaskHandle = osThreadCreate(osThread(wizTask), (void*) &wiz);
 
   /* USER CODE BEGIN RTOS_THREADS */
-  /* add threads, ... */
+#if USE_MCAST_TRANSPORT
+  osThreadDef(castTask, StartCastTask, osPriorityNormal, 0, 192);
+  castTaskHandle = osThreadCreate(osThread(castTask), (void*) &mcast);
+#endif
+  osThreadDef(linkTask, LINK_MonitorTask, osPriorityBelowNormal, 0, 192);
+  linkTaskHandle = osThreadCreate(osThread(linkTask), (void*) &phy);
+
+  // logging is not up yet, and a NULL handle would make the default task
+  // suspend itself, so an undersized configTOTAL_HEAP_SIZE stops here
+  configASSERT(i2c1Mutex != NULL);
+  configASSERT(spi1Mutex != NULL);
+  configASSERT(sampleQueue != NULL);
+  configASSERT(defaultTaskHandle != NULL);
+  configASSERT(luxTaskHandle != NULL);
+  configASSERT(dhcpTaskHandle != NULL);
+  configASSERT(mqttTaskHandle != NULL);
+  configASSERT(bmeTaskHandle != NULL);
+  configASSERT(wizTaskHandle != NULL);
+  configASSERT(linkTaskHandle != NULL);
+#if USE_MCAST_TRANSPORT
+  configASSERT(castQueue != NULL);
+  configASSERT(castTaskHandle != NULL);
+#endif
   /* USER CODE END RTOS_THREADS */
 
 }
@@ -238,10 +407,15 @@ void StartDefaultTask(void const * argument)
   /* USER CODE BEGIN StartDefaultTask */
   eeprom_status_t erc;
   w5500_status_t  wrc;
+  clock_status_t  crc;
 
   // suspend tasks that require networking
+  vTaskSuspend(linkTaskHandle);
   vTaskSuspend(dhcpTaskHandle);
   vTaskSuspend(mqttTaskHandle);
+#if USE_MCAST_TRANSPORT
+  vTaskSuspend(castTaskHandle);
+#endif
 
   // initialize UART logging
   Log_Init(&huart1);
@@ -250,8 +424,36 @@ void StartDefaultTask(void const * argument)
   // initialize shared device structures
   InitializeShared();
 
-  // suspend these tasks when not bound
+  // retime peripherals for the default clock profile
+  crc = Clock_Init(&clk, CLOCK_PROFILE_DEFAULT);
+  if (crc != CLOCK_OK)
+  {
+    LOG_ERROR("Clock_Init %s", Clock_StatusString(crc));
+  }
+
+  // tasks woken when a lease is bound
+#if USE_MQTT_TRANSPORT
   dhcp.boundTask[0] = mqttTaskHandle;
+#else
+  dhcp.boundTask[0] = NULL;
+#endif
+#if USE_MCAST_TRANSPORT
+  dhcp.boundTask[1] = castTaskHandle;
+#else
+  dhcp.boundTask[1] = NULL;
+#endif
+
+  // tasks woken by link changes
+  phy.notifyTask[0] = dhcpTaskHandle;
+#if USE_MQTT_TRANSPORT
+  phy.notifyTask[1] = mqttTaskHandle;
+#else
+  phy.notifyTask[1] = NULL;
+#endif
+
+  // tasks woken by sampling settings changes
+  control.notifyTask[0] = luxTaskHandle;
+  control.notifyTask[1] = bmeTaskHandle;
 
   // read MAC from EEPROM
   do {
@@ -279,8 +481,21 @@ void StartDefaultTask(void const * argument)
   // log PHY status
   W5500_LogPhyStatus(&wiz);
 
-  // resume other threads
+#if PROFILER_ENABLE
+  // bus usage during start up
+  Profiler_Log();
+#endif
+
+  // resume other threads, DHCP waits for the link monitor and the
+  // transports for a lease, disabled transports stay suspended
+  vTaskResume(linkTaskHandle);
   vTaskResume(dhcpTaskHandle);
+#if USE_MQTT_TRANSPORT
+  vTaskResume(mqttTaskHandle);
+#endif
+#if USE_MCAST_TRANSPORT
+  vTaskResume(castTaskHandle);
+#endif
 
   // delete yourself
   vTaskDelete(NULL);
@@ -298,18 +513,21 @@ void StartDefaultTask(void const * argument)
 void StartLuxTask(void const * argument)
 {
   /* USER CODE BEGIN StartLuxTask */
-  sample_t         optSample;     // OPT3002 sample
-  opt3002_dev_t    optDev;        // OPT3002 device
-  opt3002_cfg_t    optCfg;        // OPT3002 configuration
-  opt3002_status_t rc;            // OPT3002 return codes
-  bool             initialize;    // set to true to initialize OPT3002
+  sample_t           optSample;   // OPT3002 sample
+  opt3002_dev_t      optDev;      // OPT3002 device
+  opt3002_cfg_t      optCfg;      // OPT3002 configuration
+  opt3002_status_t   rc;          // OPT3002 return codes
+  bool               initialize;  // set to true to initialize OPT3002
+  control_settings_t settings;    // runtime sampling settings
+
+  Control_Get(&control, &settings);
 
   optSample.type  = TYPE_LUX;
   optDev.addr     = OPT3002_DEFAULT_ADDR << 1; // shifted 7-bit I2C address
   optDev.hi2cx    = hi2c1;                     // I2C port of the OPT3002
   optDev.busMutex = i2c1Mutex;                 // Mutex for the I2C bus
   optCfg.all      = OPT3002_DEFAULT_CFG;       // default configuration
-  optCfg.bits.ct  = OPT3002_100_MS;            // conversion time
+  optCfg.bits.ct  = settings.luxCt;            // conversion time
   optCfg.bits.m   = OPT3002_MODE_CONTINUOUS;   // continuous sample mode
   initialize      = true;
 
@@ -341,12 +559,21 @@ void StartLuxTask(void const * argument)
       else
       {
         // enqueue samples for publishing
-        xQueueSend(sampleQueue, (void *)&optSample, 0);
+        QueueSample(&optSample);
       }
     }
 
-    // put this thread to sleep for the sample period
-    vTaskDelay((configTICK_RATE_HZ * OPT3002_MIN_PERIOD) / 1000);
+    // put this thread to sleep for the sample period, new settings wake it
+    if (ulTaskNotifyTake(pdTRUE, (configTICK_RATE_HZ * settings.luxPeriod) / 1000))
+    {
+      Control_Get(&control, &settings);
+      if (optCfg.bits.ct != settings.luxCt)
+      {
+        optCfg.bits.ct = settings.luxCt;
+        initialize     = true;
+      }
+      LOG_INFO("OPT3002 period %lu ms, conversion time %s", settings.luxPeriod, settings.luxCt == OPT3002_800_MS ? "800 ms" : "100 ms");
+    }
   }
   /* USER CODE END StartLuxTask */
 }
@@ -362,21 +589,75 @@ void StartMqttTask(void const * argument)
 {
   /* USER CODE BEGIN StartMqttTask */
 
+#if SAMPLE_FORMAT_TEXT
   // print buffer for samples
   static const size_t BUF_SIZE = 16;
   char printBuf[BUF_SIZE] __attribute__((aligned(16)));
-
+  static const uint8_t DECIMALS = 3; // fractional digits published
+#else
+  const char*    printBuf = NULL; // packed records carry the raw value
+#endif
 
   w5500_status_t rc;      // return code from client
   sample_t       sample;  // sample structure for fetching from queue
-  int            printed; // characters printed by snprintf
-  int32_t        whole;   // whole integer portion of floats for printing
-  int32_t        decimal; // decimal portion of floats for printing
+  clock_status_t crc;     // return code from the clock manager
+  TickType_t     lostTick = 0; // tick the connection loss was noticed
+  TickType_t     subscribeTick = 0; // tick of the last command subscription attempt
+  bool           subscribed = false; // command subscription acknowledged
+  static const TickType_t LIVENESS_POLL = 250; // connection checks while idle
+#if SAMPLE_FORMAT_TEXT || PROFILER_ENABLE
+  int            printed; // characters printed by the formatters
+#endif
+#if USE_MQTT_FIELDS || PROFILER_ENABLE
+  uint8_t        site;    // sample type or profiler call site
+#endif
+#if PROFILER_ENABLE
+  static const TickType_t DIAGNOSTICS_PERIOD = 60 * configTICK_RATE_HZ;
+  static const size_t     DIAGNOSTICS_LEN    = 96;
+  char       diagBuf[DIAGNOSTICS_LEN] __attribute__((aligned(16)));
+  TickType_t lastDiag = xTaskGetTickCount();
+#endif
+
+  // commands are handled from MQTT_Process on this task
+  mqtt.onMessage = OnCommand;
+
+  // publish templates are built once, all publishes come from this task
+#if USE_MQTT_FIELDS
+  for (site = 0; site < TYPE_LAST; site++)
+  {
+    if (MQTT_TopicInit(&sampleTopic[site], SAMPLE_TYPE[site]) != W5500_OK)
+    {
+      LOG_CRITICAL("MQTT_TopicInit %s", SAMPLE_TYPE[site]);
+    }
+  }
+#endif
+#if USE_MQTT_BATCH
+  if (MQTT_TopicInit(&stateTopic, STATE_TOPIC) != W5500_OK)
+  {
+    LOG_CRITICAL("MQTT_TopicInit %s", STATE_TOPIC);
+  }
+#endif
+#if PROFILER_ENABLE
+  if (MQTT_TopicInit(&diagTopic, DIAGNOSTICS_BUS_TOPIC) != W5500_OK)
+  {
+    LOG_CRITICAL("MQTT_TopicInit %s", DIAGNOSTICS_BUS_TOPIC);
+  }
+#endif
+#if MQTT_BENCHMARK
+  if (MQTT_TopicInit(&benchTopic, DIAGNOSTICS_BENCH_TOPIC) != W5500_OK)
+  {
+    LOG_CRITICAL("MQTT_TopicInit %s", DIAGNOSTICS_BENCH_TOPIC);
+  }
+#endif
 
   while (1)
   {
     // initialize hardware and connect to MQTT server
     do {
+      // samples stay queued while the cable is unplugged or without a lease
+      LINK_WaitUp(&phy, portMAX_DELAY);
+      DHCP_WaitBound(&dhcp, portMAX_DELAY);
+
       rc = MQTT_Initialize(&mqtt);
       if (rc != W5500_OK)
       {
@@ -388,47 +669,175 @@ void StartMqttTask(void const * argument)
       if (rc != W5500_OK)
       {
         LOG_WARNING("MQTT_Connect %s", W5500_StatusString(rc));
+        continue;
       }
+
+      // sampling settings arrive on the command topic, samples are
+      // published without it and the subscription is retried later
+      subscribeTick = xTaskGetTickCount();
+      subscribed = CommandSubscribe();
     } while (rc != W5500_OK);
 
+    if (lostTick)
+    {
+      LOG_INFO("MQTT reconnected in %lu ms", (xTaskGetTickCount() - lostTick) * portTICK_PERIOD_MS);
+    }
+    else
+    {
+      LOG_INFO("MQTT dead server detection bound %lu ms", W5500_LivenessBound(&mqtt.liveness));
+    }
+
+#if MQTT_BENCHMARK
+    rc = MQTT_Benchmark(&mqtt, &benchTopic, BENCHMARK_PUBLISHES, SAMPLE_QOS);
+#endif
+
     while (rc == W5500_OK)
     {
-      // get sample from queue
-      xQueueReceive(sampleQueue, (void*)&sample, portMAX_DELAY);
+      // leave samples queued until the link is back
+      if (!phy.up)
+      {
+        rc = W5500_NO_LINK;
+        break;
+      }
+
+      // the connection is kept while the lease is renewed
+      if (!dhcp.bound)
+      {
+        DHCP_WaitBound(&dhcp, portMAX_DELAY);
+        continue;
+      }
 
-      // convert sample to string
-      whole = (int32_t)sample.value;
-      decimal = ((sample.value - (float)whole) * 1000);
-      if (decimal < 0)
+      if (!subscribed && xTaskGetTickCount() - subscribeTick >= SUBSCRIBE_RETRY)
       {
-        decimal *= -1;
+        subscribeTick = xTaskGetTickCount();
+        subscribed = CommandSubscribe();
       }
-      printed = snprintf(printBuf, BUF_SIZE, "%01lu.%03lu", whole, decimal);
 
-      // check for overflow
-      if (printed > BUF_SIZE)
+      // get sample from queue, keeping the connection alive while idle,
+      // polled every tick while a PINGRESP is due to time the round trip
+      if (xQueueReceive(sampleQueue, (void*)&sample, mqtt.pingPending ? 1 : LIVENESS_POLL) != pdTRUE)
       {
-        LOG_CRITICAL("BUFFER OVERFLOW %d vs %u", printed, BUF_SIZE);
+        rc = MQTT_Process(&mqtt);
         continue;
       }
 
-      // publish sample
-      rc = MQTT_Publish(
-        &mqtt,                              // client
-        SAMPLE_TYPE[sample.type],           // topic
-        strlen(SAMPLE_TYPE[sample.type]),   // topic length
-        printBuf,                           // payload
-        (uint16_t)printed                   // payload length
-      );
-      if (rc != W5500_OK)
+      // run at full speed until the queue is drained
+      crc = Clock_Boost(&clk);
+      if (crc != CLOCK_OK)
       {
-        LOG_ERROR("MQTT_Publish failed %s", W5500_StatusString(rc));
+        LOG_WARNING("Clock_Boost %s", Clock_StatusString(crc));
       }
-      else
+
+      do
+      {
+#if SAMPLE_FORMAT_TEXT
+        // convert sample to string with integer operations only
+        printed = (int)Codec_FormatFixed(printBuf, BUF_SIZE, Codec_ToFixed(sample.value, DECIMALS), DECIMALS);
+
+        // check for overflow
+        if (printed == 0)
+        {
+          LOG_CRITICAL("BUFFER OVERFLOW %u", BUF_SIZE);
+          continue;
+        }
+#endif
+
+#if USE_MQTT_FIELDS
+        // publish sample
+        rc = MQTT_Publish(
+          &mqtt,                              // client
+          &sampleTopic[sample.type],          // topic template
+          printBuf,                           // payload
+          (uint16_t)printed,                  // payload length
+          SAMPLE_QOS                          // QoS level
+        );
+        if (rc != W5500_OK)
+        {
+          LOG_ERROR("MQTT_Publish failed %s", W5500_StatusString(rc));
+        }
+        else
+        {
+          LOG_INFO("MQTT_Publish %s %s", SAMPLE_TYPE[sample.type], printBuf);
+          LINK_Published(&phy);
+        }
+#endif
+#if USE_MQTT_BATCH
+        // a repeated sample type or a full message starts the next message
+        if (rc == W5500_OK && !StateAppend(&sample, printBuf))
+        {
+          rc = StatePublish();
+          if (rc == W5500_OK)
+          {
+            StateAppend(&sample, printBuf);
+          }
+        }
+#endif
+      } while (rc == W5500_OK && xQueueReceive(sampleQueue, (void*)&sample, BatchWait()) == pdTRUE);
+
+#if USE_MQTT_BATCH
+      if (rc == W5500_OK)
+      {
+        rc = StatePublish();
+      }
+#endif
+
+#if PROFILER_ENABLE
+      // publish bus statistics, one message per call site
+      if (rc == W5500_OK && xTaskGetTickCount() - lastDiag >= DIAGNOSTICS_PERIOD)
+      {
+        lastDiag = xTaskGetTickCount();
+        for (site = 0; site < PROFILER_NUM_SITES && rc == W5500_OK; site++)
+        {
+          printed = Profiler_Format(site, diagBuf, DIAGNOSTICS_LEN);
+          if (printed < 0)
+          {
+            continue;
+          }
+          if ((size_t)printed >= DIAGNOSTICS_LEN)
+          {
+            printed = DIAGNOSTICS_LEN - 1;
+          }
+          rc = MQTT_Publish(
+            &mqtt,
+            &diagTopic,
+            diagBuf,
+            (uint16_t)printed,
+            0
+          );
+        }
+        if (rc != W5500_OK)
+        {
+          LOG_ERROR("MQTT_Publish diagnostics failed %s", W5500_StatusString(rc));
+        }
+      }
+#endif
+
+      // send publishes left behind the last SEND
+      if (rc == W5500_OK)
+      {
+        rc = MQTT_Flush(&mqtt);
+        if (rc != W5500_OK)
+        {
+          LOG_ERROR("MQTT_Flush failed %s", W5500_StatusString(rc));
+        }
+      }
+
+      // a busy connection still reads server packets and pings
+      if (rc == W5500_OK)
       {
-        LOG_INFO("MQTT_Publish %s %s", SAMPLE_TYPE[sample.type], printBuf);
+        rc = MQTT_Process(&mqtt);
       }
+
+      Clock_Release(&clk);
     }
+
+    // report how long the dead connection went unnoticed
+    lostTick = xTaskGetTickCount();
+    LOG_WARNING(
+      "MQTT connection lost %s, %lu ms after the last send",
+      W5500_StatusString(rc),
+      (lostTick - mqtt.lastActivity) * portTICK_PERIOD_MS
+    );
   }
   /* USER CODE END StartMqttTask */
 }
@@ -452,24 +861,27 @@ void StartBmeTask(void const * argument)
   bme280_ctrl_meas_t  ctrlMeas;           // BME280 measurement configuration
   bme280_ctrl_hum_t   ctrlHum;            // BME280 humidity configuration
   bme280_config_t     config;             // BME280 configuration
-  TickType_t          standby;            // standby time in ticks
+  TickType_t          period;             // sample period in ticks
+  control_settings_t  settings;           // runtime sampling settings
 
   bmeDev.addr        = BME280_DEFAULT_ADDR << 1; // shifted 7-bit I2C address
   bmeDev.hi2cx       = hi2c1;                    // I2C port of the BME280
   bmeDev.busMutex    = i2c1Mutex;                // Mutex for the I2C bus
 
-  ctrlMeas.bits.osP  = BME280_OVERSAMPLE_08;    // pressure oversampling settings
-  ctrlMeas.bits.osT  = BME280_OVERSAMPLE_08;    // temperature oversampling settings
+  // oversampling, filter and standby from the runtime settings
+  Control_Get(&control, &settings);
+  ctrlMeas.bits.osP  = settings.bmeOsP;         // pressure oversampling settings
+  ctrlMeas.bits.osT  = settings.bmeOsT;         // temperature oversampling settings
   ctrlMeas.bits.mde  = BME280_MODE_NORMAL;      // BME280 mode
-  ctrlHum.bits.osH   = BME280_OVERSAMPLE_08;    // humidity oversampling settings
-  config.bits.filter = BME280_FILTER_16;        // filter settings
-  config.bits.t_sb   = BME280_STANDBY_1000_ms;  // maximum standby to reduce self heating
+  ctrlHum.bits.osH   = settings.bmeOsH;         // humidity oversampling settings
+  config.bits.filter = settings.bmeFilter;      // filter settings
+  config.bits.t_sb   = settings.bmeStandby;     // standby between measurements
 
   // initialize the BME280
   initialize = true;
 
-  // get standby time in ticks
-  standby = (BME280_GetStandbyTime(config.bits.t_sb) * configTICK_RATE_HZ) / 1000;
+  // get sample period in ticks
+  period = (settings.bmePeriod * configTICK_RATE_HZ) / 1000;
 
   // initialize sample structures
   temperatureSample.type = TYPE_TEMPEARTURE;
@@ -509,14 +921,34 @@ void StartBmeTask(void const * argument)
       else
       {
         // enqueue samples for publishing
-        xQueueSend(sampleQueue, (void *)&temperatureSample, 0);
-        xQueueSend(sampleQueue, (void *)&pressureSample,    0);
-        xQueueSend(sampleQueue, (void *)&humiditySample,    0);
+        QueueSample(&temperatureSample);
+        QueueSample(&pressureSample);
+        QueueSample(&humiditySample);
       }
     }
 
-    // put this thread to sleep for the sample period
-    vTaskDelay(standby);
+    // put this thread to sleep for the sample period, new settings wake it
+    if (ulTaskNotifyTake(pdTRUE, period))
+    {
+      // reinitialize to write the new configuration
+      Control_Get(&control, &settings);
+      ctrlMeas.bits.osP  = settings.bmeOsP;
+      ctrlMeas.bits.osT  = settings.bmeOsT;
+      ctrlHum.bits.osH   = settings.bmeOsH;
+      config.bits.filter = settings.bmeFilter;
+      config.bits.t_sb   = settings.bmeStandby;
+      period             = (settings.bmePeriod * configTICK_RATE_HZ) / 1000;
+      initialize         = true;
+      LOG_INFO(
+        "BME280 period %lu ms, oversampling %u/%u/%u, filter %u, standby %lu ms",
+        settings.bmePeriod,
+        settings.bmeOsT,
+        settings.bmeOsP,
+        settings.bmeOsH,
+        settings.bmeFilter,
+        BME280_GetStandbyTime(config.bits.t_sb)
+      );
+    }
   }
   /* USER CODE END StartBmeTask */
 }
@@ -532,27 +964,41 @@ void StartBmeTask(void const * argument)
 void StartWizTask(void const * argument)
 {
   /* USER CODE BEGIN StartWizTask */
+  static const uint32_t LATENCY_LOG_PERIOD = 64;    // interrupts between latency logs
   w5500_dev_t* dev = (w5500_dev_t*)argument;        // W5500 device from argument
   w5500_status_t rc;                                // W5500 return codes
+  uint32_t       notify;                            // task notification value
+  w5500_int_status_t status;                        // interrupt and mask registers
   w5500_ir_t     ir   __attribute__((aligned(16))); // device interrupt register
   w5500_sn_ir_t  snir __attribute__((aligned(16))); // socket interrupt register
-  uint8_t        sir  __attribute__((aligned(16))); // socket interrupt mask
+  uint8_t        sir;                               // pending socket interrupts
   uint8_t        sn;                                // socket index
+  bool           first;                             // first event since the interrupt
+
+  Timing_StatsReset(&wizIntLatency);
 
   while (1)
   {
     // wait for a notification from the interrupt handler
-    ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+    xTaskNotifyWait(0, W5500_NOTIFY_INT, &notify, portMAX_DELAY);
+    if (!(notify & W5500_NOTIFY_INT))
+    {
+      continue;
+    }
+    first = true;
 
     // loop while the interrupt pin is in reset
     do
     {
-      rc = W5500_GetIR(dev, &ir);
+      // IR, IMR, SIR and SIMR in a single frame
+      rc = W5500_GetIntStatus(dev, &status);
       if (rc != W5500_OK)
       {
-        LOG_CRITICAL("W5500_GetIR FAILED %s", W5500_StatusString(rc));
-        ir.all = 0;
+        LOG_CRITICAL("W5500_GetIntStatus FAILED %s", W5500_StatusString(rc));
+        break;
       }
+      ir.all = status.ir.all & status.imr.all;
+      sir    = status.sir & status.simr;
 
       // print out interrupts
       if (ir.all)
@@ -573,22 +1019,18 @@ void StartWizTask(void const * argument)
         {
           LOG_WARNING("UNHANDLED EVENT: MP");
         }
+      }
 
-        // clear interrupts
-        rc = W5500_SetIR(dev, &ir);
+      // clear interrupts, including any that are masked
+      if (status.ir.all)
+      {
+        rc = W5500_SetIR(dev, &status.ir);
         if (rc != W5500_OK)
         {
           LOG_CRITICAL("W5500_SetIR FAILED %s", W5500_StatusString(rc));
         }
       }
 
-      rc = W5500_GetSIR(dev, &sir);
-      if (rc != W5500_OK)
-      {
-        LOG_CRITICAL("W5500_GetSIR FAILED %s", W5500_StatusString(rc));
-        sir = 0;
-      }
-
       for (sn = 0; sn < W5500_NUM_SOCKETS; sn++)
       {
         if (sir & (1U << sn))
@@ -600,10 +1042,23 @@ void StartWizTask(void const * argument)
             continue;
           }
 
+          // clear before setting the event bits so a new event is not lost
+          rc = W5500_SetSnIR(dev, sn, &snir);
+          if (rc != W5500_OK)
+          {
+            LOG_CRITICAL("W5500_SetSnIR FAILED %s", W5500_StatusString(rc));
+          }
+
           // set the event bits for other tasks
           if (dev->snEvent[sn] != NULL)
           {
             xEventGroupSetBits(dev->snEvent[sn], snir.all);
+            if (first)
+            {
+              // converted now, the clock profile may change before the log
+              Timing_StatsAdd(&wizIntLatency, Timing_CyclesToUs(Timing_GetCycles() - wizIntCycles));
+              first = false;
+            }
           }
           else
           {
@@ -628,22 +1083,286 @@ void StartWizTask(void const * argument)
               LOG_WARNING("UNHANDLED EVENT: SOCKET %u SEND_OK", sn);
             }
           }
-
-          rc = W5500_SetSnIR(dev, sn, &snir);
-          if (rc != W5500_OK)
-          {
-            LOG_CRITICAL("W5500_SetSnIR FAILED %s", W5500_StatusString(rc));
-          }
         }
       }
     } while (HAL_GPIO_ReadPin(dev->intPort, dev->intPin) == GPIO_PIN_RESET);
+
+    // interrupt to event group latency
+    if (wizIntLatency.count >= LATENCY_LOG_PERIOD)
+    {
+      LOG_DEBUG(
+        "W5500 INT latency us min %lu avg %lu max %lu",
+        wizIntLatency.min,
+        Timing_StatsAvg(&wizIntLatency),
+        wizIntLatency.max
+      );
+      Timing_StatsReset(&wizIntLatency);
+    }
   }
   /* USER CODE END StartWizTask */
 }
 
 /* Private application code --------------------------------------------------*/
 /* USER CODE BEGIN Application */
-     
+
+/**
+* @brief Timestamps a sample and places it in the queue of each enabled
+*        transport.
+* @param sample: sample to publish
+* @retval None
+*/
+static void QueueSample(sample_t* sample)
+{
+  sample->tick = xTaskGetTickCount();
+#if USE_MQTT_TRANSPORT
+  QueueSampleTo(sampleQueue, sample);
+#endif
+#if USE_MCAST_TRANSPORT
+  QueueSampleTo(castQueue, sample);
+#endif
+}
+
+/**
+* @brief Ticks the MQTT task waits for more samples before publishing.
+* @param None
+* @retval ticks to wait, zero when not batching
+*/
+static TickType_t BatchWait(void)
+{
+#if USE_MQTT_BATCH
+  TickType_t elapsed = xTaskGetTickCount() - state.start;
+
+  if (state.count && elapsed < STATE_DEADLINE)
+  {
+    return STATE_DEADLINE - elapsed;
+  }
+#endif
+  return 0;
+}
+
+#if USE_MQTT_BATCH
+/**
+* @brief Appends a sample to the state message.
+* @param sample: sample to append
+* @param value: formatted sample value, unused for packed records
+* @retval false when the message is full or already holds this sample type
+*/
+static bool StateAppend(const sample_t* sample, const char* value)
+{
+  sample_type_t type = sample->type;
+#if USE_MQTT_BINARY
+  (void)value; // records carry the raw sample value
+
+  if (state.count >= STATE_MAX_SAMPLES
+    || state.types & (1U << type)
+    || state.len + CODEC_RECORD_BYTES > STATE_BUF_SIZE)
+  {
+    return false;
+  }
+
+  // records follow the header written when the message is published
+  if (!state.count)
+  {
+    state.start = xTaskGetTickCount();
+    state.len   = CODEC_HEADER_BYTES;
+  }
+  state.len += Codec_EncodeRecord(
+    (uint8_t*)&state.buf[state.len],
+    type,
+    Codec_ToMilli(sample->value),
+    sample->tick * portTICK_PERIOD_MS
+  );
+#else
+  size_t room = STATE_BUF_SIZE - state.len;
+  int    printed;
+
+  if (state.count >= STATE_MAX_SAMPLES || state.types & (1U << type))
+  {
+    return false;
+  }
+
+  printed = snprintf(
+    &state.buf[state.len],
+    room,
+    "%c\"%s\":%s",
+    state.count ? ',' : '{',
+    SAMPLE_FIELD[type],
+    value
+  );
+
+  // keep room for the closing brace
+  if (printed < 0 || (size_t)printed + 1 >= room)
+  {
+    return false;
+  }
+
+  if (!state.count)
+  {
+    state.start = xTaskGetTickCount();
+  }
+  state.len += printed;
+#endif
+
+  state.types |= 1U << type;
+  state.count++;
+  return true;
+}
+
+/**
+* @brief Closes and publishes the JSON state message, then empties it.
+* @param None
+* @retval W5500 status
+*/
+static w5500_status_t StatePublish(void)
+{
+  w5500_status_t rc = W5500_OK;
+
+  if (state.count)
+  {
+#if USE_MQTT_BINARY
+    Codec_EncodeHeader((uint8_t*)state.buf, state.count);
+#else
+    state.buf[state.len++] = '}';
+#endif
+    rc = MQTT_Publish(&mqtt, &stateTopic, state.buf, (uint16_t)state.len, SAMPLE_QOS);
+    if (rc != W5500_OK)
+    {
+      LOG_ERROR("MQTT_Publish state failed %s", W5500_StatusString(rc));
+    }
+    else
+    {
+#if USE_MQTT_BINARY
+      LOG_INFO("MQTT_Publish %s %u records", STATE_TOPIC, state.count);
+#else
+      LOG_INFO("MQTT_Publish %s %.*s", STATE_TOPIC, (int)state.len, state.buf);
+#endif
+      LINK_Published(&phy);
+    }
+  }
+
+  state.len   = 0;
+  state.types = 0;
+  state.count = 0;
+  return rc;
+}
+#endif
+
+/**
+* @brief Places a sample in a queue, dropping the oldest sample when full so
+*        the newest samples are kept through a link outage.
+* @param queue: transport queue
+* @param sample: sample to publish
+* @retval None
+*/
+static void QueueSampleTo(QueueHandle_t queue, const sample_t* sample)
+{
+  sample_t oldest;
+
+  if (xQueueSend(queue, (void *)sample, 0) != pdTRUE)
+  {
+    xQueueReceive(queue, (void *)&oldest, 0);
+    xQueueSend(queue, (void *)sample, 0);
+  }
+}
+
+#if USE_MCAST_TRANSPORT
+/**
+* @brief Streams samples to the UDP multicast group.
+* @param argument: multicast client
+* @retval None
+*/
+void StartCastTask(void const * argument)
+{
+  mcast_client_t* client = (mcast_client_t*)argument; // multicast client from argument
+  w5500_status_t  rc;                                 // return code from client
+  sample_t        sample;                             // sample structure for fetching from queue
+
+  while (1)
+  {
+    // open the socket and join the group
+    do {
+      DHCP_WaitBound(&dhcp, portMAX_DELAY);
+      rc = MCAST_Initialize(client);
+      if (rc != W5500_OK)
+      {
+        LOG_WARNING("MCAST_Initialize %s", W5500_StatusString(rc));
+      }
+    } while (rc != W5500_OK);
+
+    LOG_INFO(
+      "Multicast %u.%u.%u.%u:%u joined",
+      client->group[0],
+      client->group[1],
+      client->group[2],
+      client->group[3],
+      client->groupPort
+    );
+
+    while (rc == W5500_OK)
+    {
+      xQueueReceive(castQueue, (void*)&sample, portMAX_DELAY);
+      DHCP_WaitBound(&dhcp, portMAX_DELAY);
+      rc = MCAST_Send(client, sample.type, sample.value);
+      if (rc != W5500_OK)
+      {
+        LOG_ERROR("MCAST_Send failed %s", W5500_StatusString(rc));
+      }
+    }
+  }
+}
+#endif
+
+/**
+* @brief Applies sampling settings received on the command topic.
+* @param topic: topic of the message
+* @param topicLen: length of the topic
+* @param payload: command, see control/control.h
+* @param payloadLen: length of the command
+* @retval None
+*/
+static void OnCommand(const char* topic, uint16_t topicLen, const uint8_t* payload, uint16_t payloadLen)
+{
+  control_status_t rc;
+
+  if (topicLen != strlen(COMMAND_TOPIC) || memcmp(topic, COMMAND_TOPIC, topicLen) != 0)
+  {
+    LOG_WARNING("MQTT message on unexpected topic %.*s", (int)topicLen, topic);
+    return;
+  }
+
+  rc = Control_Apply(&control, (const char*)payload, payloadLen);
+  if (rc != CONTROL_OK)
+  {
+    LOG_WARNING("Control_Apply %s %.*s", Control_StatusString(rc), (int)payloadLen, (const char*)payload);
+  }
+  else
+  {
+    LOG_INFO("Control_Apply %.*s", (int)payloadLen, (const char*)payload);
+  }
+}
+
+/**
+* @brief Subscribes to the command topic. A refused or failed subscription
+*        is only logged, a broken connection shows up on the next publish.
+* @param None
+* @retval true when the broker accepted the subscription
+*/
+static bool CommandSubscribe(void)
+{
+  w5500_status_t rc = MQTT_Subscribe(&mqtt, COMMAND_TOPIC, sizeof(COMMAND_TOPIC) - 1, 1);
+
+  if (rc != W5500_OK)
+  {
+    LOG_WARNING(
+      "MQTT_Subscribe %s, retrying in %lu s",
+      W5500_StatusString(rc),
+      SUBSCRIBE_RETRY / configTICK_RATE_HZ
+    );
+    return false;
+  }
+  return true;
+}
+
 /* USER CODE END Application */
 
 /************************ (C) COPYRIGHT STMicroelectronics *****END OF FILE****/
@@ -0,0 +1,106 @@
+/******************************************************************************
+* Copyright 2019 Alex M.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+******************************************************************************/
+
+
+
+#include "codec/codec.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Host benchmark of the sample formatting on the publish path: the float
+// split and snprintf it used to do against Codec_ToFixed and
+// Codec_FormatFixed. Host timings only, they do not carry over to the
+// Cortex-M0 where the soft-float and newlib costs are much higher.
+
+#define SAMPLES  10000000 //!< samples formatted per run
+#define DECIMALS 3        //!< fractional digits, as on the publish path
+#define BUF_SIZE 16       //!< output buffer, as on the publish path
+
+// private function prototypes
+static double Now(void);
+static float Sample(uint32_t i);
+
+int main(void)
+{
+  char buf[BUF_SIZE];
+  volatile size_t sink = 0;
+  int32_t whole;
+  int32_t decimal;
+  double start;
+  double snprintfNs;
+  double fixedNs;
+  uint32_t i;
+  float value;
+
+  // the publish path before the fixed-point formatter
+  start = Now();
+  for (i = 0; i < SAMPLES; i++)
+  {
+    value = Sample(i);
+    whole = (int32_t)value;
+    decimal = ((value - (float)whole) * 1000);
+    if (decimal < 0)
+    {
+      decimal *= -1;
+    }
+    sink += (size_t)snprintf(buf, BUF_SIZE, "%01lu.%03lu", (unsigned long)whole, (unsigned long)decimal);
+  }
+  snprintfNs = (Now() - start) / SAMPLES * 1e9;
+
+  start = Now();
+  for (i = 0; i < SAMPLES; i++)
+  {
+    value = Sample(i);
+    sink += Codec_FormatFixed(buf, BUF_SIZE, Codec_ToFixed(value, DECIMALS), DECIMALS);
+  }
+  fixedNs = (Now() - start) / SAMPLES * 1e9;
+
+  printf("float and snprintf         %6.1f ns per sample\n", snprintfNs);
+  printf("Codec_ToFixed+FormatFixed  %6.1f ns per sample\n", fixedNs);
+  return EXIT_SUCCESS;
+}
+
+/******************************************************************************
+* PRIVATE FUNCTIONS
+******************************************************************************/
+
+/*!
+* @brief  Reads the monotonic clock.
+* @return seconds
+*/
+double Now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*!
+* @brief  Generates a sample in the range of the sensors, -100 to 100.
+* @param  i - sample index
+* @return sample value
+*/
+float Sample(uint32_t i)
+{
+  return (float)(i % 200000) / 1000.0f - 100.0f;
+}
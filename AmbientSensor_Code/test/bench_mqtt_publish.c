@@ -0,0 +1,272 @@
+/******************************************************************************
+* Copyright 2019 Alex M.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+******************************************************************************/
+
+#include "host/host.h"
+#include "w5500/mqtt.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Host benchmark of the PUBLISH preparation: the per-call strlen, byte
+// swap and five segments it used to do against the topic templates. The
+// W5500 send is stubbed out with --wrap, so only the client work is
+// timed. Cycles are the x86 time stamp counter, they do not carry over to
+// the Cortex-M0 where every dropped segment also saves a HAL SPI call.
+
+#define PUBLISHES   1000000 //!< publishes per run, spread over the topics
+#define RUNS        7       //!< runs per path, the fastest one is reported
+#define NUM_TOPICS  4       //!< sample topics, as on the publish path
+#define SOCKET      0       //!< socket of the benchmark client
+
+//! sample topics as published by the fields build
+static const char* TOPICS[NUM_TOPICS] =
+{
+  "/home/bedroom/ambient/temperature",
+  "/home/bedroom/ambient/humidity",
+  "/home/bedroom/ambient/pressure",
+  "/home/bedroom/ambient/light",
+};
+static const char PAYLOAD[] = "21.375"; //!< formatted sample
+
+static w5500_dev_t   wiz;                   //!< device, only its event groups are used
+static mqtt_client_t mqtt;                  //!< benchmark client
+static mqtt_topic_t  templates[NUM_TOPICS]; //!< topic templates
+static uint32_t      segments;              //!< segments handed to the stubbed send
+static volatile size_t sink;                //!< bytes handed to the stubbed send
+
+// private function prototypes
+static w5500_status_t OldSendPublish(mqtt_client_t* client, const char* topic, uint16_t topicLen, const uint8_t* payload, uint16_t payloadLen, uint8_t qos, uint8_t dup, uint16_t id);
+static w5500_status_t OldPublish(mqtt_client_t* client, const char* topic, uint16_t topicLen, const char* payload, uint16_t payloadLen, uint8_t qos);
+static void Run(const char* name, uint8_t qos, uint8_t templated);
+static double Now(void);
+
+int main(void)
+{
+  uint8_t i;
+
+  Host_Init();
+  wiz.snEvent[SOCKET] = xEventGroupCreate();
+  mqtt.dev = &wiz;
+  mqtt.sn  = SOCKET;
+  for (i = 0; i < NUM_TOPICS; i++)
+  {
+    MQTT_TopicInit(&templates[i], TOPICS[i]);
+  }
+
+  printf("%-24s %9s %8s %9s\n", "publish path", "cycles", "ns", "segments");
+  Run("QoS 0 before templates", 0, 0);
+  Run("QoS 0 templates", 0, 1);
+  Run("QoS 1 before templates", 1, 0);
+  Run("QoS 1 templates", 1, 1);
+  return EXIT_SUCCESS;
+}
+
+// stands in for the W5500 TX buffer write, counts the segments
+w5500_status_t __wrap_W5500_SocketSendAsync(w5500_dev_t* dev, uint8_t sn, const w5500_iovec_t* iov, uint8_t iovcnt, TickType_t timeout)
+{
+  uint8_t i;
+
+  (void)dev;
+  (void)sn;
+  (void)timeout;
+  for (i = 0; i < iovcnt; i++)
+  {
+    sink += iov[i].len;
+  }
+  segments += iovcnt;
+  return W5500_OK;
+}
+
+// nothing is ever left pending by the stubbed send
+w5500_status_t __wrap_W5500_SocketSendFlush(w5500_dev_t* dev, uint8_t sn, TickType_t timeout)
+{
+  (void)dev;
+  (void)sn;
+  (void)timeout;
+  return W5500_OK;
+}
+
+/******************************************************************************
+* PRIVATE FUNCTIONS
+******************************************************************************/
+
+/*!
+* @brief  Times one publish path and reports its fastest run. The QoS 1
+*         window is emptied after every publish as if the PUBACK had arrived.
+* @param  name - label of the path
+* @param  qos - QoS level
+* @param  templated - 1 for MQTT_Publish, 0 for the path it replaced
+*/
+void Run(const char* name, uint8_t qos, uint8_t templated)
+{
+  w5500_status_t rc = W5500_OK;
+  uint64_t startCycles;
+  uint64_t elapsed;
+  uint64_t cycles = UINT64_MAX;
+  double startTime;
+  double ns = 0;
+  uint32_t i;
+  uint8_t run;
+  uint8_t t;
+
+  for (run = 0; run < RUNS && rc == W5500_OK; run++)
+  {
+    segments    = 0;
+    startTime   = Now();
+    startCycles = __builtin_ia32_rdtsc();
+    for (i = 0; i < PUBLISHES && rc == W5500_OK; i++)
+    {
+      t = i % NUM_TOPICS;
+      if (templated)
+      {
+        rc = MQTT_Publish(&mqtt, &templates[t], PAYLOAD, sizeof(PAYLOAD) - 1, qos);
+      }
+      else
+      {
+        // the topic length was measured by every caller
+        rc = OldPublish(&mqtt, TOPICS[t], strlen(TOPICS[t]), PAYLOAD, sizeof(PAYLOAD) - 1, qos);
+      }
+      mqtt.inflightHead  = 0;
+      mqtt.inflightCount = 0;
+    }
+    elapsed = __builtin_ia32_rdtsc() - startCycles;
+    if (elapsed < cycles)
+    {
+      cycles = elapsed;
+      ns     = (Now() - startTime) / PUBLISHES * 1e9;
+    }
+  }
+
+  if (rc != W5500_OK)
+  {
+    printf("%-24s failed %s\n", name, W5500_StatusString(rc));
+    exit(EXIT_FAILURE);
+  }
+  printf("%-24s %9.1f %8.1f %9.1f\n", name, (double)cycles / PUBLISHES, ns, (double)segments / PUBLISHES);
+}
+
+/*!
+* @brief  PUBLISH packet as sent before the topic templates.
+* @param  client - MQTT client
+* @param  topic - topic to publish to
+* @param  topicLen - topic length
+* @param  payload - payload to publish
+* @param  payloadLen - payload length
+* @param  qos - QoS level
+* @param  dup - set when retransmitting
+* @param  id - packet identifier
+* @return W5500 status
+*/
+w5500_status_t OldSendPublish(mqtt_client_t* client, const char* topic, uint16_t topicLen, const uint8_t* payload, uint16_t payloadLen, uint8_t qos, uint8_t dup, uint16_t id)
+{
+  static const uint16_t TOPIC_LEN_BYTES = 2;
+  mqtt_publish_t header __attribute__((aligned(16)));
+  uint8_t topicLenBuf[2] __attribute__((aligned(16)));
+  uint8_t idBuf[MQTT_PACKET_ID_LEN] __attribute__((aligned(16)));
+  uint16_t idLen = qos ? MQTT_PACKET_ID_LEN : 0;
+  uint8_t lenBytes;
+  w5500_status_t rc;
+
+  header.field.retain = 0;
+  header.field.qos    = qos;
+  header.field.dup    = dup;
+  header.field.type   = MQTT_PUBLISH;
+  lenBytes = MQTT_EncodeLength((uint32_t)topicLen + payloadLen + TOPIC_LEN_BYTES + idLen, header.field.length);
+
+  topicLenBuf[0] = (topicLen & 0xFF00) >> 8;
+  topicLenBuf[1] = (topicLen & 0x00FF) >> 0;
+  idBuf[0]       = (id & 0xFF00) >> 8;
+  idBuf[1]       = (id & 0x00FF) >> 0;
+
+  // header, topic length, topic, packet identifier and payload in a single frame
+  w5500_iovec_t iov[] = {
+    { .data = header.buf,              .len = 1 + lenBytes         },
+    { .data = topicLenBuf,             .len = TOPIC_LEN_BYTES      },
+    { .data = (const uint8_t*)topic,   .len = topicLen             },
+    { .data = idBuf,                   .len = idLen                },
+    { .data = payload,                 .len = payloadLen           },
+  };
+
+  // MQTT_Send with MQTT_ASYNC_SEND
+  rc = W5500_SocketSendAsync(client->dev, client->sn, iov, sizeof(iov) / sizeof(iov[0]), 0);
+  W5500_RETURN_NOT_OK(rc);
+  client->lastActivity = xTaskGetTickCount();
+  return rc;
+}
+
+/*!
+* @brief  MQTT_Publish as it was before the topic templates, with the same
+*         QoS 1 window bookkeeping as the current one.
+* @param  client - MQTT client
+* @param  topic - topic to publish to
+* @param  topicLen - topic length
+* @param  payload - payload to publish
+* @param  payloadLen - payload length
+* @param  qos - QoS level
+* @return W5500 status
+*/
+w5500_status_t OldPublish(mqtt_client_t* client, const char* topic, uint16_t topicLen, const char* payload, uint16_t payloadLen, uint8_t qos)
+{
+  mqtt_inflight_t* slot;
+  TickType_t startTick;
+  w5500_status_t rc;
+
+  if (qos == 0)
+  {
+    return OldSendPublish(client, topic, topicLen, (const uint8_t*)payload, payloadLen, 0, 0, 0);
+  }
+
+  // MQTT_WaitAcks with room in the window: flush, then no RECV event
+  startTick = xTaskGetTickCount();
+  (void)startTick;
+  rc = MQTT_Flush(client);
+  W5500_RETURN_NOT_OK(rc);
+  if (xEventGroupGetBits(client->dev->snEvent[client->sn]) & W5500_SN_EVENT_RECV)
+  {
+    return W5500_RECV_TIMEOUT;
+  }
+
+  slot = &client->inflight[(client->inflightHead + client->inflightCount) & (MQTT_INFLIGHT_MAX - 1)];
+  if (++client->packetId == 0)
+  {
+    client->packetId = 1;
+  }
+  slot->id         = client->packetId;
+  slot->payloadLen = payloadLen;
+  memcpy(slot->payload, payload, payloadLen);
+  client->inflightCount++;
+
+  return OldSendPublish(client, topic, topicLen, slot->payload, payloadLen, 1, 0, slot->id);
+}
+
+/*!
+* @brief  Reads the monotonic clock.
+* @return seconds
+*/
+double Now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
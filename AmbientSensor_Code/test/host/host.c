@@ -0,0 +1,424 @@
+/******************************************************************************
+* Copyright 2019 Alex M.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+******************************************************************************/
+
+
+#include "host/host.h"
+#include "queue.h"
+#include "semphr.h"
+#include "event_groups.h"
+#include "logging/logging.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// FreeRTOS and logging services for running firmware modules on a Linux
+// host. Every task is a thread, and a global lock lets one task run at a
+// time. A task keeps the lock until it blocks, like a cooperative scheduler,
+// so the firmware needs no locking beyond what it does on the target.
+// Blocking calls poll their condition, Host_Yield lets the other tasks run
+// in between. Ticks are milliseconds of wall clock time.
+
+static const long YIELD_NS = 20000; //!< sleep between polls of a blocked task
+
+//! host task
+typedef struct host_task_t
+{
+  pthread_t        thread;      //!< thread running the task
+  const char*      name;        //!< task name
+  void           (*task)(void const*); //!< task function
+  void const*      argument;    //!< task argument
+  uint32_t         notifyValue; //!< notification value
+  uint8_t          notifyPending; //!< notification received and not taken
+  volatile uint8_t suspended;   //!< suspended by vTaskSuspend
+} host_task_t;
+
+//! host semaphore, FreeRTOS queues are only used as semaphores here
+typedef struct host_semaphore_t
+{
+  UBaseType_t count; //!< available tokens
+} host_semaphore_t;
+
+//! host event group
+typedef struct host_event_group_t
+{
+  EventBits_t bits; //!< event bits
+} host_event_group_t;
+
+static pthread_mutex_t   lock = PTHREAD_MUTEX_INITIALIZER;
+static struct timespec   startTime;
+static host_task_t       mainTask = { .name = "main" };
+static __thread host_task_t* currentTask;
+static uint8_t           logging;
+
+// private function prototypes
+static void* Host_TaskEntry(void* argument);
+static uint8_t Host_Expired(TickType_t start, TickType_t timeout);
+static void Host_Notify(host_task_t* task, uint32_t value, eNotifyAction action);
+
+/*!
+* @brief  Initializes the host services, the calling thread becomes a task.
+*/
+void Host_Init(void)
+{
+  clock_gettime(CLOCK_MONOTONIC, &startTime);
+  logging = getenv(HOST_LOG_ENV) != NULL;
+  mainTask.thread = pthread_self();
+  currentTask = &mainTask;
+  pthread_mutex_lock(&lock);
+}
+
+/*!
+* @brief  Creates a task, it starts running when the calling task blocks.
+* @param  name - task name
+* @param  task - task function
+* @param  argument - task argument
+* @return task handle
+*/
+TaskHandle_t Host_TaskCreate(const char* name, void (*task)(void const*), void const* argument)
+{
+  host_task_t* t = calloc(1, sizeof(host_task_t));
+  t->name     = name;
+  t->task     = task;
+  t->argument = argument;
+  pthread_create(&t->thread, NULL, Host_TaskEntry, t);
+  return t;
+}
+
+/*!
+* @brief  Lets the other tasks run, returns once the calling task is resumed.
+*/
+void Host_Yield(void)
+{
+  const struct timespec delay = { .tv_sec = 0, .tv_nsec = YIELD_NS };
+  do
+  {
+    pthread_mutex_unlock(&lock);
+    nanosleep(&delay, NULL);
+    pthread_mutex_lock(&lock);
+  } while (currentTask->suspended);
+}
+
+/******************************************************************************
+* TASKS
+******************************************************************************/
+
+TickType_t xTaskGetTickCount(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (TickType_t)((now.tv_sec - startTime.tv_sec) * 1000 + (now.tv_nsec - startTime.tv_nsec) / 1000000);
+}
+
+TickType_t xTaskGetTickCountFromISR(void)
+{
+  return xTaskGetTickCount();
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+  return currentTask;
+}
+
+void vTaskDelay(const TickType_t xTicksToDelay)
+{
+  TickType_t start = xTaskGetTickCount();
+  do
+  {
+    Host_Yield();
+  } while (!Host_Expired(start, xTicksToDelay));
+}
+
+void vTaskDelayUntil(TickType_t * const pxPreviousWakeTime, const TickType_t xTimeIncrement)
+{
+  while (!Host_Expired(*pxPreviousWakeTime, xTimeIncrement))
+  {
+    Host_Yield();
+  }
+  *pxPreviousWakeTime += xTimeIncrement;
+}
+
+void vTaskSuspend(TaskHandle_t xTaskToSuspend)
+{
+  host_task_t* task = xTaskToSuspend ? xTaskToSuspend : currentTask;
+  task->suspended = 1;
+  if (task == currentTask)
+  {
+    Host_Yield();
+  }
+}
+
+void vTaskResume(TaskHandle_t xTaskToResume)
+{
+  ((host_task_t*)xTaskToResume)->suspended = 0;
+}
+
+// the lock already keeps the other tasks out
+void vTaskSuspendAll(void)
+{
+}
+
+BaseType_t xTaskResumeAll(void)
+{
+  return pdFALSE;
+}
+
+void vPortEnterCritical(void)
+{
+}
+
+void vPortExitCritical(void)
+{
+}
+
+/******************************************************************************
+* NOTIFICATIONS
+******************************************************************************/
+
+BaseType_t xTaskGenericNotify(TaskHandle_t xTaskToNotify, uint32_t ulValue, eNotifyAction eAction, uint32_t *pulPreviousNotificationValue)
+{
+  host_task_t* task = xTaskToNotify;
+  if (pulPreviousNotificationValue != NULL)
+  {
+    *pulPreviousNotificationValue = task->notifyValue;
+  }
+  Host_Notify(task, ulValue, eAction);
+  return pdPASS;
+}
+
+BaseType_t xTaskGenericNotifyFromISR(TaskHandle_t xTaskToNotify, uint32_t ulValue, eNotifyAction eAction, uint32_t *pulPreviousNotificationValue, BaseType_t *pxHigherPriorityTaskWoken)
+{
+  if (pxHigherPriorityTaskWoken != NULL)
+  {
+    *pxHigherPriorityTaskWoken = pdFALSE;
+  }
+  return xTaskGenericNotify(xTaskToNotify, ulValue, eAction, pulPreviousNotificationValue);
+}
+
+BaseType_t xTaskNotifyWait(uint32_t ulBitsToClearOnEntry, uint32_t ulBitsToClearOnExit, uint32_t *pulNotificationValue, TickType_t xTicksToWait)
+{
+  host_task_t* task = currentTask;
+  TickType_t start = xTaskGetTickCount();
+  BaseType_t rc = pdFALSE;
+
+  if (!task->notifyPending)
+  {
+    task->notifyValue &= ~ulBitsToClearOnEntry;
+    while (!task->notifyPending && !Host_Expired(start, xTicksToWait))
+    {
+      Host_Yield();
+    }
+  }
+
+  if (pulNotificationValue != NULL)
+  {
+    *pulNotificationValue = task->notifyValue;
+  }
+  if (task->notifyPending)
+  {
+    task->notifyValue &= ~ulBitsToClearOnExit;
+    task->notifyPending = 0;
+    rc = pdTRUE;
+  }
+  return rc;
+}
+
+BaseType_t xTaskNotifyStateClear(TaskHandle_t xTask)
+{
+  host_task_t* task = xTask ? xTask : currentTask;
+  BaseType_t rc = task->notifyPending ? pdPASS : pdFAIL;
+  task->notifyPending = 0;
+  return rc;
+}
+
+/******************************************************************************
+* SEMAPHORES
+******************************************************************************/
+
+QueueHandle_t xQueueCreateMutex(const uint8_t ucQueueType)
+{
+  host_semaphore_t* sem = calloc(1, sizeof(host_semaphore_t));
+  (void)ucQueueType;
+  sem->count = 1;
+  return sem;
+}
+
+BaseType_t xQueueGenericReceive(QueueHandle_t xQueue, void * const pvBuffer, TickType_t xTicksToWait, const BaseType_t xJustPeek)
+{
+  host_semaphore_t* sem = xQueue;
+  TickType_t start = xTaskGetTickCount();
+  (void)pvBuffer;
+  (void)xJustPeek;
+
+  while (sem->count == 0)
+  {
+    if (Host_Expired(start, xTicksToWait))
+    {
+      return pdFALSE;
+    }
+    Host_Yield();
+  }
+  sem->count--;
+  return pdTRUE;
+}
+
+BaseType_t xQueueGenericSend(QueueHandle_t xQueue, const void * const pvItemToQueue, TickType_t xTicksToWait, const BaseType_t xCopyPosition)
+{
+  host_semaphore_t* sem = xQueue;
+  (void)pvItemToQueue;
+  (void)xTicksToWait;
+  (void)xCopyPosition;
+  sem->count++;
+  return pdTRUE;
+}
+
+/******************************************************************************
+* EVENT GROUPS
+******************************************************************************/
+
+EventGroupHandle_t xEventGroupCreate(void)
+{
+  return calloc(1, sizeof(host_event_group_t));
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToSet)
+{
+  host_event_group_t* group = xEventGroup;
+  group->bits |= uxBitsToSet;
+  return group->bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToClear)
+{
+  host_event_group_t* group = xEventGroup;
+  EventBits_t bits = group->bits;
+  group->bits &= ~uxBitsToClear;
+  return bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToWaitFor, const BaseType_t xClearOnExit, const BaseType_t xWaitForAllBits, TickType_t xTicksToWait)
+{
+  host_event_group_t* group = xEventGroup;
+  TickType_t start = xTaskGetTickCount();
+  EventBits_t bits;
+
+  while (1)
+  {
+    bits = group->bits;
+    if (xWaitForAllBits ? (bits & uxBitsToWaitFor) == uxBitsToWaitFor : (bits & uxBitsToWaitFor) != 0)
+    {
+      if (xClearOnExit)
+      {
+        group->bits &= ~uxBitsToWaitFor;
+      }
+      return bits;
+    }
+    if (Host_Expired(start, xTicksToWait))
+    {
+      return bits;
+    }
+    Host_Yield();
+  }
+}
+
+/******************************************************************************
+* LOGGING
+******************************************************************************/
+
+void Log_printf(const char* fmt, ...)
+{
+  va_list args;
+  if (!logging)
+  {
+    return;
+  }
+  va_start(args, fmt);
+  vfprintf(stderr, fmt, args);
+  va_end(args);
+}
+
+void Log_Assert(char* condition, char* file, uint32_t line)
+{
+  fprintf(stderr, "ASSERT FAILED %s at %s:%u in task %s\n", condition, file, line, currentTask->name);
+  abort();
+}
+
+/******************************************************************************
+* PRIVATE FUNCTIONS
+******************************************************************************/
+
+/*!
+* @brief  Runs a task once the creating task blocks.
+* @param  argument - host task
+* @return never returns for FreeRTOS tasks
+*/
+void* Host_TaskEntry(void* argument)
+{
+  host_task_t* task = argument;
+  pthread_mutex_lock(&lock);
+  currentTask = task;
+  task->task(task->argument);
+  pthread_mutex_unlock(&lock);
+  return NULL;
+}
+
+/*!
+* @brief  Checks if a timeout has passed.
+* @param  start - tick the timeout started at
+* @param  timeout - timeout in ticks
+* @return 1 if the timeout has passed
+*/
+uint8_t Host_Expired(TickType_t start, TickType_t timeout)
+{
+  return timeout != portMAX_DELAY && xTaskGetTickCount() - start >= timeout;
+}
+
+/*!
+* @brief  Updates a notification value and marks it pending.
+* @param  task - task to notify
+* @param  value - notification value
+* @param  action - how the value is applied
+*/
+void Host_Notify(host_task_t* task, uint32_t value, eNotifyAction action)
+{
+  switch (action)
+  {
+    case eSetBits:
+      task->notifyValue |= value;
+      break;
+    case eIncrement:
+      task->notifyValue++;
+      break;
+    case eSetValueWithOverwrite:
+      task->notifyValue = value;
+      break;
+    case eSetValueWithoutOverwrite:
+      if (!task->notifyPending)
+      {
+        task->notifyValue = value;
+      }
+      break;
+    case eNoAction:
+      break;
+  }
+  task->notifyPending = 1;
+}
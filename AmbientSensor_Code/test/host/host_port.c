@@ -0,0 +1,48 @@
+/******************************************************************************
+* Copyright 2019 Alex M.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+******************************************************************************/
+
+
+#include <stdint.h>
+#include <time.h>
+
+// Cortex-M0 port functions, kept apart from the FreeRTOS headers that
+// declare them naked
+
+uint32_t SystemCoreClock = 1000000000U; //!< cycles are nanoseconds on the host
+
+uint32_t ulSetInterruptMaskFromISR(void)
+{
+  return 0;
+}
+
+void vClearInterruptMaskFromISR(uint32_t ulMask)
+{
+  (void)ulMask;
+}
+
+// replaces the SysTick based timestamp, linked with --wrap=Timing_GetCycles
+uint32_t __wrap_Timing_GetCycles(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint32_t)(now.tv_sec * 1000000000ULL + now.tv_nsec);
+}
@@ -0,0 +1,261 @@
+/******************************************************************************
+* Copyright 2019 Alex M.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+******************************************************************************/
+
+
+
+#include "codec/codec.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Formats int32 values with Codec_FormatFixed and compares the result with a
+// reference formatter, then parses it back to the same value. Edge values are
+// checked for every precision, and Codec_ToFixed for rounding and saturation.
+// Every value within DENSE_LIMIT is checked, and the rest of the int32 range
+// every SPARSE_STEP values. Set CODEC_EXHAUSTIVE=1 ("make exhaustive") to
+// check every int32 value, minutes on a single CPU. The range is split over
+// one thread per CPU.
+
+#define EXHAUSTIVE_DECIMALS 3          //!< precision used on the publish path
+#define DENSE_LIMIT         (1L << 24) //!< values checked one by one, beyond any sensor range
+#define SPARSE_STEP         4099       //!< prime stride over the rest of the range
+#define MAX_THREADS         64         //!< most threads the range is split over
+#define MAX_REPORTED        5          //!< mismatches printed per thread
+
+//! part of the int32 range checked by one thread
+typedef struct range_t
+{
+  int64_t  first;      //!< first value
+  int64_t  end;        //!< one past the last value
+  int      exhaustive; //!< check every value
+  uint64_t checked;    //!< values checked
+  uint64_t failures;   //!< mismatches
+} range_t;
+
+static uint32_t failures; //!< failed checks outside the threads
+
+// private function prototypes
+static void Check(int condition, const char* what, int32_t value, uint8_t decimals);
+static size_t Reference(char* buf, int32_t value, uint8_t decimals);
+static int CheckValue(int32_t value, uint8_t decimals);
+static void* CheckRange(void* argument);
+
+int main(void)
+{
+  static const int32_t EDGES[] = {
+    0, 1, -1, 5, -5, 9, -9, 10, -10, 999, -999, 1000, -1000, 1001, -1001,
+    123456789, -123456789, 999999999, -999999999, 1000000000, -1000000000,
+    INT32_MAX, INT32_MIN, INT32_MIN + 1,
+  };
+  pthread_t threads[MAX_THREADS];
+  range_t ranges[MAX_THREADS];
+  const char* env = getenv("CODEC_EXHAUSTIVE");
+  uint64_t total = 0;
+  uint64_t checked = 0;
+  int64_t span;
+  long cpus;
+  char buf[CODEC_FIXED_CHARS];
+  size_t i;
+  int t;
+  uint8_t decimals;
+
+  // edge values for every precision
+  for (decimals = 0; decimals <= CODEC_MAX_DECIMALS; decimals++)
+  {
+    for (i = 0; i < sizeof(EDGES) / sizeof(EDGES[0]); i++)
+    {
+      Check(CheckValue(EDGES[i], decimals), "edge value", EDGES[i], decimals);
+    }
+  }
+
+  // buffer length and precision limits
+  Check(Codec_FormatFixed(buf, 6, -1234, 3) == 0, "NUL does not fit", -1234, 3);
+  Check(Codec_FormatFixed(buf, 7, -1234, 3) == 6, "exact fit", -1234, 3);
+  Check(Codec_FormatFixed(buf, sizeof(buf), INT32_MIN, CODEC_MAX_DECIMALS) == CODEC_FIXED_CHARS - 1,
+    "CODEC_FIXED_CHARS fits", INT32_MIN, CODEC_MAX_DECIMALS);
+  Check(Codec_FormatFixed(buf, sizeof(buf), 1, CODEC_MAX_DECIMALS + 1) == 0,
+    "too many decimals rejected", 1, CODEC_MAX_DECIMALS + 1);
+
+  // rounding half away from zero and saturation
+  Check(Codec_ToFixed(21.5f, 3) == 21500, "Codec_ToFixed", 21500, 3);
+  Check(Codec_ToFixed(-0.0005f, 3) == -1, "Codec_ToFixed half away from zero", -1, 3);
+  Check(Codec_ToFixed(0.0004f, 3) == 0, "Codec_ToFixed rounds down", 0, 3);
+  Check(Codec_ToFixed(-0.5f, 0) == -1, "Codec_ToFixed half away from zero", -1, 0);
+  Check(Codec_ToFixed(1e10f, 3) == INT32_MAX, "Codec_ToFixed saturates", INT32_MAX, 3);
+  Check(Codec_ToFixed(-1e10f, 3) == INT32_MIN, "Codec_ToFixed saturates", INT32_MIN, 3);
+  Check(Codec_ToFixed(1.0f, CODEC_MAX_DECIMALS + 1) == 1000000000, "Codec_ToFixed clamps decimals", 1000000000, CODEC_MAX_DECIMALS);
+
+  // every int32 value at the publish path precision
+  cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cpus < 1)
+  {
+    cpus = 1;
+  }
+  if (cpus > MAX_THREADS)
+  {
+    cpus = MAX_THREADS;
+  }
+  span = ((int64_t)INT32_MAX - INT32_MIN + 1) / cpus;
+  for (t = 0; t < cpus; t++)
+  {
+    ranges[t].first    = (int64_t)INT32_MIN + t * span;
+    ranges[t].end      = t == cpus - 1 ? (int64_t)INT32_MAX + 1 : ranges[t].first + span;
+    ranges[t].exhaustive = env != NULL && env[0] == '1';
+    ranges[t].checked  = 0;
+    ranges[t].failures = 0;
+    errno = pthread_create(&threads[t], NULL, CheckRange, &ranges[t]);
+    if (errno)
+    {
+      perror("pthread_create");
+      return EXIT_FAILURE;
+    }
+  }
+  for (t = 0; t < cpus; t++)
+  {
+    pthread_join(threads[t], NULL);
+    total += ranges[t].failures;
+    checked += ranges[t].checked;
+  }
+  printf("%" PRIu64 " int32 values with %u decimals on %ld threads: %" PRIu64 " mismatches\n",
+    checked, EXHAUSTIVE_DECIMALS, cpus, total);
+
+  printf("%s\n", failures || total ? "FAILED" : "PASSED");
+  return failures || total ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/******************************************************************************
+* PRIVATE FUNCTIONS
+******************************************************************************/
+
+/*!
+* @brief  Records the result of a check.
+* @param  condition - non-zero on success
+* @param  what - check description
+* @param  value - fixed-point value under test
+* @param  decimals - fractional digits
+*/
+void Check(int condition, const char* what, int32_t value, uint8_t decimals)
+{
+  if (!condition)
+  {
+    printf("FAIL: %s, value %ld decimals %u\n", what, (long)value, decimals);
+    failures++;
+  }
+}
+
+/*!
+* @brief  Reference formatter, digits from native 64-bit division rather than
+*         the shift-and-add division under test.
+* @param  buf - output buffer, at least CODEC_FIXED_CHARS long
+* @param  value - value scaled by 10^decimals
+* @param  decimals - fractional digits in value
+* @return characters written without the NUL
+*/
+size_t Reference(char* buf, int32_t value, uint8_t decimals)
+{
+  int64_t  signedValue = value;
+  uint64_t mag = signedValue < 0 ? (uint64_t)-signedValue : (uint64_t)signedValue;
+  char     digits[CODEC_FIXED_CHARS];
+  size_t   n = 0;
+  size_t   i = 0;
+
+  do
+  {
+    digits[n++] = (char)('0' + mag % 10);
+    mag /= 10;
+  } while (mag || n < (size_t)decimals + 1);
+
+  if (value < 0)
+  {
+    buf[i++] = '-';
+  }
+  while (n--)
+  {
+    buf[i++] = digits[n];
+    if (n == decimals && n)
+    {
+      buf[i++] = '.';
+    }
+  }
+  buf[i] = '\0';
+  return i;
+}
+
+/*!
+* @brief  Compares Codec_FormatFixed with the reference formatter and parses
+*         the result back.
+* @param  value - value scaled by 10^decimals
+* @param  decimals - fractional digits in value
+* @return non-zero when the value formats and parses back correctly
+*/
+int CheckValue(int32_t value, uint8_t decimals)
+{
+  char     out[CODEC_FIXED_CHARS];
+  char     ref[CODEC_FIXED_CHARS];
+  size_t   n = Codec_FormatFixed(out, sizeof(out), value, decimals);
+  uint64_t mag = 0;
+  size_t   i = out[0] == '-';
+
+  if (n != Reference(ref, value, decimals) || strcmp(out, ref) != 0)
+  {
+    return 0;
+  }
+
+  // parse back, skipping the point
+  for (; i < n; i++)
+  {
+    if (out[i] != '.')
+    {
+      mag = mag * 10 + (uint64_t)(out[i] - '0');
+    }
+  }
+  return (out[0] == '-' ? -(int64_t)mag : (int64_t)mag) == value;
+}
+
+/*!
+* @brief  Checks the values of a range at the publish path precision.
+* @param  argument - range, its failure count is updated
+* @return NULL
+*/
+void* CheckRange(void* argument)
+{
+  range_t* range = argument;
+  int64_t value;
+
+  for (value = range->first; value < range->end;)
+  {
+    range->checked++;
+    if (!CheckValue((int32_t)value, EXHAUSTIVE_DECIMALS))
+    {
+      if (range->failures++ < MAX_REPORTED)
+      {
+        printf("FAIL: value %" PRId64 " decimals %u\n", value, EXHAUSTIVE_DECIMALS);
+      }
+    }
+    value += range->exhaustive || (value >= -DENSE_LIMIT && value < DENSE_LIMIT) ? 1 : SPARSE_STEP;
+  }
+  return NULL;
+}
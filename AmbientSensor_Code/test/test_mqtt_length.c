@@ -0,0 +1,113 @@
+/******************************************************************************
+* Copyright 2019 Alex M.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+******************************************************************************/
+
+
+
+#include "w5500/mqtt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Checks the MQTT remaining length codec at the boundaries of each encoded
+// length, the example encodings of the specification [MQTT-2.2.3] and the
+// lengths and encodings that must be rejected.
+
+//! remaining length and its expected encoding
+typedef struct length_case_t
+{
+  uint32_t len;                         //!< remaining length
+  uint8_t  bytes;                       //!< encoded length
+  uint8_t  enc[MQTT_REM_LEN_BYTES];     //!< encoded bytes
+} length_case_t;
+
+static const length_case_t CASES[] =
+{
+  { 0,                 1, {0x00}                   },
+  { 127,               1, {0x7F}                   },
+  { 128,               2, {0x80, 0x01}             },
+  { 16383,             2, {0xFF, 0x7F}             },
+  { 16384,             3, {0x80, 0x80, 0x01}       },
+  { 2097151,           3, {0xFF, 0xFF, 0x7F}       },
+  { 2097152,           4, {0x80, 0x80, 0x80, 0x01} },
+  { MQTT_REM_LEN_MAX,  4, {0xFF, 0xFF, 0xFF, 0x7F} },
+};
+
+static uint32_t failures; //!< failed checks
+
+// private function prototypes
+static void Check(int condition, const char* what, uint32_t len);
+
+int main(void)
+{
+  static const uint8_t TOO_LONG[] = {0xFF, 0xFF, 0xFF, 0xFF, 0x7F};
+  uint8_t buf[MQTT_REM_LEN_BYTES + 1];
+  uint32_t len;
+  uint8_t n;
+  size_t i;
+
+  for (i = 0; i < sizeof(CASES) / sizeof(CASES[0]); i++)
+  {
+    memset(buf, 0xAA, sizeof(buf));
+    n = MQTT_EncodeLength(CASES[i].len, buf);
+    Check(n == CASES[i].bytes, "encoded length", CASES[i].len);
+    Check(memcmp(buf, CASES[i].enc, CASES[i].bytes) == 0, "encoded bytes", CASES[i].len);
+    Check(buf[CASES[i].bytes] == 0xAA, "no write past the encoding", CASES[i].len);
+
+    len = 0xFFFFFFFFUL;
+    n = MQTT_DecodeLength(CASES[i].enc, MQTT_REM_LEN_BYTES, &len);
+    Check(n == CASES[i].bytes && len == CASES[i].len, "round trip", CASES[i].len);
+
+    // a partly received length is not decoded
+    if (CASES[i].bytes > 1)
+    {
+      n = MQTT_DecodeLength(CASES[i].enc, CASES[i].bytes - 1, &len);
+      Check(n == 0, "truncated encoding rejected", CASES[i].len);
+    }
+  }
+
+  Check(MQTT_EncodeLength(MQTT_REM_LEN_MAX + 1, buf) == 0, "length over the maximum rejected", MQTT_REM_LEN_MAX + 1);
+  Check(MQTT_EncodeLength(0xFFFFFFFFUL, buf) == 0, "length over the maximum rejected", 0xFFFFFFFFUL);
+  Check(MQTT_DecodeLength(TOO_LONG, sizeof(TOO_LONG), &len) == 0, "5 byte encoding rejected", 0);
+  Check(MQTT_DecodeLength(TOO_LONG, 0, &len) == 0, "empty encoding rejected", 0);
+
+  printf("%s\n", failures ? "FAILED" : "PASSED");
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/******************************************************************************
+* PRIVATE FUNCTIONS
+******************************************************************************/
+
+/*!
+* @brief  Records the result of a check.
+* @param  condition - non-zero on success
+* @param  what - check description
+* @param  len - remaining length under test
+*/
+void Check(int condition, const char* what, uint32_t len)
+{
+  if (!condition)
+  {
+    printf("FAIL: %s, length %lu\n", what, (unsigned long)len);
+    failures++;
+  }
+}
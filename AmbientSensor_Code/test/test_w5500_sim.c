@@ -0,0 +1,864 @@
+/******************************************************************************
+* Copyright 2019 Alex M.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+******************************************************************************/
+
+
+#include "host/host.h"
+#include "w5500_sim/w5500_sim.h"
+#include "w5500/w5500.h"
+#include "w5500/dhcp.h"
+#include "w5500/link.h"
+#include "w5500/mqtt.h"
+#include "profiler/profiler.h"
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Runs the W5500 driver, the PHY link monitor, the DHCP client and the MQTT
+// client against the simulator, with a stand-in DHCP server and MQTT broker
+// on the loopback interface. Prints the SPI traffic of each operation and
+// fails on any driver error or simulator protocol violation.
+
+static const uint16_t   PUBLISH_COUNT  = 200;         //!< publishes per QoS level
+static const TickType_t DHCP_TIMEOUT   = 5000;        //!< time to get a lease
+static const TickType_t BROKER_TIMEOUT = 5000;        //!< time for the broker to see every publish
+static const char       TOPIC[]        = "ambient/sim/temperature"; //!< publish topic
+static const char       PAYLOAD[] __attribute__((aligned(16))) = "21.500"; //!< publish payload
+static const char       CLIENT_ID[] __attribute__((aligned(16))) = "sim";  //!< MQTT client ID
+static const char       COMMAND_TOPIC[] __attribute__((aligned(16))) = "ambient/sim/cmd"; //!< subscribed topic, odd length
+static const char       COMMAND[]      = "interval=5"; //!< message the broker publishes on COMMAND_TOPIC
+static const uint16_t   COMMAND_ID     = 0x1234;      //!< packet identifier of the broker publish
+static const uint8_t    OFFER_IP[4]    = {10, 0, 0, 50}; //!< address handed out by the DHCP stand-in
+static const uint16_t   KEEP_ALIVE     = 2;           //!< keep alive in s for the PINGREQ checks
+static const uint32_t   PING_DELAY     = 50;          //!< ms the broker holds a PINGRESP back
+static const uint32_t   RTT_SLACK      = 20;          //!< ms of host scheduling allowed on top of PING_DELAY
+static const TickType_t PING_TIMEOUT   = 5000;        //!< MQTT_PING_TIMEOUT in mqtt.c
+
+//! traffic of the interrupt task, taken out of the operation being measured
+typedef struct int_stats_t
+{
+  uint32_t frames; //!< SPI frames
+  uint32_t bytes;  //!< SPI bytes
+  uint32_t calls;  //!< HAL SPI calls
+} int_stats_t;
+
+//! stand-in MQTT broker state, written by the broker thread
+typedef struct broker_t
+{
+  int               listenFd;   //!< listening socket
+  uint16_t          port;       //!< loopback port
+  volatile uint32_t connects;   //!< CONNECT packets
+  volatile uint32_t publishes[2]; //!< PUBLISH packets by QoS
+  volatile uint32_t pubacks;    //!< PUBACK packets for the broker publish
+  volatile uint32_t pingreqs;   //!< PINGREQ packets
+  volatile uint32_t pingDelay;  //!< ms to wait before each PINGRESP
+  volatile uint8_t  holdAcks;   //!< QoS 1 publishes to leave unacknowledged before dropping the connection
+  volatile uint8_t  held;       //!< publishes left unacknowledged
+  volatile uint8_t  resent;     //!< publishes received again with DUP set
+  uint16_t          heldIds[MQTT_INFLIGHT_MAX];   //!< packet identifiers of the held publishes
+  uint16_t          resentIds[MQTT_INFLIGHT_MAX]; //!< packet identifiers of the resent publishes
+  volatile uint32_t errors;     //!< malformed packets
+} broker_t;
+
+//! message passed to the MQTT message handler
+typedef struct message_t
+{
+  volatile uint32_t count;      //!< messages received
+  uint32_t          payloadAt;  //!< payload address
+  uint16_t          topicLen;   //!< topic length
+  uint16_t          payloadLen; //!< payload length
+  char              topic[32];  //!< topic copy
+  char              payload[32]; //!< payload copy
+} message_t;
+
+//! stand-in DHCP server state, written by the server thread
+typedef struct dhcp_server_t
+{
+  int               fd;     //!< UDP socket
+  uint16_t          port;   //!< loopback port
+  volatile uint32_t acks;   //!< DHCPACK messages sent
+} dhcp_server_t;
+
+static GPIO_TypeDef      gpio[3];     //!< chip select, reset and interrupt ports
+static SPI_HandleTypeDef hspi;        //!< SPI port
+static w5500_dev_t       wiz;         //!< W5500 device
+static link_monitor_t    phy;         //!< PHY link monitor
+static dhcp_client_t     dhcp;        //!< DHCP client
+static mqtt_client_t     mqtt;        //!< MQTT client
+static mqtt_topic_t      topic;       //!< publish template
+static TaskHandle_t      wizTask;     //!< interrupt task
+static int_stats_t       intStats;    //!< interrupt task traffic
+static volatile uint32_t intCycles;   //!< timestamp of the last interrupt edge
+static timing_stats_t    intLatency;  //!< interrupt to event group latency in us
+static broker_t          broker;      //!< stand-in MQTT broker
+static dhcp_server_t     dhcpServer;  //!< stand-in DHCP server
+static message_t         message;     //!< last received message
+static uint32_t          failures;    //!< failed checks
+
+// the DHCP client task is not in dhcp.h, the firmware declares it the same way
+extern void DHCP_ClientTask(void const * argument);
+
+// private function prototypes
+static void Check(int condition, const char* what);
+static void Report(const char* what, const w5500_sim_stats_t* start, const int_stats_t* intStart, uint32_t count);
+static void SimTask(void const* argument);
+static void WizTask(void const* argument);
+static void OnMessage(const char* topic, uint16_t topicLen, const uint8_t* payload, uint16_t payloadLen);
+static uint16_t Listen(int type, int* fd);
+static int ReadPacket(int fd, uint8_t* packet, size_t size, uint32_t* remLen);
+static void* BrokerThread(void* argument);
+static void* DhcpServerThread(void* argument);
+static void InitializeDevices(void);
+
+int main(void)
+{
+  w5500_sim_stats_t start;
+  int_stats_t intStart;
+  pthread_t thread;
+  w5500_status_t rc;
+  TickType_t startTick;
+  timing_stats_t cycles;
+  uint32_t cycleStart;
+  uint32_t elapsed;
+  uint32_t pingreqs;
+  profiler_site_t site;
+  char line[96];
+  uint16_t i;
+  uint8_t qos;
+
+  Host_Init();
+  W5500Sim_Init(&gpio[0], 1, &gpio[1], 1, &gpio[2], 1);
+
+  // stand-ins on ephemeral loopback ports
+  broker.port = Listen(SOCK_STREAM, &broker.listenFd);
+  dhcpServer.port = Listen(SOCK_DGRAM, &dhcpServer.fd);
+  InitializeDevices();
+  W5500Sim_MapPort(DHCP_DESTINATION_PORT, dhcpServer.port);
+  pthread_create(&thread, NULL, BrokerThread, &broker);
+  pthread_create(&thread, NULL, DhcpServerThread, &dhcpServer);
+
+  Host_TaskCreate("sim", SimTask, NULL);
+  wizTask = Host_TaskCreate("wiz", WizTask, &wiz);
+
+  printf("%-28s %8s %8s %8s\n", "operation", "frames", "bytes", "calls");
+
+  start = *W5500Sim_Stats();
+  intStart = intStats;
+  rc = W5500_Initialize(&wiz);
+  Check(rc == W5500_OK, "W5500_Initialize");
+  Report("W5500_Initialize", &start, &intStart, 1);
+
+  // the link monitor and DHCP client run as they do on the target, this
+  // task waits for the lease like the transport tasks
+  dhcp.boundTask[0] = xTaskGetCurrentTaskHandle();
+  phy.notifyTask[0] = Host_TaskCreate("dhcp", DHCP_ClientTask, &dhcp);
+  Host_TaskCreate("link", LINK_MonitorTask, &phy);
+  Check(DHCP_WaitBound(&dhcp, DHCP_TIMEOUT), "DHCP lease");
+  Check(dhcp.state == DHCP_BOUND, "DHCP state");
+  Check(memcmp(dhcp.clientIp, OFFER_IP, sizeof(OFFER_IP)) == 0, "DHCP address");
+
+  start = *W5500Sim_Stats();
+  intStart = intStats;
+  rc = MQTT_Initialize(&mqtt);
+  Check(rc == W5500_OK, "MQTT_Initialize");
+  if (rc == W5500_OK)
+  {
+    rc = MQTT_Connect(&mqtt);
+    Check(rc == W5500_OK, "MQTT_Connect");
+  }
+  Report("MQTT_Initialize+Connect", &start, &intStart, 1);
+
+  MQTT_TopicInit(&topic, TOPIC);
+  for (qos = 0; qos <= 1 && rc == W5500_OK; qos++)
+  {
+    start = *W5500Sim_Stats();
+    intStart = intStats;
+    startTick = xTaskGetTickCount();
+    Timing_StatsReset(&cycles);
+    for (i = 0; i < PUBLISH_COUNT && rc == W5500_OK; i++)
+    {
+      cycleStart = Timing_GetCycles();
+      rc = MQTT_Publish(&mqtt, &topic, PAYLOAD, sizeof(PAYLOAD) - 1, qos);
+      Timing_StatsAdd(&cycles, Timing_GetCycles() - cycleStart);
+    }
+    Check(rc == W5500_OK, "MQTT_Publish");
+    rc = MQTT_Flush(&mqtt);
+    Check(rc == W5500_OK, "MQTT_Flush");
+    Report(qos ? "MQTT_Publish QoS 1" : "MQTT_Publish QoS 0", &start, &intStart, PUBLISH_COUNT);
+
+    // QoS 1 publishes leave the window as the PUBACKs arrive
+    while ((broker.publishes[qos] < PUBLISH_COUNT || (qos && mqtt.inflightCount))
+      && xTaskGetTickCount() - startTick < BROKER_TIMEOUT)
+    {
+      rc = MQTT_Process(&mqtt);
+      vTaskDelay(1);
+    }
+    elapsed = xTaskGetTickCount() - startTick;
+    Check(broker.publishes[qos] == PUBLISH_COUNT, "broker received every publish");
+    Check(mqtt.inflightCount == 0, "QoS 1 window drained");
+    // host cycles are nanoseconds, see host_port.c
+    printf(
+      "  %u publishes in %lu ms, MQTT_Publish min %lu avg %lu ns on the host\n",
+      PUBLISH_COUNT,
+      (unsigned long)elapsed,
+      (unsigned long)cycles.min,
+      (unsigned long)Timing_StatsAvg(&cycles)
+    );
+  }
+
+  // the broker answers the subscription with a QoS 1 publish on a topic of
+  // odd length, the payload must still be read into an even address
+  mqtt.onMessage = OnMessage;
+  rc = MQTT_Subscribe(&mqtt, COMMAND_TOPIC, sizeof(COMMAND_TOPIC) - 1, 1);
+  Check(rc == W5500_OK, "MQTT_Subscribe");
+  startTick = xTaskGetTickCount();
+  while (rc == W5500_OK
+    && (message.count == 0 || broker.pubacks == 0)
+    && xTaskGetTickCount() - startTick < BROKER_TIMEOUT)
+  {
+    rc = MQTT_Process(&mqtt);
+    vTaskDelay(1);
+  }
+  Check(rc == W5500_OK, "MQTT_Process");
+  Check(message.count == 1, "subscribed message received");
+  Check(message.topicLen == sizeof(COMMAND_TOPIC) - 1
+    && memcmp(message.topic, COMMAND_TOPIC, message.topicLen) == 0, "subscribed message topic");
+  Check(message.payloadLen == sizeof(COMMAND) - 1
+    && memcmp(message.payload, COMMAND, message.payloadLen) == 0, "subscribed message payload");
+  Check((message.payloadAt & 1U) == 0, "subscribed message payload aligned");
+  Check(broker.pubacks == 1, "subscribed message acknowledged");
+
+  // the broker drops the connection with the QoS 1 window full, the client
+  // must send the same publishes again with DUP set once reconnected
+  broker.holdAcks = MQTT_INFLIGHT_MAX;
+  for (i = 0; i < MQTT_INFLIGHT_MAX && rc == W5500_OK; i++)
+  {
+    rc = MQTT_Publish(&mqtt, &topic, PAYLOAD, sizeof(PAYLOAD) - 1, 1);
+  }
+  Check(rc == W5500_OK, "MQTT_Publish unacknowledged window");
+  rc = MQTT_Flush(&mqtt);
+  startTick = xTaskGetTickCount();
+  while (rc == W5500_OK && xTaskGetTickCount() - startTick < BROKER_TIMEOUT)
+  {
+    rc = MQTT_Process(&mqtt);
+    vTaskDelay(1);
+  }
+  Check(rc != W5500_OK, "dropped connection noticed");
+  Check(broker.held == MQTT_INFLIGHT_MAX, "broker held the window");
+  Check(mqtt.inflightCount == MQTT_INFLIGHT_MAX, "window unacknowledged");
+
+  // reconnect the way the MQTT task does
+  rc = MQTT_Initialize(&mqtt);
+  if (rc == W5500_OK)
+  {
+    rc = MQTT_Connect(&mqtt);
+  }
+  Check(rc == W5500_OK, "MQTT reconnect");
+  startTick = xTaskGetTickCount();
+  while (rc == W5500_OK
+    && (mqtt.inflightCount || broker.resent < MQTT_INFLIGHT_MAX)
+    && xTaskGetTickCount() - startTick < BROKER_TIMEOUT)
+  {
+    rc = MQTT_Process(&mqtt);
+    vTaskDelay(1);
+  }
+  Check(rc == W5500_OK, "MQTT_Process after reconnect");
+  Check(mqtt.inflightCount == 0, "resent window acknowledged");
+  Check(broker.resent == MQTT_INFLIGHT_MAX
+    && memcmp(broker.resentIds, broker.heldIds, sizeof(broker.heldIds)) == 0,
+    "window resent in order with DUP set and the same packet identifiers");
+
+  // a PINGREQ due right after a publish is queued behind its SEND, then
+  // only MQTT_Process runs like in the idle MQTT task, the round trip is
+  // timed from the SEND
+  mqtt.keepAlive   = KEEP_ALIVE;
+  broker.pingDelay = PING_DELAY;
+  pingreqs         = broker.pingreqs;
+  vTaskDelay(KEEP_ALIVE * configTICK_RATE_HZ);
+  rc = MQTT_Publish(&mqtt, &topic, PAYLOAD, sizeof(PAYLOAD) - 1, 0);
+  startTick = xTaskGetTickCount();
+  while (rc == W5500_OK && mqtt.rtt.count == 0 && xTaskGetTickCount() - startTick < BROKER_TIMEOUT)
+  {
+    rc = MQTT_Process(&mqtt);
+    vTaskDelay(1);
+  }
+  Check(rc == W5500_OK, "MQTT_Process keep alive");
+  Check(broker.pingreqs == pingreqs + 1 && mqtt.rtt.count == 1, "PINGREQ answered");
+  Check(mqtt.rtt.min >= PING_DELAY && mqtt.rtt.max <= PING_DELAY + RTT_SLACK, "PINGREQ round trip time");
+  printf("PINGREQ round trip %lu ms, broker delay %lu ms\n", (unsigned long)mqtt.rtt.max, (unsigned long)PING_DELAY);
+
+  // a PINGRESP later than MQTT_PING_TIMEOUT tears the connection down
+  broker.pingDelay = PING_TIMEOUT + 1000;
+  startTick = xTaskGetTickCount();
+  while (rc == W5500_OK && xTaskGetTickCount() - startTick < KEEP_ALIVE * configTICK_RATE_HZ + 2 * PING_TIMEOUT)
+  {
+    rc = MQTT_Process(&mqtt);
+    vTaskDelay(1);
+  }
+  elapsed = xTaskGetTickCount() - mqtt.pingTick;
+  Check(rc == W5500_MQTT_PING_TIMEOUT, "late PINGRESP detected");
+  Check(elapsed >= PING_TIMEOUT && elapsed <= PING_TIMEOUT + RTT_SLACK, "PINGRESP deadline counted from the PINGREQ");
+
+  Check(broker.connects == 2, "one broker reconnection");
+  Check(broker.errors == 0, "well formed MQTT packets");
+  Check(W5500Sim_Stats()->errors == 0, "no simulator protocol violations");
+
+  Check(intLatency.count > 0, "interrupt latency sampled");
+  printf(
+    "interrupt to event group latency min %lu avg %lu max %lu us over %lu interrupts on the host\n",
+    (unsigned long)intLatency.min,
+    (unsigned long)Timing_StatsAvg(&intLatency),
+    (unsigned long)intLatency.max,
+    (unsigned long)intLatency.count
+  );
+
+  // bus timing of the whole run, PROFILER_CRITICAL only has samples with
+  // W5500_USE_DMA set to 0
+  for (site = PROFILER_W5500_READ; site <= PROFILER_W5500_WRITE; site++)
+  {
+    Profiler_Format(site, line, sizeof(line));
+    printf("  %s on the host\n", line);
+  }
+  Profiler_Format(PROFILER_CRITICAL, line, sizeof(line));
+  printf("  %s on the host\n", line);
+
+  printf("%s\n", failures ? "FAILED" : "PASSED");
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// W5500 interrupt, called by the simulator on the falling edge
+void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
+{
+  (void)GPIO_Pin;
+  if (wizTask != NULL)
+  {
+    intCycles = Timing_GetCycles();
+    xTaskNotify(wizTask, W5500_NOTIFY_INT, eSetBits);
+  }
+}
+
+// DMA completion, called by the simulator like the DMA interrupt
+void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef* hspi)
+{
+  BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+  (void)hspi;
+  W5500_TransferCompleteFromISR(&wiz, &xHigherPriorityTaskWoken);
+}
+
+void HAL_SPI_RxCpltCallback(SPI_HandleTypeDef* hspi)
+{
+  HAL_SPI_TxCpltCallback(hspi);
+}
+
+/******************************************************************************
+* PRIVATE FUNCTIONS
+******************************************************************************/
+
+/*!
+* @brief  Records the result of a check.
+* @param  condition - non-zero on success
+* @param  what - check description
+*/
+void Check(int condition, const char* what)
+{
+  if (!condition)
+  {
+    printf("FAIL: %s\n", what);
+    failures++;
+  }
+}
+
+/*!
+* @brief  Prints the SPI traffic of an operation, without the interrupt task.
+* @param  what - operation
+* @param  start - simulator counters before the operation
+* @param  intStart - interrupt task counters before the operation
+* @param  count - repetitions of the operation
+*/
+void Report(const char* what, const w5500_sim_stats_t* start, const int_stats_t* intStart, uint32_t count)
+{
+  const w5500_sim_stats_t* now = W5500Sim_Stats();
+  uint32_t frames = now->frames - start->frames - (intStats.frames - intStart->frames);
+  uint32_t bytes  = now->bytes - start->bytes - (intStats.bytes - intStart->bytes);
+  uint32_t calls  = now->calls - start->calls - (intStats.calls - intStart->calls);
+
+  printf("%-28s %8.1f %8.1f %8.1f\n", what, (double)frames / count, (double)bytes / count, (double)calls / count);
+  printf(
+    "  interrupt task %.1f frames %.1f bytes per operation\n",
+    (double)(intStats.frames - intStart->frames) / count,
+    (double)(intStats.bytes - intStart->bytes) / count
+  );
+}
+
+/*!
+* @brief  Runs the simulator and raises the interrupt pin edge, like the
+*         EXTI interrupt on the target.
+* @param  argument - unused
+*/
+void SimTask(void const* argument)
+{
+  uint8_t asserted = 0;
+  (void)argument;
+
+  while (1)
+  {
+    W5500Sim_Poll();
+    if (W5500Sim_IntAsserted() && !asserted)
+    {
+      xTaskNotify(wizTask, W5500_NOTIFY_INT, eSetBits);
+    }
+    asserted = W5500Sim_IntAsserted();
+    Host_Yield();
+  }
+}
+
+/*!
+* @brief  Dispatches W5500 interrupts to the socket event groups, the same
+*         sequence as StartWizTask.
+* @param  argument - W5500 device
+*/
+void WizTask(void const* argument)
+{
+  w5500_dev_t* dev = (w5500_dev_t*)argument;
+  w5500_int_status_t status;
+  w5500_sn_ir_t snir __attribute__((aligned(16)));
+  w5500_sim_stats_t start;
+  w5500_status_t rc;
+  uint32_t notify;
+  uint8_t sir;
+  uint8_t sn;
+  uint8_t first;
+
+  Timing_StatsReset(&intLatency);
+
+  while (1)
+  {
+    xTaskNotifyWait(0, W5500_NOTIFY_INT, &notify, portMAX_DELAY);
+    if (!(notify & W5500_NOTIFY_INT))
+    {
+      continue;
+    }
+    first = 1;
+
+    start = *W5500Sim_Stats();
+    do
+    {
+      rc = W5500_GetIntStatus(dev, &status);
+      Check(rc == W5500_OK, "W5500_GetIntStatus");
+      if (rc != W5500_OK)
+      {
+        break;
+      }
+      if (status.ir.all)
+      {
+        W5500_SetIR(dev, &status.ir);
+      }
+
+      sir = status.sir & status.simr;
+      for (sn = 0; sn < W5500_NUM_SOCKETS; sn++)
+      {
+        if (sir & (1U << sn))
+        {
+          rc = W5500_GetSnIR(dev, sn, &snir);
+          Check(rc == W5500_OK, "W5500_GetSnIR");
+          rc = W5500_SetSnIR(dev, sn, &snir);
+          Check(rc == W5500_OK, "W5500_SetSnIR");
+          if (dev->snEvent[sn] != NULL)
+          {
+            xEventGroupSetBits(dev->snEvent[sn], snir.all);
+            if (first)
+            {
+              Timing_StatsAdd(&intLatency, Timing_CyclesToUs(Timing_GetCycles() - intCycles));
+              first = 0;
+            }
+          }
+        }
+      }
+    } while (HAL_GPIO_ReadPin(dev->intPort, dev->intPin) == GPIO_PIN_RESET);
+
+    intStats.frames += W5500Sim_Stats()->frames - start.frames;
+    intStats.bytes  += W5500Sim_Stats()->bytes - start.bytes;
+    intStats.calls  += W5500Sim_Stats()->calls - start.calls;
+  }
+}
+
+/*!
+* @brief  Keeps a copy of a received message.
+* @param  topic - message topic
+* @param  topicLen - topic length
+* @param  payload - message payload
+* @param  payloadLen - payload length
+*/
+void OnMessage(const char* topic, uint16_t topicLen, const uint8_t* payload, uint16_t payloadLen)
+{
+  message.count++;
+  message.payloadAt  = (uint32_t)(uintptr_t)payload;
+  message.topicLen   = topicLen;
+  message.payloadLen = payloadLen;
+  memcpy(message.topic, topic, topicLen < sizeof(message.topic) ? topicLen : sizeof(message.topic));
+  memcpy(message.payload, payload, payloadLen < sizeof(message.payload) ? payloadLen : sizeof(message.payload));
+}
+
+/*!
+* @brief  Opens a loopback socket on an ephemeral port.
+* @param  type - SOCK_STREAM or SOCK_DGRAM
+* @param  fd - opened socket
+* @return port
+*/
+uint16_t Listen(int type, int* fd)
+{
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family      = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  *fd = socket(AF_INET, type, 0);
+  if (*fd < 0
+    || bind(*fd, (struct sockaddr*)&addr, sizeof(addr)) != 0
+    || (type == SOCK_STREAM && listen(*fd, 1) != 0)
+    || getsockname(*fd, (struct sockaddr*)&addr, &len) != 0)
+  {
+    perror("stand-in socket");
+    exit(EXIT_FAILURE);
+  }
+  return ntohs(addr.sin_port);
+}
+
+/*!
+* @brief  Reads exactly len bytes from a stream socket.
+* @param  fd - socket
+* @param  buf - buffer
+* @param  len - bytes to read
+* @return 1 on success, 0 once the connection is closed
+*/
+static int ReadAll(int fd, uint8_t* buf, size_t len)
+{
+  ssize_t n;
+  while (len)
+  {
+    n = recv(fd, buf, len, 0);
+    if (n <= 0)
+    {
+      return 0;
+    }
+    buf += n;
+    len -= (size_t)n;
+  }
+  return 1;
+}
+
+/*!
+* @brief  Reads one MQTT packet.
+* @param  fd - stream socket
+* @param  packet - fixed header byte followed by the remaining length bytes
+* @param  size - size of packet
+* @param  remLen - remaining length
+* @return 1 on success, 0 once the connection is closed, -1 if malformed
+*/
+static int ReadPacket(int fd, uint8_t* packet, size_t size, uint32_t* remLen)
+{
+  uint8_t lenByte;
+  uint8_t shift = 0;
+
+  if (!ReadAll(fd, packet, 1))
+  {
+    return 0;
+  }
+  *remLen = 0;
+  do
+  {
+    if (!ReadAll(fd, &lenByte, 1))
+    {
+      return 0;
+    }
+    *remLen |= (uint32_t)(lenByte & 0x7F) << shift;
+    shift += 7;
+  } while ((lenByte & 0x80) && shift < 28);
+  if (*remLen > size - 1)
+  {
+    return -1;
+  }
+  return ReadAll(fd, &packet[1], *remLen);
+}
+
+/*!
+* @brief  Stand-in MQTT broker, acknowledges CONNECT, QoS 1 PUBLISH,
+*         SUBSCRIBE and PINGREQ and checks every PUBLISH it receives. Each
+*         subscription is answered with a QoS 1 publish of COMMAND. While
+*         holdAcks is set, QoS 1 publishes are left unacknowledged and the
+*         connection is dropped after the last one, the client must then
+*         send them again with DUP set.
+* @param  argument - broker state
+* @return never returns
+*/
+void* BrokerThread(void* argument)
+{
+  broker_t* b = argument;
+  uint8_t packet[2048];
+  uint8_t reply[64];
+  uint32_t remLen;
+  uint16_t topicLen;
+  uint16_t id;
+  uint8_t qos;
+  int drop;
+  int one = 1;
+  int rc;
+  int fd;
+
+  while ((fd = accept(b->listenFd, NULL, NULL)) >= 0)
+  {
+    // small replies would otherwise wait for the delayed ACK of the last one
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    drop = 0;
+    while (!drop && (rc = ReadPacket(fd, packet, sizeof(packet), &remLen)) > 0)
+    {
+      switch (packet[0] >> 4)
+      {
+        case MQTT_CONNECT:
+          // the session is kept, a reconnect resumes it
+          reply[0] = MQTT_CONNACK << 4;
+          reply[1] = 2;
+          reply[2] = b->connects ? 0x01 : 0x00;
+          reply[3] = MQTT_CON_ACCEPT;
+          b->connects++;
+          send(fd, reply, 4, 0);
+          break;
+        case MQTT_PUBLISH:
+          qos = (packet[0] >> 1) & 0x03;
+          topicLen = ((uint16_t)packet[1] << 8) | packet[2];
+          if (qos > 1
+            || topicLen != sizeof(TOPIC) - 1
+            || memcmp(&packet[3], TOPIC, topicLen) != 0
+            || remLen != 2 + topicLen + (qos ? 2 : 0) + sizeof(PAYLOAD) - 1
+            || memcmp(&packet[3 + topicLen + (qos ? 2 : 0)], PAYLOAD, sizeof(PAYLOAD) - 1) != 0)
+          {
+            b->errors++;
+            break;
+          }
+          b->publishes[qos]++;
+          if (qos)
+          {
+            id = ((uint16_t)packet[3 + topicLen] << 8) | packet[4 + topicLen];
+            if (packet[0] & 0x08)
+            {
+              if (b->resent < MQTT_INFLIGHT_MAX)
+              {
+                b->resentIds[b->resent] = id;
+              }
+              b->resent++;
+            }
+            else if (b->holdAcks)
+            {
+              b->heldIds[b->held++] = id;
+              drop = --b->holdAcks == 0;
+              break;
+            }
+            reply[0] = MQTT_PUBACK << 4;
+            reply[1] = 2;
+            reply[2] = packet[3 + topicLen];
+            reply[3] = packet[4 + topicLen];
+            send(fd, reply, 4, 0);
+          }
+          break;
+        case MQTT_SUBSCRIBE:
+          reply[0] = MQTT_SUBACK << 4;
+          reply[1] = 3;
+          reply[2] = packet[1];
+          reply[3] = packet[2];
+          reply[4] = packet[remLen];
+          send(fd, reply, 5, 0);
+
+          // publish on the subscribed topic, copied from the topic filter
+          topicLen = ((uint16_t)packet[3] << 8) | packet[4];
+          if (6 + topicLen + sizeof(COMMAND) - 1 > sizeof(reply))
+          {
+            b->errors++;
+            break;
+          }
+          reply[0] = (MQTT_PUBLISH << 4) | (1 << 1);
+          reply[1] = (uint8_t)(2 + topicLen + 2 + sizeof(COMMAND) - 1);
+          memcpy(&reply[2], &packet[3], 2 + topicLen);
+          reply[4 + topicLen] = (COMMAND_ID & 0xFF00) >> 8;
+          reply[5 + topicLen] = (COMMAND_ID & 0x00FF) >> 0;
+          memcpy(&reply[6 + topicLen], COMMAND, sizeof(COMMAND) - 1);
+          send(fd, reply, 2 + reply[1], 0);
+          break;
+        case MQTT_PUBACK:
+          if (remLen != 2 || (((uint16_t)packet[1] << 8) | packet[2]) != COMMAND_ID)
+          {
+            b->errors++;
+            break;
+          }
+          b->pubacks++;
+          break;
+        case MQTT_PINGREQ:
+          b->pingreqs++;
+          if (b->pingDelay)
+          {
+            usleep(b->pingDelay * 1000);
+          }
+          reply[0] = MQTT_PINGRESP << 4;
+          reply[1] = 0;
+          send(fd, reply, 2, 0);
+          break;
+        default:
+          b->errors++;
+          break;
+      }
+    }
+    if (rc < 0)
+    {
+      b->errors++;
+    }
+    close(fd);
+  }
+  return NULL;
+}
+
+/*!
+* @brief  Appends a DHCP option.
+* @param  opt - option field
+* @param  ptr - option field index, advanced past the option
+* @param  code - option code
+* @param  data - option data
+* @param  len - option data length
+*/
+static void AppendOption(uint8_t* opt, size_t* ptr, uint8_t code, const uint8_t* data, uint8_t len)
+{
+  opt[(*ptr)++] = code;
+  opt[(*ptr)++] = len;
+  memcpy(&opt[*ptr], data, len);
+  *ptr += len;
+}
+
+/*!
+* @brief  Stand-in DHCP server, answers DISCOVER with an OFFER and REQUEST
+*         with an ACK for OFFER_IP.
+* @param  argument - server state
+* @return never returns
+*/
+void* DhcpServerThread(void* argument)
+{
+  static const uint8_t SERVER_IP[4]  = {10, 0, 0, 1};
+  static const uint8_t SUBNET[4]     = {255, 255, 255, 0};
+  static const uint8_t LEASE_TIME[4] = {0, 0, 0x0E, 0x10};
+  dhcp_server_t* s = argument;
+  struct sockaddr_in client;
+  socklen_t clientLen;
+  dhcp_msg_t msg;
+  uint8_t type;
+  size_t ptr;
+  ssize_t n;
+
+  while (1)
+  {
+    clientLen = sizeof(client);
+    n = recvfrom(s->fd, msg.buf, sizeof(msg.buf), 0, (struct sockaddr*)&client, &clientLen);
+    if (n != DHCP_MSG_SIZE || msg.field.op != DHCP_BOOTREQUEST)
+    {
+      continue;
+    }
+
+    // the message type is the first option behind the magic cookie
+    if (msg.field.opt[4] != DHCP_OPTION_MESSAGE_TYPE)
+    {
+      continue;
+    }
+    type = msg.field.opt[6] == DHCP_DISCOVER ? DHCP_OFFER : DHCP_ACK;
+
+    msg.field.op = DHCP_BOOTREPLY;
+    memcpy(msg.field.yiAddr, OFFER_IP, sizeof(OFFER_IP));
+    memset(&msg.field.opt[4], 0, DHCP_OPT_SIZE - 4);
+    ptr = 4;
+    AppendOption(msg.field.opt, &ptr, DHCP_OPTION_MESSAGE_TYPE, &type, 1);
+    AppendOption(msg.field.opt, &ptr, DHCP_OPTION_SERVER_ID, SERVER_IP, sizeof(SERVER_IP));
+    AppendOption(msg.field.opt, &ptr, DHCP_OPTION_LEASE_TIME, LEASE_TIME, sizeof(LEASE_TIME));
+    AppendOption(msg.field.opt, &ptr, DHCP_OPTION_SUBNET_MASK, SUBNET, sizeof(SUBNET));
+    AppendOption(msg.field.opt, &ptr, DHCP_OPTION_ROUTER, SERVER_IP, sizeof(SERVER_IP));
+    msg.field.opt[ptr] = DHCP_OPTION_END;
+    sendto(s->fd, msg.buf, DHCP_MSG_SIZE, 0, (struct sockaddr*)&client, clientLen);
+    if (type == DHCP_ACK)
+    {
+      s->acks++;
+    }
+  }
+  return NULL;
+}
+
+/*!
+* @brief  Sets up the devices like InitializeShared does on the target.
+*/
+void InitializeDevices(void)
+{
+  static const uint8_t TX_BUF_SIZE[W5500_NUM_SOCKETS] = {8, 2, 1, 1, 1, 1, 1, 1};
+  static const uint8_t RX_BUF_SIZE[W5500_NUM_SOCKETS] = {4, 4, 2, 2, 1, 1, 1, 1};
+  static const uint8_t MAC[MAC_BYTES] = {0x46, 0x52, 0x45, 0x53, 0x48, 0x00};
+  static char hostName[] = "sim";
+  uint8_t sn;
+
+  wiz.hspix    = &hspi;
+  wiz.csPort   = &gpio[0];
+  wiz.csPin    = 1;
+  wiz.rstPort  = &gpio[1];
+  wiz.rstPin   = 1;
+  wiz.intPort  = &gpio[2];
+  wiz.intPin   = 1;
+  wiz.busMutex = xSemaphoreCreateMutex();
+  wiz.xferTask = NULL;
+  memcpy(wiz.mac, MAC, MAC_BYTES);
+  for (sn = 0; sn < W5500_NUM_SOCKETS; sn++)
+  {
+    wiz.snState[sn]   = W5500_SN_FREE;
+    wiz.txBufSize[sn] = TX_BUF_SIZE[sn];
+    wiz.rxBufSize[sn] = RX_BUF_SIZE[sn];
+  }
+
+  phy.dev    = &wiz;
+  phy.period = 250;
+
+  dhcp.dev         = &wiz;
+  dhcp.link        = &phy;
+  dhcp.sn          = W5500_SN_NONE;
+  dhcp.hostName    = hostName;
+  dhcp.hostNameLen = sizeof(hostName) - 1;
+  dhcp.state       = DHCP_INIT;
+
+  mqtt.dev              = &wiz;
+  mqtt.sn               = W5500_SN_NONE;
+  mqtt.ip[0]            = 10;
+  mqtt.ip[1]            = 0;
+  mqtt.ip[2]            = 0;
+  mqtt.ip[3]            = 4;
+  mqtt.destinationPort  = broker.port;
+  mqtt.sourcePort       = 33650;
+  mqtt.liveness.rtr     = 2000;
+  mqtt.liveness.rcr     = 3;
+  mqtt.liveness.kpalvtr = 1;
+  mqtt.keepAlive        = 60;
+  Timing_StatsReset(&mqtt.rtt);
+  mqtt.clientId         = CLIENT_ID;
+}
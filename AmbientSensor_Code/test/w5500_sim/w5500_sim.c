@@ -0,0 +1,969 @@
+/******************************************************************************
+* Copyright 2019 Alex M.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+******************************************************************************/
+
+
+#include "w5500_sim/w5500_sim.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// W5500 model: the common and socket register blocks, the socket TX and RX
+// rings and the command register, driven through the HAL SPI and GPIO calls
+// the driver makes. Socket traffic is bridged to Linux sockets on the
+// loopback interface, every destination address maps to 127.0.0.1.
+
+static const uint8_t CHIP_VERSION     = 0x04; //!< VERSIONR reset value
+static const uint8_t PHYCFGR_RESET    = 0xBE; //!< 100 Mbps full duplex, link bit clear
+
+#define SPI_FRAME_BYTES 3 //!< address and control bytes
+#define NUM_PORT_MAPS   4 //!< destination ports redirected to host ports
+
+// registers from Table 3.1: Common Register Block
+#define REG_IR        0x15 //!< [1] [RW] interrupt
+#define REG_IMR       0x16 //!< [1] [RW] interrupt mask
+#define REG_SIR       0x17 //!< [1] [R]  socket interrupt
+#define REG_SIMR      0x18 //!< [1] [RW] socket interrupt mask
+#define REG_RTR       0x19 //!< [2] [RW] retry time
+#define REG_RCR       0x1B //!< [1] [RW] retry count
+#define REG_PHYCFGR   0x2E //!< [1] [RW] PHY configuration
+#define REG_VERSIONR  0x39 //!< [1] [R]  chip version
+#define COMMON_BYTES  0x40 //!< length of the common register block
+
+// registers from Table 3.2: Socket Register Block
+#define REG_SN_MR         0x00 //!< [1] [RW] mode
+#define REG_SN_CR         0x01 //!< [1] [RW] command
+#define REG_SN_IR         0x02 //!< [1] [R]  interrupt
+#define REG_SN_SR         0x03 //!< [1] [R]  status
+#define REG_SN_DPORT      0x10 //!< [2] [RW] destination port
+#define REG_SN_TTL        0x16 //!< [1] [RW] IP TTL
+#define REG_SN_RXBUF_SIZE 0x1E //!< [1] [RW] RX buffer size
+#define REG_SN_TXBUF_SIZE 0x1F //!< [1] [RW] TX buffer size
+#define REG_SN_TX_FSR     0x20 //!< [2] [R]  TX free size
+#define REG_SN_TX_RD      0x22 //!< [2] [R]  TX read pointer
+#define REG_SN_TX_WR      0x24 //!< [2] [RW] TX write pointer
+#define REG_SN_RX_RSR     0x26 //!< [2] [R]  RX received size
+#define REG_SN_RX_RD      0x28 //!< [2] [RW] RX read pointer
+#define REG_SN_RX_WR      0x2A //!< [2] [R]  RX write pointer
+#define REG_SN_IMR        0x2C //!< [1] [RW] interrupt mask
+#define REG_SN_FRAG       0x2D //!< [2] [RW] fragment offset in IP header
+#define REG_SN_KPALVTR    0x2F //!< [1] [RW] keep alive timer
+#define SOCKET_BYTES      0x30 //!< length of the socket register block
+
+// socket modes, commands, states and interrupts
+#define SN_PROTO_TCP       0x01
+#define SN_PROTO_UDP       0x02
+#define SN_CMD_OPEN        0x01
+#define SN_CMD_CONNECT     0x04
+#define SN_CMD_DISCON      0x08
+#define SN_CMD_CLOSE       0x10
+#define SN_CMD_SEND        0x20
+#define SN_CMD_SEND_KEEP   0x22
+#define SN_CMD_RECV        0x40
+#define SN_SR_CLOSED       0x00
+#define SN_SR_INIT         0x13
+#define SN_SR_SYNSENT      0x15
+#define SN_SR_ESTABLISHED  0x17
+#define SN_SR_CLOSE_WAIT   0x1C
+#define SN_SR_UDP          0x22
+#define SN_IR_CON          (1U << 0)
+#define SN_IR_DISCON       (1U << 1)
+#define SN_IR_RECV         (1U << 2)
+#define SN_IR_TIMEOUT      (1U << 3)
+#define SN_IR_SENDOK       (1U << 4)
+#define UDP_HEADER_BYTES   8
+
+//! SPI frame decoder states
+typedef enum
+{
+  FRAME_IDLE   = 0U, //!< chip select high
+  FRAME_HEADER = 1U, //!< address and control phase
+  FRAME_DATA   = 2U, //!< data phase
+} frame_state_t;
+
+//! simulated socket
+typedef struct sim_socket_t
+{
+  uint8_t  regs[SOCKET_BYTES];       //!< socket register block
+  uint8_t  tx[W5500_SIM_BUF_BYTES];  //!< TX ring
+  uint8_t  rx[W5500_SIM_BUF_BYTES];  //!< RX ring
+  int      fd;                       //!< Linux socket, -1 when closed
+  uint8_t  sendPending;              //!< SEND issued and not on the wire yet
+  uint16_t sendWr;                   //!< TX write pointer of the pending SEND
+} sim_socket_t;
+
+//! simulated chip
+typedef struct sim_chip_t
+{
+  GPIO_TypeDef*     csPort;                         //!< chip select port
+  uint16_t          csPin;                          //!< chip select pin
+  GPIO_TypeDef*     rstPort;                        //!< reset port
+  uint16_t          rstPin;                         //!< reset pin
+  GPIO_TypeDef*     intPort;                        //!< interrupt port
+  uint16_t          intPin;                         //!< interrupt pin
+  uint8_t           common[COMMON_BYTES];           //!< common register block
+  sim_socket_t      sn[W5500_SIM_NUM_SOCKETS];      //!< sockets
+  uint16_t          portMap[NUM_PORT_MAPS][2];      //!< destination port, host port
+  uint8_t           link;                           //!< PHY link state
+  uint8_t           intAsserted;                    //!< interrupt pin state
+  frame_state_t     frame;                          //!< SPI frame decoder state
+  uint8_t           header[SPI_FRAME_BYTES];        //!< received header bytes
+  uint8_t           headerLen;                      //!< received header length
+  uint16_t          addr;                           //!< current address
+  uint8_t           bsb;                            //!< block select bits
+  uint8_t           write;                          //!< frame writes
+  w5500_sim_stats_t stats;                          //!< traffic counters
+} sim_chip_t;
+
+static sim_chip_t chip;
+
+// private function prototypes
+static void W5500Sim_Reset(void);
+static void W5500Sim_Error(const char* msg, uint8_t sn);
+static void W5500Sim_UpdateInt(void);
+static uint8_t W5500Sim_Clock(uint8_t mosi);
+static uint8_t W5500Sim_Read(uint8_t bsb, uint16_t addr);
+static void W5500Sim_Write(uint8_t bsb, uint16_t addr, uint8_t value);
+static void W5500Sim_Command(uint8_t sn, uint8_t cmd);
+static void W5500Sim_Close(uint8_t sn);
+static void W5500Sim_Connect(uint8_t sn);
+static void W5500Sim_Send(uint8_t sn);
+static void W5500Sim_Receive(uint8_t sn);
+static struct sockaddr_in W5500Sim_Destination(uint8_t sn);
+static inline uint16_t W5500Sim_Get16(const uint8_t* reg);
+static inline void W5500Sim_Set16(uint8_t* reg, uint16_t value);
+static inline uint16_t W5500Sim_Size(const sim_socket_t* s, uint8_t reg);
+
+/*!
+* @brief  Initializes the simulator and resets the chip.
+* @param  csPort - chip select port
+* @param  csPin - chip select pin
+* @param  rstPort - reset port
+* @param  rstPin - reset pin
+* @param  intPort - interrupt port
+* @param  intPin - interrupt pin
+*/
+void W5500Sim_Init(
+  GPIO_TypeDef* csPort,
+  uint16_t      csPin,
+  GPIO_TypeDef* rstPort,
+  uint16_t      rstPin,
+  GPIO_TypeDef* intPort,
+  uint16_t      intPin
+)
+{
+  uint8_t sn;
+
+  memset(&chip, 0, sizeof(chip));
+  chip.csPort  = csPort;
+  chip.csPin   = csPin;
+  chip.rstPort = rstPort;
+  chip.rstPin  = rstPin;
+  chip.intPort = intPort;
+  chip.intPin  = intPin;
+  chip.link    = 1;
+  for (sn = 0; sn < W5500_SIM_NUM_SOCKETS; sn++)
+  {
+    chip.sn[sn].fd = -1;
+  }
+  W5500Sim_Reset();
+}
+
+/*!
+* @brief  Redirects a destination port to a host port, so stand-ins for
+*         servers on privileged ports can run unprivileged.
+* @param  port - destination port written to Sn_DPORT
+* @param  hostPort - loopback port to use instead
+*/
+void W5500Sim_MapPort(uint16_t port, uint16_t hostPort)
+{
+  size_t i;
+  for (i = 0; i < NUM_PORT_MAPS; i++)
+  {
+    if (chip.portMap[i][0] == 0 || chip.portMap[i][0] == port)
+    {
+      chip.portMap[i][0] = port;
+      chip.portMap[i][1] = hostPort;
+      return;
+    }
+  }
+  W5500Sim_Error("port map full", 0);
+}
+
+/*!
+* @brief  Sets the PHY link state reported in PHYCFGR.
+* @param  up - 1 for link up
+*/
+void W5500Sim_SetLink(uint8_t up)
+{
+  chip.link = up;
+}
+
+/*!
+* @brief  Moves data between the socket rings and the Linux sockets and
+*         completes pending connects and sends, call periodically.
+*/
+void W5500Sim_Poll(void)
+{
+  struct pollfd pfd;
+  sim_socket_t* s;
+  socklen_t len;
+  int err;
+  uint8_t sn;
+
+  for (sn = 0; sn < W5500_SIM_NUM_SOCKETS; sn++)
+  {
+    s = &chip.sn[sn];
+    if (s->fd < 0)
+    {
+      continue;
+    }
+
+    // a non-blocking connect completes when the socket becomes writable
+    if (s->regs[REG_SN_SR] == SN_SR_SYNSENT)
+    {
+      pfd.fd      = s->fd;
+      pfd.events  = POLLOUT;
+      pfd.revents = 0;
+      if (poll(&pfd, 1, 0) <= 0)
+      {
+        continue;
+      }
+      err = 0;
+      len = sizeof(err);
+      getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+      if (err)
+      {
+        W5500Sim_Close(sn);
+        s->regs[REG_SN_IR] |= SN_IR_TIMEOUT;
+        continue;
+      }
+      s->regs[REG_SN_SR]  = SN_SR_ESTABLISHED;
+      s->regs[REG_SN_IR] |= SN_IR_CON;
+    }
+
+    if (s->sendPending)
+    {
+      W5500Sim_Send(sn);
+    }
+    if (s->fd >= 0)
+    {
+      W5500Sim_Receive(sn);
+    }
+  }
+  W5500Sim_UpdateInt();
+}
+
+/*!
+* @brief  Gets the state of the active low interrupt pin.
+* @return 1 if the interrupt pin is asserted
+*/
+uint8_t W5500Sim_IntAsserted(void)
+{
+  uint8_t sir = W5500Sim_Read(0, REG_SIR);
+  return (chip.common[REG_IR] & chip.common[REG_IMR]) || (sir & chip.common[REG_SIMR]);
+}
+
+/*!
+* @brief  Resets the traffic counters.
+*/
+void W5500Sim_StatsReset(void)
+{
+  memset(&chip.stats, 0, sizeof(chip.stats));
+}
+
+/*!
+* @brief  Gets the traffic counters.
+* @return traffic counters since the last reset
+*/
+const w5500_sim_stats_t* W5500Sim_Stats(void)
+{
+  return &chip.stats;
+}
+
+/******************************************************************************
+* HAL
+******************************************************************************/
+
+void HAL_GPIO_WritePin(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState)
+{
+  if (GPIOx == chip.csPort && GPIO_Pin == chip.csPin)
+  {
+    if (PinState == GPIO_PIN_RESET)
+    {
+      if (chip.frame != FRAME_IDLE)
+      {
+        W5500Sim_Error("chip select asserted twice", 0);
+      }
+      chip.frame     = FRAME_HEADER;
+      chip.headerLen = 0;
+      chip.stats.frames++;
+    }
+    else
+    {
+      if (chip.frame == FRAME_HEADER)
+      {
+        W5500Sim_Error("frame ended in the header", 0);
+      }
+      chip.frame = FRAME_IDLE;
+      W5500Sim_UpdateInt();
+    }
+  }
+  else if (GPIOx == chip.rstPort && GPIO_Pin == chip.rstPin && PinState == GPIO_PIN_RESET)
+  {
+    W5500Sim_Reset();
+  }
+}
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin)
+{
+  if (GPIOx == chip.intPort && GPIO_Pin == chip.intPin)
+  {
+    return W5500Sim_IntAsserted() ? GPIO_PIN_RESET : GPIO_PIN_SET;
+  }
+  return GPIO_PIN_RESET;
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+  uint16_t i;
+  (void)Timeout;
+  chip.stats.calls++;
+  for (i = 0; i < Size; i++)
+  {
+    W5500Sim_Clock(pData[i]);
+  }
+  hspi->ErrorCode = HAL_SPI_ERROR_NONE;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+  uint16_t i;
+  (void)Timeout;
+  chip.stats.calls++;
+  for (i = 0; i < Size; i++)
+  {
+    pData[i] = W5500Sim_Clock(0x00);
+  }
+  hspi->ErrorCode = HAL_SPI_ERROR_NONE;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData, uint16_t Size, uint32_t Timeout)
+{
+  uint16_t i;
+  (void)Timeout;
+  chip.stats.calls++;
+  for (i = 0; i < Size; i++)
+  {
+    pRxData[i] = W5500Sim_Clock(pTxData[i]);
+  }
+  hspi->ErrorCode = HAL_SPI_ERROR_NONE;
+  return HAL_OK;
+}
+
+// DMA transfers complete before returning, the completion callback runs
+// from here like it would from the DMA interrupt
+HAL_StatusTypeDef HAL_SPI_Transmit_DMA(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size)
+{
+  HAL_SPI_Transmit(hspi, pData, Size, 0);
+  HAL_SPI_TxCpltCallback(hspi);
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Receive_DMA(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size)
+{
+  HAL_SPI_Receive(hspi, pData, Size, 0);
+  HAL_SPI_RxCpltCallback(hspi);
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Abort(SPI_HandleTypeDef *hspi)
+{
+  (void)hspi;
+  W5500Sim_Error("DMA transfer aborted", 0);
+  return HAL_OK;
+}
+
+// weak defaults like the HAL, tests that run tasks define their own
+__weak void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+  (void)hspi;
+}
+
+__weak void HAL_SPI_RxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+  (void)hspi;
+}
+
+__weak void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
+{
+  (void)GPIO_Pin;
+}
+
+/******************************************************************************
+* PRIVATE FUNCTIONS
+******************************************************************************/
+
+/*!
+* @brief  Resets the registers to their datasheet values and closes every
+*         socket.
+*/
+void W5500Sim_Reset(void)
+{
+  sim_socket_t* s;
+  uint8_t sn;
+
+  memset(chip.common, 0, sizeof(chip.common));
+  W5500Sim_Set16(&chip.common[REG_RTR], 0x07D0);
+  chip.common[REG_RCR]      = 0x08;
+  chip.common[REG_PHYCFGR]  = PHYCFGR_RESET;
+  chip.common[REG_VERSIONR] = CHIP_VERSION;
+
+  for (sn = 0; sn < W5500_SIM_NUM_SOCKETS; sn++)
+  {
+    s = &chip.sn[sn];
+    W5500Sim_Close(sn);
+    memset(s->regs, 0, sizeof(s->regs));
+    W5500Sim_Set16(&s->regs[REG_SN_FRAG], 0x4000);
+    s->regs[REG_SN_TTL]        = 0x80;
+    s->regs[REG_SN_RXBUF_SIZE] = 0x02;
+    s->regs[REG_SN_TXBUF_SIZE] = 0x02;
+    s->regs[REG_SN_IMR]        = 0xFF;
+  }
+  chip.frame       = FRAME_IDLE;
+  chip.intAsserted = 0;
+}
+
+/*!
+* @brief  Records a driver protocol violation.
+* @param  msg - description
+* @param  sn - socket number
+*/
+void W5500Sim_Error(const char* msg, uint8_t sn)
+{
+  fprintf(stderr, "W5500 SIM ERROR socket %u: %s\n", sn, msg);
+  chip.stats.errors++;
+}
+
+/*!
+* @brief  Calls the EXTI callback on a falling edge of the interrupt pin,
+*         like the HAL interrupt handler on the target.
+*/
+void W5500Sim_UpdateInt(void)
+{
+  uint8_t asserted = W5500Sim_IntAsserted();
+  if (asserted && !chip.intAsserted)
+  {
+    HAL_GPIO_EXTI_Callback(chip.intPin);
+  }
+  chip.intAsserted = asserted;
+}
+
+/*!
+* @brief  Clocks one byte through the SPI frame decoder.
+* @param  mosi - byte from the MCU
+* @return byte to the MCU
+*/
+uint8_t W5500Sim_Clock(uint8_t mosi)
+{
+  uint8_t miso = 0;
+
+  chip.stats.bytes++;
+  switch (chip.frame)
+  {
+    case FRAME_IDLE:
+      W5500Sim_Error("clock with chip select high", 0);
+      break;
+    case FRAME_HEADER:
+      // the W5500 drives 0x01, 0x02, 0x03 during the header
+      chip.header[chip.headerLen++] = mosi;
+      miso = chip.headerLen;
+      if (chip.headerLen == SPI_FRAME_BYTES)
+      {
+        chip.addr  = ((uint16_t)chip.header[0] << 8) | chip.header[1];
+        chip.bsb   = chip.header[2] >> 3;
+        chip.write = (chip.header[2] >> 2) & 0x01;
+        chip.frame = FRAME_DATA;
+        if (chip.header[2] & 0x03)
+        {
+          W5500Sim_Error("fixed length mode with framed chip select", 0);
+        }
+      }
+      break;
+    case FRAME_DATA:
+      if (chip.write)
+      {
+        W5500Sim_Write(chip.bsb, chip.addr, mosi);
+      }
+      else
+      {
+        miso = W5500Sim_Read(chip.bsb, chip.addr);
+      }
+      chip.addr++;
+      break;
+  }
+  return miso;
+}
+
+/*!
+* @brief  Reads a byte from a block.
+* @param  bsb - block select bits
+* @param  addr - offset address
+* @return register or buffer value
+*/
+uint8_t W5500Sim_Read(uint8_t bsb, uint16_t addr)
+{
+  sim_socket_t* s = &chip.sn[bsb >> 2];
+  uint8_t value[2];
+  uint8_t sn;
+
+  switch (bsb & 0x03)
+  {
+    case 0:
+      if (bsb != 0 || addr >= COMMON_BYTES)
+      {
+        return 0;
+      }
+      if (addr == REG_SIR)
+      {
+        value[0] = 0;
+        for (sn = 0; sn < W5500_SIM_NUM_SOCKETS; sn++)
+        {
+          if (chip.sn[sn].regs[REG_SN_IR] & chip.sn[sn].regs[REG_SN_IMR])
+          {
+            value[0] |= (1U << sn);
+          }
+        }
+        return value[0];
+      }
+      if (addr == REG_PHYCFGR)
+      {
+        return (chip.common[REG_PHYCFGR] & ~0x01) | (chip.link ? 0x01 : 0x00);
+      }
+      return chip.common[addr];
+    case 1:
+      if (addr >= SOCKET_BYTES)
+      {
+        return 0;
+      }
+      // free and received sizes are computed from the pointers
+      if (addr == REG_SN_TX_FSR || addr == REG_SN_TX_FSR + 1)
+      {
+        W5500Sim_Set16(value, W5500Sim_Size(s, REG_SN_TXBUF_SIZE)
+          - (uint16_t)(W5500Sim_Get16(&s->regs[REG_SN_TX_WR]) - W5500Sim_Get16(&s->regs[REG_SN_TX_RD])));
+        return value[addr - REG_SN_TX_FSR];
+      }
+      if (addr == REG_SN_RX_RSR || addr == REG_SN_RX_RSR + 1)
+      {
+        W5500Sim_Set16(value, W5500Sim_Get16(&s->regs[REG_SN_RX_WR]) - W5500Sim_Get16(&s->regs[REG_SN_RX_RD]));
+        return value[addr - REG_SN_RX_RSR];
+      }
+      return s->regs[addr];
+    case 2:
+      return s->tx[addr & (W5500Sim_Size(s, REG_SN_TXBUF_SIZE) - 1)];
+    default:
+      return s->rx[addr & (W5500Sim_Size(s, REG_SN_RXBUF_SIZE) - 1)];
+  }
+}
+
+/*!
+* @brief  Writes a byte to a block.
+* @param  bsb - block select bits
+* @param  addr - offset address
+* @param  value - value to write
+*/
+void W5500Sim_Write(uint8_t bsb, uint16_t addr, uint8_t value)
+{
+  uint8_t sn = bsb >> 2;
+  sim_socket_t* s = &chip.sn[sn];
+
+  switch (bsb & 0x03)
+  {
+    case 0:
+      if (bsb != 0 || addr >= COMMON_BYTES || addr == REG_SIR || addr == REG_VERSIONR)
+      {
+        return;
+      }
+      if (addr == REG_IR)
+      {
+        chip.common[REG_IR] &= ~value;
+        return;
+      }
+      chip.common[addr] = value;
+      return;
+    case 1:
+      switch (addr)
+      {
+        case REG_SN_CR:
+          W5500Sim_Command(sn, value);
+          return;
+        case REG_SN_IR:
+          s->regs[REG_SN_IR] &= ~value;
+          return;
+        case REG_SN_SR:
+        case REG_SN_TX_FSR:
+        case REG_SN_TX_FSR + 1:
+        case REG_SN_TX_RD:
+        case REG_SN_TX_RD + 1:
+        case REG_SN_RX_RSR:
+        case REG_SN_RX_RSR + 1:
+        case REG_SN_RX_WR:
+        case REG_SN_RX_WR + 1:
+          return;
+        default:
+          if (addr < SOCKET_BYTES)
+          {
+            s->regs[addr] = value;
+          }
+          return;
+      }
+    case 2:
+      s->tx[addr & (W5500Sim_Size(s, REG_SN_TXBUF_SIZE) - 1)] = value;
+      return;
+    default:
+      W5500Sim_Error("write to the RX buffer", sn);
+      return;
+  }
+}
+
+/*!
+* @brief  Runs a socket command, Sn_CR reads back zero once it was accepted.
+* @param  sn - socket number
+* @param  cmd - command
+*/
+void W5500Sim_Command(uint8_t sn, uint8_t cmd)
+{
+  sim_socket_t* s = &chip.sn[sn];
+  struct sockaddr_in addr;
+  int fd;
+
+  chip.stats.commands++;
+  switch (cmd)
+  {
+    case SN_CMD_OPEN:
+      W5500Sim_Close(sn);
+      W5500Sim_Set16(&s->regs[REG_SN_TX_RD], 0);
+      W5500Sim_Set16(&s->regs[REG_SN_TX_WR], 0);
+      W5500Sim_Set16(&s->regs[REG_SN_RX_RD], 0);
+      W5500Sim_Set16(&s->regs[REG_SN_RX_WR], 0);
+      if ((s->regs[REG_SN_MR] & 0x0F) == SN_PROTO_TCP)
+      {
+        s->regs[REG_SN_SR] = SN_SR_INIT;
+      }
+      else if ((s->regs[REG_SN_MR] & 0x0F) == SN_PROTO_UDP)
+      {
+        // the source port is left to the host, replies go to where the
+        // datagram came from
+        fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family      = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+        {
+          W5500Sim_Error("UDP socket failed", sn);
+          if (fd >= 0)
+          {
+            close(fd);
+          }
+          return;
+        }
+        s->fd = fd;
+        s->regs[REG_SN_SR] = SN_SR_UDP;
+      }
+      else
+      {
+        W5500Sim_Error("unsupported protocol", sn);
+      }
+      break;
+    case SN_CMD_CONNECT:
+      if (s->regs[REG_SN_SR] != SN_SR_INIT)
+      {
+        W5500Sim_Error("CONNECT outside of SOCK_INIT", sn);
+        break;
+      }
+      W5500Sim_Connect(sn);
+      break;
+    case SN_CMD_DISCON:
+      if (s->fd >= 0)
+      {
+        shutdown(s->fd, SHUT_RDWR);
+      }
+      W5500Sim_Close(sn);
+      s->regs[REG_SN_IR] |= SN_IR_DISCON;
+      break;
+    case SN_CMD_CLOSE:
+      W5500Sim_Close(sn);
+      break;
+    case SN_CMD_SEND:
+      if (s->regs[REG_SN_SR] != SN_SR_ESTABLISHED && s->regs[REG_SN_SR] != SN_SR_UDP)
+      {
+        W5500Sim_Error("SEND on a closed socket", sn);
+        break;
+      }
+      if (s->sendPending)
+      {
+        W5500Sim_Error("SEND before SENDOK", sn);
+      }
+      s->sendPending = 1;
+      s->sendWr      = W5500Sim_Get16(&s->regs[REG_SN_TX_WR]);
+      break;
+    case SN_CMD_SEND_KEEP:
+    case SN_CMD_RECV:
+      break;
+    default:
+      W5500Sim_Error("unsupported command", sn);
+      break;
+  }
+  s->regs[REG_SN_CR] = 0;
+}
+
+/*!
+* @brief  Closes the Linux socket and drops pending work.
+* @param  sn - socket number
+*/
+void W5500Sim_Close(uint8_t sn)
+{
+  sim_socket_t* s = &chip.sn[sn];
+  if (s->fd >= 0)
+  {
+    close(s->fd);
+    s->fd = -1;
+  }
+  s->sendPending     = 0;
+  s->regs[REG_SN_SR] = SN_SR_CLOSED;
+}
+
+/*!
+* @brief  Starts a non-blocking connect, completed by W5500Sim_Poll.
+* @param  sn - socket number
+*/
+void W5500Sim_Connect(uint8_t sn)
+{
+  sim_socket_t* s = &chip.sn[sn];
+  struct sockaddr_in addr = W5500Sim_Destination(sn);
+  int one = 1;
+  int fd;
+
+  fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (fd < 0)
+  {
+    W5500Sim_Error("TCP socket failed", sn);
+    return;
+  }
+  s->fd = fd;
+  // the chip puts each SEND on the wire without coalescing
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 && errno != EINPROGRESS)
+  {
+    W5500Sim_Close(sn);
+    s->regs[REG_SN_IR] |= SN_IR_TIMEOUT;
+    return;
+  }
+  s->regs[REG_SN_SR] = SN_SR_SYNSENT;
+}
+
+/*!
+* @brief  Sends the data between Sn_TX_RD and the Sn_TX_WR of the SEND.
+* @param  sn - socket number
+*/
+void W5500Sim_Send(uint8_t sn)
+{
+  static uint8_t buf[W5500_SIM_BUF_BYTES];
+  sim_socket_t* s = &chip.sn[sn];
+  struct sockaddr_in addr;
+  uint16_t mask = W5500Sim_Size(s, REG_SN_TXBUF_SIZE) - 1;
+  uint16_t rd   = W5500Sim_Get16(&s->regs[REG_SN_TX_RD]);
+  uint16_t len  = s->sendWr - rd;
+  size_t sent = 0;
+  ssize_t n;
+  uint16_t i;
+
+  if (len > mask + 1)
+  {
+    W5500Sim_Error("SEND longer than the TX buffer", sn);
+    len = mask + 1;
+  }
+  for (i = 0; i < len; i++)
+  {
+    buf[i] = s->tx[(uint16_t)(rd + i) & mask];
+  }
+
+  if (s->regs[REG_SN_SR] == SN_SR_UDP)
+  {
+    addr = W5500Sim_Destination(sn);
+    sendto(s->fd, buf, len, 0, (struct sockaddr*)&addr, sizeof(addr));
+  }
+  else
+  {
+    while (sent < len)
+    {
+      n = send(s->fd, &buf[sent], len - sent, MSG_NOSIGNAL);
+      if (n < 0 && errno != EAGAIN)
+      {
+        W5500Sim_Close(sn);
+        s->regs[REG_SN_IR] |= SN_IR_TIMEOUT;
+        return;
+      }
+      sent += n > 0 ? (size_t)n : 0;
+    }
+  }
+
+  W5500Sim_Set16(&s->regs[REG_SN_TX_RD], s->sendWr);
+  s->sendPending      = 0;
+  s->regs[REG_SN_IR] |= SN_IR_SENDOK;
+}
+
+/*!
+* @brief  Copies received data into the RX ring, UDP datagrams are preceded
+*         by the 8 byte source address, port and length header.
+* @param  sn - socket number
+*/
+void W5500Sim_Receive(uint8_t sn)
+{
+  static uint8_t buf[W5500_SIM_BUF_BYTES];
+  sim_socket_t* s = &chip.sn[sn];
+  struct sockaddr_in addr;
+  socklen_t addrLen = sizeof(addr);
+  uint16_t size = W5500Sim_Size(s, REG_SN_RXBUF_SIZE);
+  uint16_t wr   = W5500Sim_Get16(&s->regs[REG_SN_RX_WR]);
+  uint16_t used = wr - W5500Sim_Get16(&s->regs[REG_SN_RX_RD]);
+  uint16_t free = size - used;
+  uint16_t hdrLen = 0;
+  ssize_t n;
+  ssize_t i;
+
+  if (s->regs[REG_SN_SR] == SN_SR_UDP)
+  {
+    n = recv(s->fd, buf, sizeof(buf), MSG_PEEK | MSG_TRUNC | MSG_DONTWAIT);
+    if (n < 0 || n + UDP_HEADER_BYTES > free)
+    {
+      return;
+    }
+    n = recvfrom(s->fd, &buf[UDP_HEADER_BYTES], sizeof(buf) - UDP_HEADER_BYTES, MSG_DONTWAIT, (struct sockaddr*)&addr, &addrLen);
+    if (n < 0)
+    {
+      return;
+    }
+    memcpy(buf, &addr.sin_addr.s_addr, 4);
+    memcpy(&buf[4], &addr.sin_port, 2);
+    W5500Sim_Set16(&buf[6], (uint16_t)n);
+    hdrLen = UDP_HEADER_BYTES;
+  }
+  else if (s->regs[REG_SN_SR] == SN_SR_ESTABLISHED)
+  {
+    if (free == 0)
+    {
+      return;
+    }
+    n = recv(s->fd, buf, free, MSG_DONTWAIT);
+    if (n == 0)
+    {
+      // the server closed its side
+      s->regs[REG_SN_SR]  = SN_SR_CLOSE_WAIT;
+      s->regs[REG_SN_IR] |= SN_IR_DISCON;
+      return;
+    }
+    if (n < 0)
+    {
+      return;
+    }
+  }
+  else
+  {
+    return;
+  }
+
+  n += hdrLen;
+  for (i = 0; i < n; i++)
+  {
+    s->rx[(uint16_t)(wr + i) & (size - 1)] = buf[i];
+  }
+  W5500Sim_Set16(&s->regs[REG_SN_RX_WR], wr + (uint16_t)n);
+  s->regs[REG_SN_IR] |= SN_IR_RECV;
+}
+
+/*!
+* @brief  Gets the loopback address for the socket destination.
+* @param  sn - socket number
+* @return destination address
+*/
+struct sockaddr_in W5500Sim_Destination(uint8_t sn)
+{
+  struct sockaddr_in addr;
+  uint16_t port = W5500Sim_Get16(&chip.sn[sn].regs[REG_SN_DPORT]);
+  size_t i;
+
+  for (i = 0; i < NUM_PORT_MAPS; i++)
+  {
+    if (chip.portMap[i][0] == port)
+    {
+      port = chip.portMap[i][1];
+      break;
+    }
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family      = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port        = htons(port);
+  return addr;
+}
+
+/*!
+* @brief  Reads a big endian 16-bit register.
+* @param  reg - register
+* @return value
+*/
+inline uint16_t W5500Sim_Get16(const uint8_t* reg)
+{
+  return ((uint16_t)reg[0] << 8) | reg[1];
+}
+
+/*!
+* @brief  Writes a big endian 16-bit register.
+* @param  reg - register
+* @param  value - value
+*/
+inline void W5500Sim_Set16(uint8_t* reg, uint16_t value)
+{
+  reg[0] = (value & 0xFF00) >> 8;
+  reg[1] = (value & 0x00FF) >> 0;
+}
+
+/*!
+* @brief  Gets a socket buffer size in bytes.
+* @param  s - socket
+* @param  reg - Sn_TXBUF_SIZE or Sn_RXBUF_SIZE
+* @return buffer size, at least one byte
+*/
+inline uint16_t W5500Sim_Size(const sim_socket_t* s, uint8_t reg)
+{
+  uint16_t size = (uint16_t)s->regs[reg] << 10;
+  return size ? size : 1;
+}
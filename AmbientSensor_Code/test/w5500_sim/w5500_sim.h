@@ -0,0 +1,57 @@
+/******************************************************************************
+* Copyright 2019 Alex M.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+******************************************************************************/
+
+
+#ifndef _W5500_SIM_H_
+#define _W5500_SIM_H_
+
+#include "stm32f0xx_hal.h"
+
+#define W5500_SIM_NUM_SOCKETS 8         //!< number of sockets on the W5500
+#define W5500_SIM_BUF_BYTES   (16 << 10) //!< largest socket buffer
+
+//! SPI traffic and command counters, reset around an operation to measure it
+typedef struct w5500_sim_stats_t
+{
+  uint32_t frames;   //!< chip select low periods
+  uint32_t bytes;    //!< bytes clocked, including the 3 byte headers
+  uint32_t calls;    //!< HAL SPI calls
+  uint32_t commands; //!< Sn_CR commands
+  uint32_t errors;   //!< driver protocol violations, see W5500Sim_Error
+} w5500_sim_stats_t;
+
+// function prototypes
+void W5500Sim_Init(
+  GPIO_TypeDef* csPort,
+  uint16_t      csPin,
+  GPIO_TypeDef* rstPort,
+  uint16_t      rstPin,
+  GPIO_TypeDef* intPort,
+  uint16_t      intPin
+);
+void W5500Sim_MapPort(uint16_t port, uint16_t hostPort);
+void W5500Sim_SetLink(uint8_t up);
+void W5500Sim_Poll(void);
+uint8_t W5500Sim_IntAsserted(void);
+void W5500Sim_StatsReset(void);
+const w5500_sim_stats_t* W5500Sim_Stats(void);
+#endif // _W5500_SIM_H_
@@ -21,6 +21,7 @@
 ******************************************************************************/
 
 #include "bme280.h"
+#include "profiler/profiler.h"
 
 // registers from Table 18: Memory Map
 // static const uint8_t REG_HUM_LSB    = 0xFE;
@@ -171,9 +172,10 @@ inline bme280_status_t ReadRegister(bme280_dev_t* dev, uint8_t reg, uint8_t* buf
 
   // take the mutex for the I2C bus
   xSemaphoreTake(dev->busMutex, portMAX_DELAY);
+  PROFILER_START(start);
 
   // do I2C transfer in critical section
-  taskENTER_CRITICAL();
+  PROFILER_ENTER_CRITICAL();
   rc = HAL_I2C_Mem_Read(
     &dev->hi2cx,
     dev->addr,
@@ -183,7 +185,8 @@ inline bme280_status_t ReadRegister(bme280_dev_t* dev, uint8_t reg, uint8_t* buf
     num,
     BME280_TIMEOUT
   );
-  taskEXIT_CRITICAL();
+  PROFILER_EXIT_CRITICAL();
+  PROFILER_STOP(PROFILER_BME280_READ, start, num);
 
   // release mutex
   xSemaphoreGive(dev->busMutex);
@@ -218,9 +221,10 @@ inline bme280_status_t WriteRegister(bme280_dev_t* dev, uint8_t reg, uint8_t* bu
 
   // take the mutex for the I2C bus
   xSemaphoreTake(dev->busMutex, portMAX_DELAY);
+  PROFILER_START(start);
 
   // do I2C transfer in critical section
-  taskENTER_CRITICAL();
+  PROFILER_ENTER_CRITICAL();
   rc = (bme280_status_t) HAL_I2C_Mem_Write(
     &dev->hi2cx,
     dev->addr,
@@ -230,7 +234,8 @@ inline bme280_status_t WriteRegister(bme280_dev_t* dev, uint8_t reg, uint8_t* bu
     num,
     BME280_TIMEOUT
   );
-  taskEXIT_CRITICAL();
+  PROFILER_EXIT_CRITICAL();
+  PROFILER_STOP(PROFILER_BME280_WRITE, start, num);
 
   // release mutex
   xSemaphoreGive(dev->busMutex);
@@ -0,0 +1,412 @@
+/******************************************************************************
+* Copyright 2019 Alex M.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+******************************************************************************/
+
+#include "clock/clock.h"
+#include "task.h"
+#include "logging/logging.h"
+
+//! settings of a clock profile
+typedef struct clock_cfg_t
+{
+  uint32_t sysclkSource; //!< SYSCLK source
+  uint32_t ahbDivider;   //!< HCLK divider
+  uint32_t flashLatency; //!< flash wait states for HCLK
+  uint32_t i2cTiming;    //!< I2C TIMINGR for 100 kHz
+} clock_cfg_t;
+
+// I2C1 is clocked from the 8 MHz HSI in every profile, the timing is the
+// same value CubeMX generated
+static const clock_cfg_t PROFILES[CLOCK_NUM_PROFILES] =
+{
+  { RCC_SYSCLKSOURCE_HSI,    RCC_SYSCLK_DIV2, FLASH_LATENCY_0, 0x2000090E }, // LOW_POWER
+  { RCC_SYSCLKSOURCE_HSI,    RCC_SYSCLK_DIV1, FLASH_LATENCY_0, 0x2000090E }, // DEFAULT
+  { RCC_SYSCLKSOURCE_PLLCLK, RCC_SYSCLK_DIV1, FLASH_LATENCY_1, 0x2000090E }, // PERFORMANCE
+};
+
+static const uint32_t UART_TC_TIMEOUT = 2; //!< time to finish a character in ms
+
+static volatile uint32_t tickReload; //!< SysTick reload after a partial tick, 0 when none
+
+/*!
+* @brief  Configures the oscillators and bus clocks for a profile.
+* @param  cfg - profile settings
+* @return clock status
+*/
+static clock_status_t Clock_ConfigRCC(const clock_cfg_t* cfg)
+{
+  RCC_OscInitTypeDef osc = {0};
+  RCC_ClkInitTypeDef clk = {0};
+
+  // the PLL must be running before it can be selected
+  if (cfg->sysclkSource == RCC_SYSCLKSOURCE_PLLCLK && !(RCC->CR & RCC_CR_PLLRDY))
+  {
+    osc.OscillatorType = RCC_OSCILLATORTYPE_NONE;
+    osc.PLL.PLLState   = RCC_PLL_ON;
+    osc.PLL.PLLSource  = RCC_PLLSOURCE_HSI;
+    osc.PLL.PREDIV     = RCC_PREDIV_DIV2;
+    osc.PLL.PLLMUL     = RCC_PLL_MUL12;
+    if (HAL_RCC_OscConfig(&osc) != HAL_OK)
+    {
+      return CLOCK_RCC_ERROR;
+    }
+  }
+
+  clk.ClockType      = RCC_CLOCKTYPE_HCLK | RCC_CLOCKTYPE_SYSCLK | RCC_CLOCKTYPE_PCLK1;
+  clk.SYSCLKSource   = cfg->sysclkSource;
+  clk.AHBCLKDivider  = cfg->ahbDivider;
+  clk.APB1CLKDivider = RCC_HCLK_DIV1;
+  if (HAL_RCC_ClockConfig(&clk, cfg->flashLatency) != HAL_OK)
+  {
+    return CLOCK_RCC_ERROR;
+  }
+
+  // stop the PLL once nothing uses it
+  if (cfg->sysclkSource != RCC_SYSCLKSOURCE_PLLCLK && (RCC->CR & RCC_CR_PLLON))
+  {
+    osc.OscillatorType = RCC_OSCILLATORTYPE_NONE;
+    osc.PLL.PLLState   = RCC_PLL_OFF;
+    if (HAL_RCC_OscConfig(&osc) != HAL_OK)
+    {
+      return CLOCK_RCC_ERROR;
+    }
+  }
+  return CLOCK_OK;
+}
+
+/*!
+* @brief  Reloads SysTick for the FreeRTOS tick rate at the current HCLK.
+*         Writing VAL clears it, so the count left in the current tick is
+*         scaled to the new clock and loaded as a partial tick, the full
+*         reload is restored by Clock_TickHook.
+*/
+static void Clock_RetimeSysTick(void)
+{
+  uint32_t reload = SystemCoreClock / configTICK_RATE_HZ;
+  uint32_t period;
+  uint32_t remaining;
+
+  taskENTER_CRITICAL();
+  // the tick in progress may already be a partial one
+  period    = (tickReload ? tickReload : SysTick->LOAD) + 1UL;
+  remaining = (uint32_t)((uint64_t)SysTick->VAL * reload / period);
+
+  // the counter wrapped and the tick interrupt has not run yet
+  if (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk)
+  {
+    remaining = 0;
+  }
+
+  if (remaining > 1UL)
+  {
+    SysTick->LOAD = remaining - 1UL;
+    tickReload    = reload - 1UL;
+  }
+  else
+  {
+    SysTick->LOAD = reload - 1UL;
+    tickReload    = 0;
+  }
+  SysTick->VAL = 0;
+  taskEXIT_CRITICAL();
+}
+
+/*!
+* @brief  Restores the full SysTick reload once a partial tick after a
+*         profile change has elapsed. Call from vApplicationTickHook.
+*/
+void Clock_TickHook(void)
+{
+  if (tickReload)
+  {
+    // the counter already reloaded the partial count, restart it so only
+    // the interrupt latency is lost
+    SysTick->LOAD = tickReload;
+    SysTick->VAL  = 0;
+    tickReload    = 0;
+  }
+}
+
+/*!
+* @brief  Sets the fastest SPI prescaler within the bus limit.
+* @param  spi  - SPI port to retime
+* @param  pclk - SPI peripheral clock in Hz
+*/
+static void Clock_RetimeSPI(clock_spi_t* spi, uint32_t pclk)
+{
+  uint32_t br = 0;
+
+  // SCK is PCLK divided by 2^(BR + 1)
+  while (br < 7 && (pclk >> (br + 1)) > spi->maxHz)
+  {
+    br++;
+  }
+  spi->hspix->Init.BaudRatePrescaler = br << SPI_CR1_BR_Pos;
+
+  // HAL transfers enable the port again
+  __HAL_SPI_DISABLE(spi->hspix);
+  MODIFY_REG(spi->hspix->Instance->CR1, SPI_CR1_BR, spi->hspix->Init.BaudRatePrescaler);
+}
+
+/*!
+* @brief  Sets the I2C timing register.
+* @param  dev    - clock manager device structure
+* @param  timing - TIMINGR value
+*/
+static void Clock_RetimeI2C(clock_dev_t* dev, uint32_t timing)
+{
+  if (dev->hi2cx->Instance->TIMINGR == timing)
+  {
+    return;
+  }
+  dev->hi2cx->Init.Timing = timing;
+  __HAL_I2C_DISABLE(dev->hi2cx);
+  WRITE_REG(dev->hi2cx->Instance->TIMINGR, timing);
+  __HAL_I2C_ENABLE(dev->hi2cx);
+}
+
+/*!
+* @brief  Waits for the UART to finish the character being shifted out.
+* @param  dev - clock manager device structure
+*/
+static void Clock_WaitUART(clock_dev_t* dev)
+{
+  uint32_t start = HAL_GetTick();
+  while (!__HAL_UART_GET_FLAG(dev->huartx, UART_FLAG_TC)
+         && HAL_GetTick() - start < UART_TC_TIMEOUT);
+}
+
+/*!
+* @brief  Sets the UART baud rate divider.
+* @param  dev  - clock manager device structure
+* @param  pclk - UART peripheral clock in Hz
+*/
+static void Clock_RetimeUART(clock_dev_t* dev, uint32_t pclk)
+{
+  // 16x oversampling, BRR is the rounded divider
+  __HAL_UART_DISABLE(dev->huartx);
+  dev->huartx->Instance->BRR = (pclk + dev->baud / 2U) / dev->baud;
+  __HAL_UART_ENABLE(dev->huartx);
+}
+
+/*!
+* @brief  Switches to a profile and retimes the peripherals.
+*         Must hold the clock manager lock.
+* @param  dev     - clock manager device structure
+* @param  profile - profile to switch to
+* @return clock status
+*/
+static clock_status_t Clock_Apply(clock_dev_t* dev, clock_profile_t profile)
+{
+  const clock_cfg_t* cfg = &PROFILES[profile];
+  clock_status_t     rc;
+  uint32_t           pclk;
+  uint8_t            i;
+
+  if (profile == dev->profile)
+  {
+    return CLOCK_OK;
+  }
+
+  // wait for transfers in progress to finish
+  for (i = 0; i < CLOCK_NUM_SPI; i++)
+  {
+    if (dev->spi[i].busMutex != NULL)
+    {
+      xSemaphoreTake(dev->spi[i].busMutex, portMAX_DELAY);
+    }
+  }
+  xSemaphoreTake(dev->i2cMutex, portMAX_DELAY);
+
+  // interrupts stay enabled, the HAL timebase is needed for RCC timeouts
+  vTaskSuspendAll();
+  Clock_WaitUART(dev);
+
+  rc = Clock_ConfigRCC(cfg);
+
+  // retime from the clock that is actually running, even on failure
+  pclk = HAL_RCC_GetPCLK1Freq();
+  Clock_RetimeSysTick();
+  for (i = 0; i < CLOCK_NUM_SPI; i++)
+  {
+    Clock_RetimeSPI(&dev->spi[i], pclk);
+  }
+  Clock_RetimeI2C(dev, cfg->i2cTiming);
+  Clock_RetimeUART(dev, pclk);
+
+  if (rc == CLOCK_OK)
+  {
+    dev->profile = profile;
+    dev->switches++;
+  }
+  xTaskResumeAll();
+
+  xSemaphoreGive(dev->i2cMutex);
+  for (i = CLOCK_NUM_SPI; i > 0; i--)
+  {
+    if (dev->spi[i - 1].busMutex != NULL)
+    {
+      xSemaphoreGive(dev->spi[i - 1].busMutex);
+    }
+  }
+
+  return rc;
+}
+
+/*!
+* @brief  Initializes the clock manager and switches to a profile.
+*         Call from a task once the bus mutexes exist.
+* @param  dev     - clock manager device structure
+* @param  profile - initial profile
+* @return clock status
+*/
+clock_status_t Clock_Init(clock_dev_t* dev, clock_profile_t profile)
+{
+  clock_status_t rc;
+
+  if (profile >= CLOCK_NUM_PROFILES)
+  {
+    return CLOCK_BAD_PROFILE;
+  }
+
+  dev->lock = xSemaphoreCreateMutex();
+  if (dev->lock == NULL)
+  {
+    return CLOCK_NO_MEMORY;
+  }
+  dev->profile  = CLOCK_NUM_PROFILES; // unknown, forces retiming
+  dev->base     = profile;
+  dev->boosts   = 0;
+  dev->switches = 0;
+
+  rc = Clock_Apply(dev, profile);
+  LOG_INFO(
+    "Clock profile %s HCLK %lu Hz",
+    Clock_ProfileString(profile),
+    SystemCoreClock
+  );
+  return rc;
+}
+
+/*!
+* @brief  Sets the base profile, applied immediately unless a boost is held.
+* @param  dev     - clock manager device structure
+* @param  profile - base profile
+* @return clock status
+*/
+clock_status_t Clock_SetProfile(clock_dev_t* dev, clock_profile_t profile)
+{
+  clock_status_t rc = CLOCK_OK;
+
+  if (profile >= CLOCK_NUM_PROFILES)
+  {
+    return CLOCK_BAD_PROFILE;
+  }
+
+  xSemaphoreTake(dev->lock, portMAX_DELAY);
+  dev->base = profile;
+  if (!dev->boosts)
+  {
+    rc = Clock_Apply(dev, profile);
+  }
+  xSemaphoreGive(dev->lock);
+  return rc;
+}
+
+/*!
+* @brief  Switches to the performance profile until released.
+*         Boosts nest, each must be paired with a Clock_Release.
+*         Do not call while holding a bus mutex.
+* @param  dev - clock manager device structure
+* @return clock status
+*/
+clock_status_t Clock_Boost(clock_dev_t* dev)
+{
+  clock_status_t rc = CLOCK_OK;
+
+  xSemaphoreTake(dev->lock, portMAX_DELAY);
+  if (dev->boosts++ == 0)
+  {
+    rc = Clock_Apply(dev, CLOCK_PROFILE_PERFORMANCE);
+  }
+  xSemaphoreGive(dev->lock);
+  return rc;
+}
+
+/*!
+* @brief  Releases a boost, returning to the base profile after the last one.
+* @param  dev - clock manager device structure
+* @return clock status
+*/
+clock_status_t Clock_Release(clock_dev_t* dev)
+{
+  clock_status_t rc = CLOCK_OK;
+
+  xSemaphoreTake(dev->lock, portMAX_DELAY);
+  if (dev->boosts && --dev->boosts == 0)
+  {
+    rc = Clock_Apply(dev, dev->base);
+  }
+  xSemaphoreGive(dev->lock);
+  return rc;
+}
+
+/*!
+* @brief  Converts a clock profile to a string.
+* @param  profile - clock profile
+* @return profile name
+*/
+const char* Clock_ProfileString(clock_profile_t profile)
+{
+  switch (profile)
+  {
+    case CLOCK_PROFILE_LOW_POWER:
+      return "LOW_POWER";
+    case CLOCK_PROFILE_DEFAULT:
+      return "DEFAULT";
+    case CLOCK_PROFILE_PERFORMANCE:
+      return "PERFORMANCE";
+    default:
+      return "UNKNOWN";
+  }
+}
+
+/*!
+* @brief  Converts a clock status to a string.
+* @param  status - clock status
+* @return status name
+*/
+const char* Clock_StatusString(clock_status_t status)
+{
+  switch (status)
+  {
+    case CLOCK_OK:
+      return "OK";
+    case CLOCK_BAD_PROFILE:
+      return "BAD_PROFILE";
+    case CLOCK_RCC_ERROR:
+      return "RCC_ERROR";
+    case CLOCK_NO_MEMORY:
+      return "NO_MEMORY";
+    default:
+      return "UNKNOWN";
+  }
+}
@@ -0,0 +1,81 @@
+/******************************************************************************
+* Copyright 2019 Alex M.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+******************************************************************************/
+
+#ifndef _CLOCK_H_
+#define _CLOCK_H_
+
+#include "stm32f0xx_hal.h"
+#include "FreeRTOS.h"
+#include "semphr.h"
+
+#define CLOCK_NUM_SPI 2 //!< number of SPI ports retimed on a profile change
+
+//! system clock profiles
+typedef enum
+{
+  CLOCK_PROFILE_LOW_POWER   = 0U, //!< 4 MHz, HSI with HCLK divided by 2
+  CLOCK_PROFILE_DEFAULT     = 1U, //!< 8 MHz, HSI
+  CLOCK_PROFILE_PERFORMANCE = 2U, //!< 48 MHz, PLL from HSI
+  CLOCK_NUM_PROFILES        = 3U,
+} clock_profile_t;
+
+//! SPI port retimed on profile changes
+typedef struct clock_spi_t
+{
+  SPI_HandleTypeDef* hspix;    //!< SPI port
+  uint32_t           maxHz;    //!< maximum SCK frequency of the slowest device on the bus
+  SemaphoreHandle_t  busMutex; //!< mutex for the SPI bus, NULL when not shared
+} clock_spi_t;
+
+//! clock manager device structure
+typedef struct clock_dev_t
+{
+  clock_spi_t         spi[CLOCK_NUM_SPI]; //!< SPI ports
+  I2C_HandleTypeDef*  hi2cx;    //!< I2C port
+  SemaphoreHandle_t   i2cMutex; //!< mutex for the I2C bus
+  UART_HandleTypeDef* huartx;   //!< UART port
+  uint32_t            baud;     //!< UART baud rate
+  SemaphoreHandle_t   lock;     //!< serializes profile changes
+  clock_profile_t     profile;  //!< active profile
+  clock_profile_t     base;     //!< profile to return to when no boost is held
+  uint8_t             boosts;   //!< number of boosts held
+  uint32_t            switches; //!< number of profile changes
+} clock_dev_t;
+
+//! clock manager return codes
+typedef enum
+{
+  CLOCK_OK          = 0x00U,
+  CLOCK_BAD_PROFILE = 0x01U,
+  CLOCK_RCC_ERROR   = 0x02U,
+  CLOCK_NO_MEMORY   = 0x03U,
+} clock_status_t;
+
+clock_status_t Clock_Init(clock_dev_t* dev, clock_profile_t profile);
+clock_status_t Clock_SetProfile(clock_dev_t* dev, clock_profile_t profile);
+clock_status_t Clock_Boost(clock_dev_t* dev);
+clock_status_t Clock_Release(clock_dev_t* dev);
+void Clock_TickHook(void);
+const char* Clock_ProfileString(clock_profile_t profile);
+const char* Clock_StatusString(clock_status_t status);
+
+#endif // _CLOCK_H_
@@ -0,0 +1,187 @@
+/******************************************************************************
+* Copyright 2019 Alex M.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+******************************************************************************/
+
+#include "codec/codec.h"
+
+//! fixed-point scale for each number of fractional digits
+static const float FIXED_SCALE[CODEC_MAX_DECIMALS + 1] = {
+  1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f,
+};
+
+/*!
+* @brief  Divides by ten with shifts and adds, the Cortex-M0 has no divider.
+*         From Hacker's Delight, figure 10-12.
+* @param  n - dividend
+* @param  rem - remainder
+* @return quotient
+*/
+static uint32_t DivU10(uint32_t n, uint32_t* rem)
+{
+  uint32_t q;
+  uint32_t r;
+
+  q = (n >> 1) + (n >> 2);
+  q = q + (q >> 4);
+  q = q + (q >> 8);
+  q = q + (q >> 16);
+  q = q >> 3;
+  r = n - (((q << 2) + q) << 1);
+  if (r > 9)
+  {
+    q++;
+    r -= 10;
+  }
+
+  *rem = r;
+  return q;
+}
+
+/*!
+* @brief  Converts a sample to fixed-point, rounding half away from zero and
+*         saturating at the int32 limits.
+* @param  value - sample value
+* @param  decimals - fractional digits to keep, at most CODEC_MAX_DECIMALS
+* @return value scaled by 10^decimals
+*/
+int32_t Codec_ToFixed(float value, uint8_t decimals)
+{
+  float scaled;
+
+  if (decimals > CODEC_MAX_DECIMALS)
+  {
+    decimals = CODEC_MAX_DECIMALS;
+  }
+  scaled = value * FIXED_SCALE[decimals];
+
+  if (scaled >= 2147483647.0f)
+  {
+    return INT32_MAX;
+  }
+  if (scaled <= -2147483648.0f)
+  {
+    return INT32_MIN;
+  }
+  if (scaled < 0)
+  {
+    return (int32_t)(scaled - 0.5f);
+  }
+  return (int32_t)(scaled + 0.5f);
+}
+
+/*!
+* @brief  Converts a sample to thousandths.
+* @param  value - sample value
+* @return value in thousandths
+*/
+int32_t Codec_ToMilli(float value)
+{
+  return Codec_ToFixed(value, 3);
+}
+
+/*!
+* @brief  Formats a fixed-point value as a decimal string with integer
+*         operations only, e.g. -1234 with 3 decimals is "-1.234" and -5 with
+*         3 decimals is "-0.005".
+* @param  buf - output buffer, CODEC_FIXED_CHARS always fits
+* @param  len - size of the output buffer
+* @param  value - value scaled by 10^decimals
+* @param  decimals - fractional digits in value, at most CODEC_MAX_DECIMALS
+* @return characters written without the NUL, zero if buf is too small
+*/
+size_t Codec_FormatFixed(char* buf, size_t len, int32_t value, uint8_t decimals)
+{
+  char     digits[CODEC_MAX_DECIMALS + 2]; // least significant digit first
+  uint32_t mag = value < 0 ? 0U - (uint32_t)value : (uint32_t)value;
+  uint32_t rem;
+  size_t   n = 0;
+  size_t   i = 0;
+
+  if (decimals > CODEC_MAX_DECIMALS)
+  {
+    return 0;
+  }
+
+  // at least one digit before the point
+  do
+  {
+    mag = DivU10(mag, &rem);
+    digits[n++] = (char)('0' + rem);
+  } while (mag || n <= decimals);
+
+  // sign, digits, point and NUL
+  if ((value < 0) + n + (decimals > 0) + 1 > len)
+  {
+    return 0;
+  }
+
+  if (value < 0)
+  {
+    buf[i++] = '-';
+  }
+  while (n)
+  {
+    if (n == decimals)
+    {
+      buf[i++] = '.';
+    }
+    buf[i++] = digits[--n];
+  }
+  buf[i] = '\0';
+
+  return i;
+}
+
+/*!
+* @brief  Writes the payload header.
+* @param  buf - start of the payload
+* @param  count - number of records that follow
+*/
+void Codec_EncodeHeader(uint8_t* buf, uint8_t count)
+{
+  buf[0] = CODEC_VERSION;
+  buf[1] = count;
+}
+
+/*!
+* @brief  Writes one sample record.
+* @param  buf - output buffer, at least CODEC_RECORD_BYTES long
+* @param  type - sample type
+* @param  value - value in thousandths
+* @param  tick - sample time in ms
+* @return bytes written
+*/
+size_t Codec_EncodeRecord(uint8_t* buf, uint8_t type, int32_t value, uint32_t tick)
+{
+  uint32_t bits = (uint32_t)value;
+
+  buf[0] = type;
+  buf[1] = (bits >> 24) & 0xFF;
+  buf[2] = (bits >> 16) & 0xFF;
+  buf[3] = (bits >>  8) & 0xFF;
+  buf[4] = (bits >>  0) & 0xFF;
+  buf[5] = (tick >> 24) & 0xFF;
+  buf[6] = (tick >> 16) & 0xFF;
+  buf[7] = (tick >>  8) & 0xFF;
+  buf[8] = (tick >>  0) & 0xFF;
+
+  return CODEC_RECORD_BYTES;
+}
@@ -0,0 +1,47 @@
+/******************************************************************************
+* Copyright 2019 Alex M.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+******************************************************************************/
+
+#ifndef _CODEC_H_
+#define _CODEC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Packed sample payload, all fields big endian:
+//   header  uint8  version
+//           uint8  record count
+//   record  uint8  sample type
+//           int32  value in thousandths of the sample unit
+//           uint32 tick count in ms when the sample was taken
+#define CODEC_VERSION      1 //!< payload format version
+#define CODEC_HEADER_BYTES 2 //!< length of the payload header
+#define CODEC_RECORD_BYTES 9 //!< length of one sample record
+#define CODEC_MAX_DECIMALS 9 //!< most fractional digits of a fixed-point value
+#define CODEC_FIXED_CHARS  13 //!< longest formatted int32 with sign and point, plus NUL
+
+int32_t Codec_ToFixed(float value, uint8_t decimals);
+int32_t Codec_ToMilli(float value);
+size_t  Codec_FormatFixed(char* buf, size_t len, int32_t value, uint8_t decimals);
+void    Codec_EncodeHeader(uint8_t* buf, uint8_t count);
+size_t  Codec_EncodeRecord(uint8_t* buf, uint8_t type, int32_t value, uint32_t tick);
+
+#endif // _CODEC_H_
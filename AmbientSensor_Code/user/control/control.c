@@ -0,0 +1,328 @@
+/******************************************************************************
+* Copyright 2019 Alex M.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+******************************************************************************/
+
+#include <string.h>
+#include "control/control.h"
+#include "opt3002/opt3002.h"
+#include "bme280/bme280.h"
+
+/*!
+* @brief  Checks for a separator between commands.
+* @param  c - character
+* @return non-zero for a separator
+*/
+static int Control_IsSeparator(char c)
+{
+  return c == ' ' || c == ',' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/*!
+* @brief  Compares a key that is not NUL terminated.
+* @param  key - key from the command
+* @param  keyLen - length of the key
+* @param  name - NUL terminated name to compare with
+* @return non-zero when equal
+*/
+static int Control_KeyIs(const char* key, size_t keyLen, const char* name)
+{
+  return strlen(name) == keyLen && memcmp(key, name, keyLen) == 0;
+}
+
+/*!
+* @brief  Converts an oversampling ratio to the BME280 register value.
+* @param  ratio - 1, 2, 4, 8 or 16
+* @param  os - register value
+* @return control status
+*/
+static control_status_t Control_Oversample(uint32_t ratio, uint8_t* os)
+{
+  uint8_t value;
+
+  for (value = BME280_OVERSAMPLE_01; value <= BME280_OVERSAMPLE_16; value++)
+  {
+    if (ratio == 1U << (value - BME280_OVERSAMPLE_01))
+    {
+      *os = value;
+      return CONTROL_OK;
+    }
+  }
+  return CONTROL_BAD_VALUE;
+}
+
+/*!
+* @brief  Converts an IIR filter coefficient to the BME280 register value.
+* @param  coefficient - 0 for off, 2, 4, 8 or 16
+* @param  filter - register value
+* @return control status
+*/
+static control_status_t Control_Filter(uint32_t coefficient, uint8_t* filter)
+{
+  uint8_t value;
+
+  if (coefficient == 0)
+  {
+    *filter = BME280_FILTER_OFF;
+    return CONTROL_OK;
+  }
+  for (value = BME280_FILTER_02; value <= BME280_FILTER_16; value++)
+  {
+    if (coefficient == 1U << value)
+    {
+      *filter = value;
+      return CONTROL_OK;
+    }
+  }
+  return CONTROL_BAD_VALUE;
+}
+
+/*!
+* @brief  Converts a standby time to the BME280 register value.
+* @param  ms - standby time as rounded by BME280_GetStandbyTime
+* @param  standby - register value
+* @return control status
+*/
+static control_status_t Control_Standby(uint32_t ms, uint8_t* standby)
+{
+  uint8_t value;
+
+  for (value = BME280_STANDBY_0_5_ms; value <= BME280_STANDBY_20_ms; value++)
+  {
+    if (ms == BME280_GetStandbyTime((bme280_standby_t)value))
+    {
+      *standby = value;
+      return CONTROL_OK;
+    }
+  }
+  return CONTROL_BAD_VALUE;
+}
+
+/*!
+* @brief  Sets one setting from a key and value.
+* @param  settings - settings to update
+* @param  key - key from the command
+* @param  keyLen - length of the key
+* @param  value - decimal value from the command
+* @return control status
+*/
+static control_status_t Control_Set(control_settings_t* settings, const char* key, size_t keyLen, uint32_t value)
+{
+  control_status_t rc;
+
+  if (Control_KeyIs(key, keyLen, "lux_period"))
+  {
+    if (value < OPT3002_MIN_PERIOD || value > CONTROL_MAX_PERIOD)
+    {
+      return CONTROL_BAD_VALUE;
+    }
+    settings->luxPeriod = value;
+  }
+  else if (Control_KeyIs(key, keyLen, "lux_ct"))
+  {
+    if (value == 100)
+    {
+      settings->luxCt = OPT3002_100_MS;
+    }
+    else if (value == 800)
+    {
+      settings->luxCt = OPT3002_800_MS;
+    }
+    else
+    {
+      return CONTROL_BAD_VALUE;
+    }
+  }
+  else if (Control_KeyIs(key, keyLen, "bme_period"))
+  {
+    if (value < CONTROL_MIN_BME_PERIOD || value > CONTROL_MAX_PERIOD)
+    {
+      return CONTROL_BAD_VALUE;
+    }
+    settings->bmePeriod = value;
+  }
+  else if (Control_KeyIs(key, keyLen, "bme_os"))
+  {
+    rc = Control_Oversample(value, &settings->bmeOsT);
+    settings->bmeOsP = settings->bmeOsT;
+    settings->bmeOsH = settings->bmeOsT;
+    return rc;
+  }
+  else if (Control_KeyIs(key, keyLen, "bme_os_t"))
+  {
+    return Control_Oversample(value, &settings->bmeOsT);
+  }
+  else if (Control_KeyIs(key, keyLen, "bme_os_p"))
+  {
+    return Control_Oversample(value, &settings->bmeOsP);
+  }
+  else if (Control_KeyIs(key, keyLen, "bme_os_h"))
+  {
+    return Control_Oversample(value, &settings->bmeOsH);
+  }
+  else if (Control_KeyIs(key, keyLen, "bme_filter"))
+  {
+    return Control_Filter(value, &settings->bmeFilter);
+  }
+  else if (Control_KeyIs(key, keyLen, "bme_standby"))
+  {
+    return Control_Standby(value, &settings->bmeStandby);
+  }
+  else
+  {
+    return CONTROL_BAD_KEY;
+  }
+
+  return CONTROL_OK;
+}
+
+/*!
+* @brief  Copies the active settings.
+* @param  dev - control structure
+* @param  settings - copy of the settings
+*/
+void Control_Get(control_dev_t* dev, control_settings_t* settings)
+{
+  taskENTER_CRITICAL();
+  *settings = dev->settings;
+  taskEXIT_CRITICAL();
+}
+
+/*!
+* @brief  Parses a command and applies it. Nothing changes unless every
+*         setting in the command is valid, the notified tasks then pick up
+*         the new settings with Control_Get.
+* @param  dev - control structure
+* @param  cmd - command, does not need to be NUL terminated
+* @param  len - length of the command
+* @return control status
+*/
+control_status_t Control_Apply(control_dev_t* dev, const char* cmd, size_t len)
+{
+  control_settings_t settings;
+  control_status_t rc;
+  const char* key;
+  size_t keyLen;
+  size_t pos = 0;
+  size_t digits;
+  size_t count = 0;
+  uint32_t value;
+  uint8_t i;
+
+  Control_Get(dev, &settings);
+
+  while (1)
+  {
+    while (pos < len && Control_IsSeparator(cmd[pos]))
+    {
+      pos++;
+    }
+    if (pos == len)
+    {
+      break;
+    }
+
+    // key up to the equals sign
+    key = &cmd[pos];
+    while (pos < len && cmd[pos] != '=' && !Control_IsSeparator(cmd[pos]))
+    {
+      pos++;
+    }
+    keyLen = &cmd[pos] - key;
+    if (pos == len || cmd[pos] != '=' || keyLen == 0)
+    {
+      return CONTROL_BAD_FORMAT;
+    }
+    pos++;
+
+    // decimal value, rejecting overflow
+    value  = 0;
+    digits = 0;
+    while (pos < len && cmd[pos] >= '0' && cmd[pos] <= '9')
+    {
+      if (value > (UINT32_MAX - 9) / 10)
+      {
+        return CONTROL_BAD_VALUE;
+      }
+      value = value * 10 + (cmd[pos] - '0');
+      digits++;
+      pos++;
+    }
+    if (digits == 0 || (pos < len && !Control_IsSeparator(cmd[pos])))
+    {
+      return CONTROL_BAD_VALUE;
+    }
+
+    rc = Control_Set(&settings, key, keyLen, value);
+    if (rc != CONTROL_OK)
+    {
+      return rc;
+    }
+    count++;
+  }
+
+  // an empty command, such as a cleared retained message, changes nothing
+  if (count == 0)
+  {
+    return CONTROL_OK;
+  }
+
+  // a period shorter than the conversion returns the same result again
+  if (settings.luxPeriod < (settings.luxCt == OPT3002_800_MS ? 800U : 100U))
+  {
+    return CONTROL_BAD_VALUE;
+  }
+
+  taskENTER_CRITICAL();
+  dev->settings = settings;
+  taskEXIT_CRITICAL();
+
+  for (i = 0; i < CONTROL_NUM_NOTIFY_TASKS; i++)
+  {
+    if (dev->notifyTask[i] != NULL)
+    {
+      xTaskNotifyGive(dev->notifyTask[i]);
+    }
+  }
+
+  return CONTROL_OK;
+}
+
+/*!
+* @brief  enum to string conversion for control status codes.
+* @param  status - status enumeration value
+* @return string for the corresponding enumeration
+*/
+const char* Control_StatusString(control_status_t status)
+{
+  switch (status)
+  {
+    case CONTROL_OK:
+      return "OK";
+    case CONTROL_BAD_FORMAT:
+      return "BAD_FORMAT";
+    case CONTROL_BAD_KEY:
+      return "BAD_KEY";
+    case CONTROL_BAD_VALUE:
+      return "BAD_VALUE";
+    default:
+      return "UNKNOWN";
+  }
+}
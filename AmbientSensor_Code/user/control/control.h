@@ -0,0 +1,79 @@
+/******************************************************************************
+* Copyright 2019 Alex M.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+******************************************************************************/
+
+#ifndef _CONTROL_H_
+#define _CONTROL_H_
+
+#include <stddef.h>
+#include "FreeRTOS.h"
+#include "task.h"
+
+#define CONTROL_NUM_NOTIFY_TASKS 2       //!< number of tasks notified of setting changes
+#define CONTROL_MAX_PERIOD       3600000 //!< longest sample period in ms
+#define CONTROL_MIN_BME_PERIOD   10      //!< shortest BME280 sample period in ms
+
+// Commands are key=value pairs separated by spaces, commas or new lines,
+// values are decimal integers:
+//   lux_period  OPT3002 sample period in ms
+//   lux_ct      OPT3002 conversion time in ms, 100 or 800
+//   bme_period  BME280 sample period in ms
+//   bme_os      BME280 oversampling of every measurement, 1 to 16
+//   bme_os_t    BME280 temperature oversampling
+//   bme_os_p    BME280 pressure oversampling
+//   bme_os_h    BME280 humidity oversampling
+//   bme_filter  BME280 IIR filter coefficient, 0 (off) to 16
+//   bme_standby BME280 standby in ms, 1 (0.5), 10, 20, 63 (62.5), 125, 250, 500 or 1000
+
+//! runtime sampling settings
+typedef struct control_settings_t
+{
+  uint32_t luxPeriod;  //!< OPT3002 sample period in ms
+  uint8_t  luxCt;      //!< OPT3002 conversion time, see opt3002/opt3002.h
+  uint32_t bmePeriod;  //!< BME280 sample period in ms
+  uint8_t  bmeOsT;     //!< BME280 temperature oversampling, see bme280/bme280.h
+  uint8_t  bmeOsP;     //!< BME280 pressure oversampling
+  uint8_t  bmeOsH;     //!< BME280 humidity oversampling
+  uint8_t  bmeFilter;  //!< BME280 IIR filter coefficient
+  uint8_t  bmeStandby; //!< BME280 standby time in normal mode
+} control_settings_t;
+
+//! runtime sampling control
+typedef struct control_dev_t
+{
+  control_settings_t settings;                             //!< active settings, read with Control_Get
+  TaskHandle_t       notifyTask[CONTROL_NUM_NOTIFY_TASKS]; //!< tasks notified of changes
+} control_dev_t;
+
+//! control return codes
+typedef enum
+{
+  CONTROL_OK         = 0x00U,
+  CONTROL_BAD_FORMAT = 0x01U,
+  CONTROL_BAD_KEY    = 0x02U,
+  CONTROL_BAD_VALUE  = 0x03U,
+} control_status_t;
+
+void Control_Get(control_dev_t* dev, control_settings_t* settings);
+control_status_t Control_Apply(control_dev_t* dev, const char* cmd, size_t len);
+const char* Control_StatusString(control_status_t status);
+
+#endif // _CONTROL_H_
@@ -24,6 +24,7 @@
 #include "FreeRTOS.h"
 #include "task.h"
 #include "cmsis_os.h"
+#include "profiler/profiler.h"
 
 static const uint32_t EEPROM_TIMEOUT = 1000; //!< SPI timeout in milliseconds
 
@@ -44,6 +45,7 @@ eeprom_status_t EEPROM_ReadMemory(eeprom_dev_t* dev, uint8_t addr, uint8_t* buf,
   vTaskPrioritySet(NULL, osPriorityRealtime);
 
   // enable CS
+  PROFILER_START(start);
   HAL_GPIO_WritePin(dev->csPort, dev->csPin, GPIO_PIN_RESET);
 
   // send read command followed by address
@@ -62,6 +64,7 @@ eeprom_status_t EEPROM_ReadMemory(eeprom_dev_t* dev, uint8_t addr, uint8_t* buf,
 cleanup:
   // disable CS
   HAL_GPIO_WritePin(dev->csPort, dev->csPin, GPIO_PIN_SET);
+  PROFILER_STOP(PROFILER_EEPROM_READ, start, num);
 
   // restore original priority
   vTaskPrioritySet(NULL, originalPriority);
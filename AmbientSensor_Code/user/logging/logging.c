@@ -37,6 +37,7 @@ void Log_Init(UART_HandleTypeDef* huart)
 {
   logUart = *huart;
   logMutex = xSemaphoreCreateMutex();
+  configASSERT(logMutex != NULL);
   Log_printf("\n");
 }
 
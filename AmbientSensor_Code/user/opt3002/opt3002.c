@@ -24,6 +24,7 @@
 #include "FreeRTOS.h"
 #include "task.h"
 #include "cmsis_os.h"
+#include "profiler/profiler.h"
 #include <math.h>
 
 // register map
@@ -115,9 +116,10 @@ opt3002_status_t ReadRegister(opt3002_dev_t* dev, const uint8_t reg, uint16_t* b
 
   // take the mutex for the I2C bus
   xSemaphoreTake(dev->busMutex, portMAX_DELAY);
+  PROFILER_START(start);
 
   // do I2C transfer in critical section
-  taskENTER_CRITICAL();
+  PROFILER_ENTER_CRITICAL();
   rc = (opt3002_status_t) HAL_I2C_Mem_Read(
     &dev->hi2cx,
     dev->addr,
@@ -127,7 +129,8 @@ opt3002_status_t ReadRegister(opt3002_dev_t* dev, const uint8_t reg, uint16_t* b
     REG_SIZE,
     TIMEOUT
   );
-  taskEXIT_CRITICAL();
+  PROFILER_EXIT_CRITICAL();
+  PROFILER_STOP(PROFILER_OPT3002_READ, start, REG_SIZE);
 
   // release mutex
   xSemaphoreGive(dev->busMutex);
@@ -154,9 +157,10 @@ opt3002_status_t WriteRegister(opt3002_dev_t* dev, const uint8_t reg, uint16_t*
 
   // take the mutex for the I2C bus
   xSemaphoreTake(dev->busMutex, portMAX_DELAY);
+  PROFILER_START(start);
 
   // do I2C transfer in critical section
-  taskENTER_CRITICAL();
+  PROFILER_ENTER_CRITICAL();
   rc = (opt3002_status_t) HAL_I2C_Mem_Write(
     &dev->hi2cx,
     dev->addr,
@@ -166,7 +170,8 @@ opt3002_status_t WriteRegister(opt3002_dev_t* dev, const uint8_t reg, uint16_t*
     REG_SIZE,
     TIMEOUT
   );
-  taskEXIT_CRITICAL();
+  PROFILER_EXIT_CRITICAL();
+  PROFILER_STOP(PROFILER_OPT3002_WRITE, start, REG_SIZE);
 
   // release mutex
   xSemaphoreGive(dev->busMutex);
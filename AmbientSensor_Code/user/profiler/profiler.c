@@ -0,0 +1,162 @@
+/******************************************************************************
+* Copyright 2019 Alex M.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+******************************************************************************/
+
+#include "profiler/profiler.h"
+
+#if PROFILER_ENABLE
+#include "FreeRTOS.h"
+#include "task.h"
+#include "logging/logging.h"
+#include <stdio.h>
+
+//! call site names
+static const char* SITE_NAMES[PROFILER_NUM_SITES] =
+{
+  "W5500_READ",
+  "W5500_WRITE",
+  "EEPROM_READ",
+  "BME280_READ",
+  "BME280_WRITE",
+  "OPT3002_READ",
+  "OPT3002_WRITE",
+  "CRITICAL",
+};
+
+static profiler_entry_t table[PROFILER_NUM_SITES]; //!< statistics per call site
+static uint8_t          initialized;               //!< set once the table is reset
+static uint32_t         criticalStart;             //!< timestamp of the outermost critical section
+static UBaseType_t      criticalNesting;           //!< nesting depth of timed critical sections
+
+/*!
+* @brief  Records a bus transaction. The duration is converted with the
+*         current core clock, the clock profile may change before the
+*         statistics are formatted.
+* @param  site   - call site
+* @param  cycles - duration in CPU cycles
+* @param  bytes  - data bytes transferred
+*/
+void Profiler_Record(profiler_site_t site, uint32_t cycles, uint32_t bytes)
+{
+  taskENTER_CRITICAL();
+  if (!initialized)
+  {
+    Profiler_Reset();
+  }
+  Timing_StatsAdd(&table[site].time, Timing_CyclesToNs(cycles));
+  table[site].bytes += bytes;
+  taskEXIT_CRITICAL();
+}
+
+/*!
+* @brief  Enters a critical section, the time until the matching
+*         Profiler_ExitCritical is recorded as PROFILER_CRITICAL.
+*         Only sections entered through PROFILER_ENTER_CRITICAL are timed,
+*         the short sections inside FreeRTOS are not.
+*/
+void Profiler_EnterCritical(void)
+{
+  taskENTER_CRITICAL();
+  if (criticalNesting++ == 0)
+  {
+    criticalStart = Timing_GetCycles();
+  }
+}
+
+/*!
+* @brief  Exits a critical section entered with Profiler_EnterCritical.
+*/
+void Profiler_ExitCritical(void)
+{
+  if (--criticalNesting == 0)
+  {
+    Profiler_Record(PROFILER_CRITICAL, Timing_GetCycles() - criticalStart, 0);
+  }
+  taskEXIT_CRITICAL();
+}
+
+/*!
+* @brief  Clears the statistics of all call sites.
+*/
+void Profiler_Reset(void)
+{
+  uint8_t site;
+
+  taskENTER_CRITICAL();
+  for (site = 0; site < PROFILER_NUM_SITES; site++)
+  {
+    Timing_StatsReset(&table[site].time);
+    table[site].bytes = 0;
+  }
+  initialized = 1;
+  taskEXIT_CRITICAL();
+}
+
+/*!
+* @brief  Formats the statistics of a call site as a single line.
+* @param  site - call site
+* @param  buf  - output buffer
+* @param  len  - length of the output buffer
+* @return characters printed, as returned by snprintf
+*/
+int Profiler_Format(profiler_site_t site, char* buf, size_t len)
+{
+  profiler_entry_t entry;
+
+  // copy so the line is consistent
+  taskENTER_CRITICAL();
+  entry = table[site];
+  taskEXIT_CRITICAL();
+
+  if (entry.time.count == 0)
+  {
+    return snprintf(buf, len, "%s count 0", SITE_NAMES[site]);
+  }
+
+  return snprintf(
+    buf,
+    len,
+    "%s count %lu bytes %lu ns min %lu avg %lu max %lu",
+    SITE_NAMES[site],
+    entry.time.count,
+    entry.bytes,
+    entry.time.min,
+    Timing_StatsAvg(&entry.time),
+    entry.time.max
+  );
+}
+
+/*!
+* @brief  Logs the statistics of all call sites.
+*/
+void Profiler_Log(void)
+{
+  static const size_t LINE_LEN = 96;
+  char    line[LINE_LEN];
+  uint8_t site;
+
+  for (site = 0; site < PROFILER_NUM_SITES; site++)
+  {
+    Profiler_Format(site, line, LINE_LEN);
+    LOG_DEBUG("%s", line);
+  }
+}
+#endif
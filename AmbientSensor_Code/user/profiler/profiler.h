@@ -0,0 +1,77 @@
+/******************************************************************************
+* Copyright 2019 Alex M.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+******************************************************************************/
+
+#ifndef _PROFILER_H_
+#define _PROFILER_H_
+
+#include "stm32f0xx_hal.h"
+#include "timing/timing.h"
+#include <stddef.h>
+
+#define PROFILER_ENABLE 1 //!< record bus transaction statistics
+
+//! instrumented bus call sites
+typedef enum
+{
+  PROFILER_W5500_READ    = 0U, //!< W5500 SPI read frames
+  PROFILER_W5500_WRITE   = 1U, //!< W5500 SPI write frames
+  PROFILER_EEPROM_READ   = 2U, //!< 25AA02E48 SPI reads
+  PROFILER_BME280_READ   = 3U, //!< BME280 I2C register reads
+  PROFILER_BME280_WRITE  = 4U, //!< BME280 I2C register writes
+  PROFILER_OPT3002_READ  = 5U, //!< OPT3002 I2C register reads
+  PROFILER_OPT3002_WRITE = 6U, //!< OPT3002 I2C register writes
+  PROFILER_CRITICAL      = 7U, //!< interrupt-masked sections, see PROFILER_ENTER_CRITICAL
+  PROFILER_NUM_SITES     = 8U,
+} profiler_site_t;
+
+#if PROFILER_ENABLE
+//! statistics of one call site
+typedef struct profiler_entry_t
+{
+  timing_stats_t time;  //!< transaction durations in nanoseconds
+  uint32_t       bytes; //!< data bytes transferred
+} profiler_entry_t;
+
+//! starts timing a bus transaction
+#define PROFILER_START(start) uint32_t start = Timing_GetCycles()
+//! records a bus transaction started with PROFILER_START
+#define PROFILER_STOP(site, start, bytes) \
+  Profiler_Record((site), Timing_GetCycles() - (start), (bytes))
+//! enters a critical section timed as PROFILER_CRITICAL
+#define PROFILER_ENTER_CRITICAL() Profiler_EnterCritical()
+//! exits a critical section entered with PROFILER_ENTER_CRITICAL
+#define PROFILER_EXIT_CRITICAL()  Profiler_ExitCritical()
+
+void Profiler_Record(profiler_site_t site, uint32_t cycles, uint32_t bytes);
+void Profiler_EnterCritical(void);
+void Profiler_ExitCritical(void);
+void Profiler_Reset(void);
+void Profiler_Log(void);
+int  Profiler_Format(profiler_site_t site, char* buf, size_t len);
+#else
+#define PROFILER_START(start)
+#define PROFILER_STOP(site, start, bytes) ((void) 0U)
+#define PROFILER_ENTER_CRITICAL()         taskENTER_CRITICAL()
+#define PROFILER_EXIT_CRITICAL()          taskEXIT_CRITICAL()
+#endif
+
+#endif // _PROFILER_H_
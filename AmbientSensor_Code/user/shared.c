@@ -23,53 +23,131 @@
 #include "shared.h"
 #include "main.h"
 #include "spi.h"
+#include "i2c.h"
+#include "usart.h"
+#include "opt3002/opt3002.h"
+#include "bme280/bme280.h"
 
 char*         hostName = DEVICE_NAME;
+//! MQTT client ID, written to the W5500 straight from this buffer
+static const char CLIENT_ID[] __attribute__((aligned(16))) = DEVICE_NAME;
+clock_dev_t   clk;
 eeprom_dev_t  rom;
 w5500_dev_t   wiz;
 dhcp_client_t dhcp;
 mqtt_client_t mqtt;
+mcast_client_t mcast;
+link_monitor_t phy;
+control_dev_t control;
 
 /*!
 * @brief Initialized shared device structures.
 */
 void InitializeShared(void)
 {
+  // socket pool buffer memory in KB, at most 16 KB in each direction
+  static const uint8_t TX_BUF_SIZE[W5500_NUM_SOCKETS] = {8, 2, 1, 1, 1, 1, 1, 1};
+  static const uint8_t RX_BUF_SIZE[W5500_NUM_SOCKETS] = {4, 4, 2, 2, 1, 1, 1, 1};
   uint8_t sn;
 
   // W5500 Ethernet
-  wiz.hspix   = hspi1;              // SPI port
+  wiz.hspix   = &hspi1;             // SPI port
   wiz.csPort  = WIZ_CS_GPIO_Port;   // chip select port
   wiz.csPin   = WIZ_CS_Pin;         // chip select pin
   wiz.rstPort = WIZ_RST_GPIO_Port;  // reset port
   wiz.rstPin  = WIZ_RST_Pin;        // reset pin
   wiz.intPort = WIZ_INT_GPIO_Port;  // interrupt port
   wiz.intPin  = WIZ_INT_Pin;        // interrupt pin
+  wiz.cmdPolls    = 0;              // command poll counter
+  wiz.statusPolls = 0;              // status poll counter
+  wiz.busMutex    = spi1Mutex;      // SPI bus mutex, shared with the clock manager
+  wiz.xferTask    = NULL;           // no DMA transfer in progress
 
+  // socket pool
   for (sn = 0; sn < W5500_NUM_SOCKETS; sn++)
   {
-    wiz.snEvent[sn] = NULL;
+    wiz.snEvent[sn]   = NULL;
+    wiz.snOwner[sn]   = NULL;
+    wiz.snState[sn]   = W5500_SN_FREE;
+    wiz.txBufSize[sn] = TX_BUF_SIZE[sn];
+    wiz.rxBufSize[sn] = RX_BUF_SIZE[sn];
   }
 
+  // PHY link monitor, tasks to notify are set once they exist
+  phy.dev          = &wiz;              // monitored device
+  phy.period       = 250;               // PHYCFGR poll period in ticks
+  phy.up           = 0;                 // down until the first poll
+  phy.recovering   = 0;                 // nothing to measure yet
+  phy.upTick       = 0;
+  phy.downTick     = 0;
+
   // DHCP client
   dhcp.dev         = &wiz;              // DHCP client device
-  dhcp.sn          = 3;                 // DHCP socket number
+  dhcp.link        = &phy;              // waits on the link before leasing
+  dhcp.sn          = W5500_SN_NONE;     // allocated from the socket pool
   dhcp.hostName    = hostName;          // shared host name
   dhcp.hostNameLen = DEVICE_NAME_CHARS; // host name length
   dhcp.state       = DHCP_INIT;         // start DHCP FSM at DHCPINIT
 
   // MQTT client
-  mqtt.dev             = &wiz;          // MQTT client device
-  mqtt.sn              = 7;             // MQTT socket number
-  mqtt.ip[0]           = 10;            // server IP
-  mqtt.ip[1]           = 0;
-  mqtt.ip[2]           = 0;
-  mqtt.ip[3]           = 4;
-  mqtt.destinationPort = 1883;          // destination port
-  mqtt.sourcePort      = 33650;         // source port
+  mqtt.dev              = &wiz;          // MQTT client device
+  mqtt.sn               = W5500_SN_NONE; // allocated from the socket pool
+  mqtt.ip[0]            = 10;            // server IP
+  mqtt.ip[1]            = 0;
+  mqtt.ip[2]            = 0;
+  mqtt.ip[3]            = 4;
+  mqtt.destinationPort  = 1883;          // destination port
+  mqtt.sourcePort       = 33650;         // source port
+  mqtt.liveness.rtr     = 2000;          // 200 ms first retransmission, doubling
+  mqtt.liveness.rcr     = 3;             // 3 retransmissions, 3 s timeout
+  mqtt.liveness.kpalvtr = 1;             // 5 s keep alive when idle
+  mqtt.keepAlive        = 60;            // PINGREQ after 30 s idle, at least every 60 s
+  Timing_StatsReset(&mqtt.rtt);          // broker round trip times
+  mqtt.clientId         = CLIENT_ID;     // persistent session for QoS 1
+  mqtt.inflightHead     = 0;             // empty QoS 1 window
+  mqtt.inflightCount    = 0;
+  mqtt.packetId         = 0;             // first identifier is 1
+  mqtt.onMessage        = NULL;          // set by the MQTT task
+  mqtt.subscribeId      = 0;             // no SUBSCRIBE outstanding
+
+  // multicast sample client
+  mcast.dev            = &wiz;          // multicast client device
+  mcast.sn             = W5500_SN_NONE; // allocated from the socket pool
+  mcast.group[0]       = 239;           // administratively scoped group
+  mcast.group[1]       = 255;
+  mcast.group[2]       = 0;
+  mcast.group[3]       = 1;
+  mcast.groupPort      = 5007;          // group port
+  mcast.sourcePort     = 5007;          // source port
+  mcast.ttl            = 1;             // do not route beyond the LAN
+  mcast.seq            = 0;             // first sequence number
+
+  // sampling settings, changed at runtime from the command topic
+  control.settings.luxPeriod  = OPT3002_MIN_PERIOD;     // fastest OPT3002 rate
+  control.settings.luxCt      = OPT3002_100_MS;         // conversion time
+  control.settings.bmePeriod  = 1000;                   // one sample per standby period
+  control.settings.bmeOsT     = BME280_OVERSAMPLE_08;   // temperature oversampling
+  control.settings.bmeOsP     = BME280_OVERSAMPLE_08;   // pressure oversampling
+  control.settings.bmeOsH     = BME280_OVERSAMPLE_08;   // humidity oversampling
+  control.settings.bmeFilter  = BME280_FILTER_16;       // filter settings
+  control.settings.bmeStandby = BME280_STANDBY_1000_ms; // maximum standby to reduce self heating
+  control.notifyTask[0]       = NULL;                   // sampling tasks, set once created
+  control.notifyTask[1]       = NULL;
 
   // EEPROM
   rom.hspix  = hspi2;               // SPI port
   rom.csPort = EEPROM_CS_GPIO_Port; // chip select port
   rom.csPin  = EEPROM_CS_Pin;       // chip select pin
+
+  // clock manager
+  clk.spi[0].hspix    = &hspi1;     // W5500 SPI port
+  clk.spi[0].maxHz    = 18000000;   // STM32F070 SPI master limit, below the W5500
+  clk.spi[0].busMutex = spi1Mutex;
+  clk.spi[1].hspix    = &hspi2;     // EEPROM SPI port
+  clk.spi[1].maxHz    = 10000000;   // 25AA02E48 limit
+  clk.spi[1].busMutex = NULL;
+  clk.hi2cx           = &hi2c1;     // BME280 and OPT3002 I2C port
+  clk.i2cMutex        = i2c1Mutex;
+  clk.huartx          = &huart1;    // logging UART
+  clk.baud            = 115200;     // logging baud rate
 }
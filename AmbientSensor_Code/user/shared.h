@@ -23,19 +23,36 @@
 #ifndef _SHARED_H_
 #define _SHARED_H_
 
+#include "clock/clock.h"
 #include "eeprom/eeprom.h"
 #include "w5500/w5500.h"
 #include "w5500/dhcp.h"
 #include "w5500/mqtt.h"
+#include "w5500/mcast.h"
+#include "w5500/link.h"
+#include "control/control.h"
 
 #define DEVICE_NAME       "ambient1"                //!< device name used for MQTT client ID and host name
 #define DEVICE_NAME_CHARS (sizeof(DEVICE_NAME) - 1) //!< characters in the device name
 
+#define USE_MQTT_TRANSPORT  1 //!< publish samples to the MQTT broker
+#define USE_MCAST_TRANSPORT 1 //!< stream samples to the UDP multicast group
+#define USE_MQTT_BATCH      1 //!< publish samples together as JSON on the state topic
+#define USE_MQTT_FIELDS     0 //!< publish each sample on its own topic
+#define USE_MQTT_BINARY     0 //!< state message as packed records, see codec/codec.h
+#define SAMPLE_QOS          1 //!< QoS of sample messages, QoS 1 survives reconnects
+
 extern char*         hostName;   //!< device hostname
+extern clock_dev_t   clk;        //!< clock manager
 extern eeprom_dev_t  rom;        //!< EEPROM device structure
 extern w5500_dev_t   wiz;        //!< W5500 device structure
 extern dhcp_client_t dhcp;       //!< DHCP client
 extern mqtt_client_t mqtt;       //!< MQTT client
+extern mcast_client_t mcast;     //!< multicast sample client
+extern link_monitor_t phy;       //!< PHY link monitor
+extern control_dev_t control;    //!< runtime sampling settings
+extern SemaphoreHandle_t spi1Mutex; //!< W5500 SPI bus mutex, created before InitializeShared
+extern SemaphoreHandle_t i2c1Mutex; //!< sensor I2C bus mutex, created before InitializeShared
 
 void InitializeShared(void);
 
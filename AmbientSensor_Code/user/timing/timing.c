@@ -0,0 +1,123 @@
+/******************************************************************************
+* Copyright 2019 Alex M.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+******************************************************************************/
+
+#include "timing/timing.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+/*!
+* @brief  Gets a timestamp in CPU cycles.
+*         The Cortex-M0 has no cycle counter, the timestamp is built from the
+*         FreeRTOS tick count and the SysTick down counter.
+*         Safe to call from interrupts, wraps after 2^32 cycles.
+*         Timestamps taken on either side of a clock profile change are not
+*         comparable.
+* @return timestamp in CPU cycles
+*/
+uint32_t Timing_GetCycles(void)
+{
+  UBaseType_t mask;
+  uint32_t    reload = SysTick->LOAD + 1;
+  uint32_t    ticks;
+  uint32_t    val;
+
+  mask  = taskENTER_CRITICAL_FROM_ISR();
+  ticks = xTaskGetTickCountFromISR();
+  val   = SysTick->VAL;
+
+  // the counter wrapped but the tick interrupt has not run yet
+  if (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk)
+  {
+    ticks++;
+    val = SysTick->VAL;
+  }
+  taskEXIT_CRITICAL_FROM_ISR(mask);
+
+  return ticks * reload + (reload - 1 - val);
+}
+
+/*!
+* @brief  Converts a duration in CPU cycles to microseconds.
+* @param  cycles - duration in CPU cycles
+* @return duration in microseconds
+*/
+uint32_t Timing_CyclesToUs(uint32_t cycles)
+{
+  return cycles / (SystemCoreClock / 1000000U);
+}
+
+/*!
+* @brief  Converts a duration in CPU cycles to nanoseconds, saturating at
+*         UINT32_MAX.
+* @param  cycles - duration in CPU cycles
+* @return duration in nanoseconds
+*/
+uint32_t Timing_CyclesToNs(uint32_t cycles)
+{
+  uint64_t ns = (uint64_t)cycles * 1000U / (SystemCoreClock / 1000000U);
+  return ns > UINT32_MAX ? UINT32_MAX : (uint32_t)ns;
+}
+
+/*!
+* @brief  Resets duration statistics.
+* @param  stats - statistics to reset
+*/
+void Timing_StatsReset(timing_stats_t* stats)
+{
+  stats->count = 0;
+  stats->min   = UINT32_MAX;
+  stats->max   = 0;
+  stats->sum   = 0;
+}
+
+/*!
+* @brief  Adds a duration to the statistics.
+* @param  stats  - statistics to update
+* @param  cycles - duration in CPU cycles
+*/
+void Timing_StatsAdd(timing_stats_t* stats, uint32_t cycles)
+{
+  stats->count++;
+  stats->sum += cycles;
+  if (cycles < stats->min)
+  {
+    stats->min = cycles;
+  }
+  if (cycles > stats->max)
+  {
+    stats->max = cycles;
+  }
+}
+
+/*!
+* @brief  Gets the average duration.
+* @param  stats - statistics
+* @return average duration in CPU cycles, zero without samples
+*/
+uint32_t Timing_StatsAvg(const timing_stats_t* stats)
+{
+  if (stats->count == 0)
+  {
+    return 0;
+  }
+  return (uint32_t)(stats->sum / stats->count);
+}
@@ -0,0 +1,44 @@
+/******************************************************************************
+* Copyright 2019 Alex M.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+******************************************************************************/
+
+#ifndef _TIMING_H_
+#define _TIMING_H_
+
+#include "stm32f0xx_hal.h"
+
+//! min/avg/max statistics of a duration in CPU cycles
+typedef struct timing_stats_t
+{
+  uint32_t count; //!< number of samples
+  uint32_t min;   //!< minimum duration in cycles
+  uint32_t max;   //!< maximum duration in cycles
+  uint64_t sum;   //!< sum of all durations in cycles
+} timing_stats_t;
+
+uint32_t Timing_GetCycles(void);
+uint32_t Timing_CyclesToUs(uint32_t cycles);
+uint32_t Timing_CyclesToNs(uint32_t cycles);
+void     Timing_StatsReset(timing_stats_t* stats);
+void     Timing_StatsAdd(timing_stats_t* stats, uint32_t cycles);
+uint32_t Timing_StatsAvg(const timing_stats_t* stats);
+
+#endif // _TIMING_H_
@@ -29,6 +29,8 @@ static const TickType_t DHCP_INIT_FAIL_TIMEOUT = 3000; //!< failed initializatio
 static const TickType_t DHCP_SOCKET_TIMEOUT    =  100; //!< socket timeout
 static const TickType_t DHCP_SEND_TIMEOUT      =  100; //!< packet send timeout
 static const TickType_t DHCP_RECV_TIMEOUT      =  100; //!< packet receive timeout
+static const uint8_t    DHCP_TX_KB             =    1; //!< TX buffer, DHCP messages fit in 1 KB
+static const uint8_t    DHCP_RX_KB             =    2; //!< RX buffer, room for two offers
 
 //! DHCP magic cookie
 static const uint8_t MAGIC_COOKIE[MAGIC_COOKIE_SIZE] = {0x63, 0x82, 0x53, 0x63};
@@ -411,6 +413,32 @@ w5500_status_t DHCP_Receive(dhcp_client_t* client, dhcp_msg_type_t* msgType)
   return rc;
 }
 
+/*!
+* @brief  Blocks until a lease is bound. The calling task must be in the
+*         bound task list to be woken.
+* @param  client - DHCP client
+* @param  timeout - timeout duration in ticks
+* @return 1 if a lease is bound
+*/
+uint8_t DHCP_WaitBound(dhcp_client_t* client, TickType_t timeout)
+{
+  TickType_t startTick = xTaskGetTickCount();
+  TickType_t elapsed;
+  uint32_t notify;
+
+  while (!client->bound)
+  {
+    elapsed = xTaskGetTickCount() - startTick;
+    if (elapsed >= timeout)
+    {
+      break;
+    }
+    xTaskNotifyWait(0, W5500_NOTIFY_BOUND, &notify, timeout - elapsed);
+  }
+
+  return client->bound;
+}
+
 /*!
 * @brief Runs the DHCP client.
 * @param argument - pointer to DHCP client
@@ -418,10 +446,29 @@ w5500_status_t DHCP_Receive(dhcp_client_t* client, dhcp_msg_type_t* msgType)
 void DHCP_ClientTask(void const * argument)
 {
   dhcp_client_t* client = (dhcp_client_t*)argument;
+  w5500_status_t rc;
+
+  // the DHCP client keeps its socket for the lifetime of the device
+  while (client->sn == W5500_SN_NONE)
+  {
+    rc = W5500_SocketAlloc(client->dev, "DHCP", DHCP_TX_KB, DHCP_RX_KB, &client->sn);
+    if (rc != W5500_OK)
+    {
+      LOG_ERROR("W5500_SocketAlloc failed %s", W5500_StatusString(rc));
+      vTaskDelay(DHCP_INIT_FAIL_TIMEOUT);
+    }
+  }
 
   // DHCP finite state machine
   while (1)
   {
+    // do not send discovers into an unplugged cable
+    if (client->state == DHCP_INIT && !client->link->up)
+    {
+      LOG_INFO("waiting for link up");
+      LINK_WaitUp(client->link, portMAX_DELAY);
+    }
+
     LOG_DEBUG("State: %s", StateString(client->state));
     switch (client->state)
     {
@@ -724,16 +771,30 @@ inline void DHCP_HandleBOUND(dhcp_client_t* client)
   w5500_status_t rc;
   TickType_t sleepDuration;
 
-  // resume tasks that need a bound IP
+  // wake tasks that need a bound IP, the state is read from the client
+  client->bound = 1;
   for (i = 0; i < DHCP_NUM_BOUND_TASKS; i++)
   {
-    vTaskResume(client->boundTask[i]);
+    if (client->boundTask[i] != NULL)
+    {
+      xTaskNotify(client->boundTask[i], W5500_NOTIFY_BOUND, eSetBits);
+    }
   }
 
-  // sleep
+  W5500_LogStats(client->dev);
+
+  // sleep, waking early if the link goes down
   sleepDuration = client->leaseDuration - (xTaskGetTickCount() - client->leaseTick);
   LOG_DEBUG("Sleeping for %lus", sleepDuration / configTICK_RATE_HZ);
-  vTaskDelay(sleepDuration);
+  if (LINK_WaitDown(client->link, sleepDuration))
+  {
+    // the lease may still be valid, confirm it once the link is back
+    LINK_WaitUp(client->link, portMAX_DELAY);
+  }
+
+  // tasks that need a bound IP wait at their next check, they are not
+  // stopped in the middle of an operation holding the SPI bus
+  client->bound = 0;
 
   // attempt renewal
   rc = DHCP_SendREQUEST(client);
@@ -747,12 +808,6 @@ inline void DHCP_HandleBOUND(dhcp_client_t* client)
     client->state = DHCP_RENEWING;
   }
 
-  // suspend tasks that need a bound IP
-  for (i = 0; i < DHCP_NUM_BOUND_TASKS; i++)
-  {
-    vTaskSuspend(client->boundTask[i]);
-  }
-
   return;
 }
 
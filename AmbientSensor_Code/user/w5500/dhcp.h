@@ -25,12 +25,13 @@
 
 #include "constants.h"
 #include "w5500/w5500.h"
+#include "w5500/link.h"
 #include "logging/logging.h"
 #include "FreeRTOS.h"
 #include "task.h"
 #include "cmsis_os.h"
 
-#define DHCP_NUM_BOUND_TASKS    1 //!< Number of bound tasks
+#define DHCP_NUM_BOUND_TASKS    2 //!< Number of tasks notified when bound
 #define DHCP_SOURCE_PORT       68 //!< DHCP source port
 #define DHCP_DESTINATION_PORT  67 //!< DHCP destination port
 #define DHCP_CHADDR_SIZE       16 //!< client hardware address size
@@ -128,17 +129,22 @@ typedef union dhcp_msg_t
 //! DHCP client
 typedef struct dhcp_client_t
 {
-  w5500_dev_t* dev;                               //!< W5500 device to utilize 
-  uint8_t      sn;                                //!< socket number
-  char*        hostName;                          //!< device host name
-  uint8_t      hostNameLen;                       //!< host name length
-  uint8_t      clientIp[IPV4_BYTES];              //!< our IP address
-  uint8_t      serverIp[IPV4_BYTES];              //!< DHCP server IP
-  TickType_t   leaseTick;                         //!< DHCP lease time
-  TickType_t   leaseDuration;                     //!< DHCP lease duration
-  dhcp_state_t state;                             //!< DHCP state
-  TaskHandle_t boundTask[DHCP_NUM_BOUND_TASKS];   //!< tasks to suspend when not bound
-  dhcp_msg_t   msg __attribute__((aligned(16)));  //!< message buffer
+  w5500_dev_t*    dev;                                 //!< W5500 device to utilize 
+  uint8_t         sn;                                  //!< socket number
+  char*           hostName;                            //!< device host name
+  uint8_t         hostNameLen;                         //!< host name length
+  uint8_t         clientIp[IPV4_BYTES];                //!< our IP address
+  uint8_t         serverIp[IPV4_BYTES];                //!< DHCP server IP
+  TickType_t      leaseTick;                           //!< DHCP lease time
+  TickType_t      leaseDuration;                       //!< DHCP lease duration
+  dhcp_state_t    state;                               //!< DHCP state
+  link_monitor_t* link;                                //!< PHY link monitor
+  TaskHandle_t    boundTask[DHCP_NUM_BOUND_TASKS];     //!< tasks notified when bound
+  volatile uint8_t bound;                              //!< lease bound and not being renewed
+  dhcp_msg_t      msg __attribute__((aligned(16)));    //!< message buffer
 } dhcp_client_t;
 
+// function prototypes
+uint8_t DHCP_WaitBound(dhcp_client_t* client, TickType_t timeout);
+
 #endif // _DHCP_H_
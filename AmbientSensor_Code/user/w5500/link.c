@@ -0,0 +1,147 @@
+/******************************************************************************
+* Copyright 2019 Alex M.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+******************************************************************************/
+
+#include "w5500/link.h"
+
+/*!
+* @brief  Blocks until the link is up. The calling task must be in the
+*         notify list to be woken by link changes.
+* @param  link - link monitor
+* @param  timeout - timeout duration in ticks
+* @return 1 if the link is up
+*/
+uint8_t LINK_WaitUp(link_monitor_t* link, TickType_t timeout)
+{
+  TickType_t startTick = xTaskGetTickCount();
+  TickType_t elapsed;
+  uint32_t notify;
+
+  while (!link->up)
+  {
+    elapsed = xTaskGetTickCount() - startTick;
+    if (elapsed >= timeout)
+    {
+      break;
+    }
+    xTaskNotifyWait(0, W5500_NOTIFY_LINK, &notify, timeout - elapsed);
+  }
+
+  return link->up;
+}
+
+/*!
+* @brief  Blocks until the link goes down. The calling task must be in the
+*         notify list to be woken by link changes.
+* @param  link - link monitor
+* @param  timeout - timeout duration in ticks
+* @return 1 if the link is down
+*/
+uint8_t LINK_WaitDown(link_monitor_t* link, TickType_t timeout)
+{
+  TickType_t startTick = xTaskGetTickCount();
+  TickType_t elapsed;
+  uint32_t notify;
+
+  while (link->up)
+  {
+    elapsed = xTaskGetTickCount() - startTick;
+    if (elapsed >= timeout)
+    {
+      break;
+    }
+    xTaskNotifyWait(0, W5500_NOTIFY_LINK, &notify, timeout - elapsed);
+  }
+
+  return !link->up;
+}
+
+/*!
+* @brief  Logs the time from link up to the first publish, call after every
+*         successful publish.
+* @param  link - link monitor
+*/
+void LINK_Published(link_monitor_t* link)
+{
+  if (link->recovering)
+  {
+    link->recovering = 0;
+    LOG_INFO("Link up to first publish %lu ms", (xTaskGetTickCount() - link->upTick) * portTICK_PERIOD_MS);
+  }
+}
+
+/*!
+* @brief Polls the PHY link state and notifies tasks of changes.
+* @param argument - pointer to link monitor
+*/
+void LINK_MonitorTask(void const * argument)
+{
+  link_monitor_t* link = (link_monitor_t*)argument;
+  w5500_phycfgr_t phycfg __attribute__((aligned(16)));
+  w5500_status_t rc;
+  TickType_t lastWake = xTaskGetTickCount();
+  uint8_t up;
+  size_t i;
+
+  while (1)
+  {
+    rc = W5500_GetPHYCFGR(link->dev, &phycfg);
+    if (rc != W5500_OK)
+    {
+      LOG_ERROR("W5500_GetPHYCFGR failed %s", W5500_StatusString(rc));
+    }
+    else
+    {
+      up = phycfg.bits.lnk == W5500_LINK_UP;
+      if (up != link->up)
+      {
+        if (up)
+        {
+          link->upTick     = xTaskGetTickCount();
+          link->recovering = 1;
+          LOG_INFO(
+            "Link up %uMbps %s duplex, down for %lu ms",
+            phycfg.bits.spd ? 100 : 10,
+            phycfg.bits.dpx ? "Full" : "Half",
+            (link->upTick - link->downTick) * portTICK_PERIOD_MS
+          );
+        }
+        else
+        {
+          link->downTick = xTaskGetTickCount();
+          LOG_WARNING("Link down");
+        }
+
+        // state is read from the monitor, the notification only wakes tasks
+        link->up = up;
+        for (i = 0; i < LINK_NUM_NOTIFY_TASKS; i++)
+        {
+          if (link->notifyTask[i] != NULL)
+          {
+            xTaskNotify(link->notifyTask[i], W5500_NOTIFY_LINK, eSetBits);
+          }
+        }
+      }
+    }
+
+    vTaskDelayUntil(&lastWake, link->period);
+  }
+}
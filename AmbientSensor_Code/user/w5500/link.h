@@ -0,0 +1,48 @@
+/******************************************************************************
+* Copyright 2019 Alex M.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+******************************************************************************/
+
+#ifndef _LINK_H_
+#define _LINK_H_
+
+#include "w5500/w5500.h"
+#include "logging/logging.h"
+
+#define LINK_NUM_NOTIFY_TASKS 2 //!< number of tasks notified of link changes
+
+//! PHY link monitor
+typedef struct link_monitor_t
+{
+  w5500_dev_t*     dev;                               //!< W5500 device to monitor
+  TickType_t       period;                            //!< PHYCFGR poll period in ticks
+  TaskHandle_t     notifyTask[LINK_NUM_NOTIFY_TASKS]; //!< tasks notified of link changes
+  volatile uint8_t up;                                //!< link state from the last poll
+  volatile uint8_t recovering;                        //!< link came up and nothing was published yet
+  TickType_t       upTick;                            //!< tick of the last link up
+  TickType_t       downTick;                          //!< tick of the last link down
+} link_monitor_t;
+
+// function prototypes
+void LINK_MonitorTask(void const * argument);
+uint8_t LINK_WaitUp(link_monitor_t* link, TickType_t timeout);
+uint8_t LINK_WaitDown(link_monitor_t* link, TickType_t timeout);
+void LINK_Published(link_monitor_t* link);
+#endif // _LINK_H_
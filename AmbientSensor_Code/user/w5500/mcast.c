@@ -0,0 +1,97 @@
+/******************************************************************************
+* Copyright 2019 Alex M.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+******************************************************************************/
+
+#include "w5500/mcast.h"
+
+static const TickType_t MCAST_OPEN_TIMEOUT = 100; //!< socket open timeout
+static const TickType_t MCAST_SEND_TIMEOUT = 100; //!< datagram send timeout
+static const uint8_t    MCAST_TX_KB        =   1; //!< TX buffer, one datagram at a time
+static const uint8_t    MCAST_RX_KB        =   1; //!< RX buffer, multicast is send only
+
+/*!
+* @brief  Opens the multicast socket and joins the group.
+* @param  client - multicast client
+* @return W5500 status
+*/
+w5500_status_t MCAST_Initialize(mcast_client_t* client)
+{
+  w5500_status_t rc;
+
+  // take a socket from the pool
+  if (client->sn == W5500_SN_NONE)
+  {
+    rc = W5500_SocketAlloc(client->dev, "MCAST", MCAST_TX_KB, MCAST_RX_KB, &client->sn);
+    W5500_RETURN_NOT_OK(rc);
+  }
+
+  rc = W5500_SocketOpenMulticast(
+    client->dev,
+    client->sn,
+    client->group,
+    client->groupPort,
+    client->sourcePort,
+    client->ttl,
+    MCAST_OPEN_TIMEOUT
+  );
+
+  // return the socket to the pool on failure
+  if (rc != W5500_OK)
+  {
+    W5500_SocketFree(client->dev, &client->sn, MCAST_OPEN_TIMEOUT);
+  }
+
+  return rc;
+}
+
+/*!
+* @brief  Sends a sample to the multicast group.
+* @param  client - multicast client
+* @param  type - sample type
+* @param  value - sample value
+* @return W5500 status
+*/
+w5500_status_t MCAST_Send(mcast_client_t* client, uint8_t type, float value)
+{
+  mcast_datagram_t datagram __attribute__((aligned(16)));
+  union
+  {
+    float    f;
+    uint32_t u;
+  } bits;
+
+  bits.f = value;
+
+  datagram.field.version = MCAST_VERSION;
+  datagram.field.type    = type;
+  datagram.field.seq     = BYTE_SWAP_16(client->seq);
+  datagram.field.tick    = BYTE_SWAP_32((uint32_t)(xTaskGetTickCount() * portTICK_PERIOD_MS));
+  datagram.field.value   = BYTE_SWAP_32(bits.u);
+  client->seq++;
+
+  return W5500_SocketSend(
+    client->dev,
+    client->sn,
+    datagram.buf,
+    MCAST_DATAGRAM_BYTES,
+    MCAST_SEND_TIMEOUT
+  );
+}
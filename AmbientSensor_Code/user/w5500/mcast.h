@@ -0,0 +1,60 @@
+/******************************************************************************
+* Copyright 2019 Alex M.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+******************************************************************************/
+
+#ifndef _MCAST_H_
+#define _MCAST_H_
+
+#include "w5500/w5500.h"
+#include "logging/logging.h"
+
+#define MCAST_VERSION        1  //!< datagram format version
+#define MCAST_DATAGRAM_BYTES 12 //!< length of a sample datagram
+
+//! multicast sample datagram, multi-byte fields are big endian
+typedef union mcast_datagram_t {
+  struct {
+    uint8_t  version; //!< datagram format version
+    uint8_t  type;    //!< sample type
+    uint16_t seq;     //!< sequence number, wraps
+    uint32_t tick;    //!< sender tick count when sent, in ms
+    uint32_t value;   //!< sample value, IEEE 754 single precision
+  } __attribute__((packed)) field;
+  uint8_t buf[MCAST_DATAGRAM_BYTES];
+} mcast_datagram_t;
+
+//! multicast sample client
+typedef struct mcast_client_t
+{
+  w5500_dev_t* dev;                                            //!< W5500 device to utilize
+  uint8_t      sn;                                             //!< socket number
+  uint8_t      group[IPV4_BYTES] __attribute__((aligned(16))); //!< multicast group IP
+  uint16_t     groupPort;                                      //!< multicast group port
+  uint16_t     sourcePort;                                     //!< our port
+  uint8_t      ttl;                                            //!< IP time to live, 1 stays on the LAN
+  uint16_t     seq;                                            //!< next sequence number
+} mcast_client_t;
+
+// function prototypes
+w5500_status_t MCAST_Initialize(mcast_client_t* client);
+w5500_status_t MCAST_Send(mcast_client_t* client, uint8_t type, float value);
+
+#endif // _MCAST_H_
@@ -20,11 +20,71 @@
 * SOFTWARE.
 ******************************************************************************/
 
+#include <string.h>
 #include "w5500/mqtt.h"
 
 static const TickType_t MQTT_ACK_TIMEOUT    = 1000; //!< server acknowledgment timeout
 static const TickType_t MQTT_CON_TIMEOUT    =  500; //!< connection timeout
 static const TickType_t MQTT_SEND_TIMEOUT   =  100; //!< packet send timeout
+static const TickType_t MQTT_SPACE_TIMEOUT  = 1000; //!< wait for the server to acknowledge buffered data
+static const TickType_t MQTT_PING_TIMEOUT   = 5000; //!< PINGRESP deadline before the connection is torn down
+static const uint8_t    MQTT_TX_KB          =    8; //!< TX buffer, room for a sample backlog
+static const uint8_t    MQTT_RX_KB          =    4; //!< RX buffer
+
+/*!
+* @brief  Encodes a remaining length as an MQTT variable length integer,
+*         7 bits per byte with the high bit set when more bytes follow.
+* @param  len - remaining length
+* @param  buf - output buffer, at least MQTT_REM_LEN_BYTES long
+* @return bytes written, zero if the length cannot be encoded
+*/
+uint8_t MQTT_EncodeLength(uint32_t len, uint8_t* buf)
+{
+  uint8_t n = 0;
+
+  if (len > MQTT_REM_LEN_MAX)
+  {
+    return 0;
+  }
+
+  do
+  {
+    buf[n] = len & 0x7F;
+    len >>= 7;
+    if (len)
+    {
+      buf[n] |= 0x80;
+    }
+    n++;
+  } while (len);
+
+  return n;
+}
+
+/*!
+* @brief  Decodes an MQTT variable length integer.
+* @param  buf - encoded bytes
+* @param  bufLen - bytes available in buf
+* @param  len - decoded remaining length
+* @return bytes consumed, zero if the encoding is truncated or malformed
+*/
+uint8_t MQTT_DecodeLength(const uint8_t* buf, uint8_t bufLen, uint32_t* len)
+{
+  uint32_t value = 0;
+  uint8_t n;
+
+  for (n = 0; n < bufLen && n < MQTT_REM_LEN_BYTES; n++)
+  {
+    value |= (uint32_t)(buf[n] & 0x7F) << (7 * n);
+    if (!(buf[n] & 0x80))
+    {
+      *len = value;
+      return n + 1;
+    }
+  }
+
+  return 0;
+}
 
 /*!
 * @brief  Initializes the W5500 hardware for MQTT.
@@ -35,19 +95,172 @@ w5500_status_t MQTT_Initialize(mqtt_client_t* client)
 {
   w5500_status_t rc;
 
-  // open TCP socket
+  // take a socket from the pool
+  if (client->sn == W5500_SN_NONE)
+  {
+    rc = W5500_SocketAlloc(client->dev, "MQTT", MQTT_TX_KB, MQTT_RX_KB, &client->sn);
+    W5500_RETURN_NOT_OK(rc);
+  }
+
+  // open TCP socket and connect
   rc = W5500_SocketOpen(client->dev, client->sn, W5500_SN_PROTO_TCP, client->sourcePort, MQTT_CON_TIMEOUT);
+  if (rc == W5500_OK)
+  {
+    rc = W5500_SetLiveness(client->dev, client->sn, &client->liveness);
+  }
+  if (rc == W5500_OK)
+  {
+    rc = W5500_SocketConnect(client->dev, client->sn, client->ip, client->destinationPort, MQTT_CON_TIMEOUT);
+  }
+
+  // return the socket to the pool on failure
+  if (rc != W5500_OK)
+  {
+    W5500_SocketFree(client->dev, &client->sn, MQTT_CON_TIMEOUT);
+  }
+
+  return rc;
+}
+
+/*!
+* @brief  Sends a packet, queued behind the previous one with MQTT_ASYNC_SEND.
+* @param  client - MQTT client
+* @param  iov - packet segments
+* @param  iovcnt - number of segments
+* @return W5500 status
+*/
+static w5500_status_t MQTT_Send(mqtt_client_t* client, const w5500_iovec_t* iov, uint8_t iovcnt)
+{
+  w5500_status_t rc;
+#if MQTT_ASYNC_SEND
+  // queue behind the previous packet, waits only when the buffer is full
+  rc = W5500_SocketSendAsync(client->dev, client->sn, iov, iovcnt, MQTT_SPACE_TIMEOUT);
+  W5500_RETURN_NOT_OK(rc);
+#else
+  uint32_t fsr = UINT32_MAX;
+  uint32_t ptr = UINT32_MAX;
+
+  rc = W5500_SocketWritev(client->dev, client->sn, iov, iovcnt, &fsr, &ptr);
   W5500_RETURN_NOT_OK(rc);
 
-  // connect
-  rc = W5500_SocketConnect(client->dev, client->sn, client->ip, client->destinationPort, MQTT_CON_TIMEOUT);
+  // send data
+  rc = W5500_SocketSendBuffer(client->dev, client->sn, (uint16_t)ptr, MQTT_SEND_TIMEOUT);
   W5500_RETURN_NOT_OK(rc);
+#endif
 
+  client->lastActivity = xTaskGetTickCount();
   return rc;
 }
 
 /*!
-* @brief  Connects to the MQTT server.
+* @brief  Builds the PUBLISH template of a topic, the topic length is byte
+*         swapped and the topic copied once instead of on every publish.
+* @param  topic - template to build
+* @param  name - topic to publish to
+* @return W5500 status
+*/
+w5500_status_t MQTT_TopicInit(mqtt_topic_t* topic, const char* name)
+{
+  size_t len = strlen(name);
+
+  if (len > MQTT_TOPIC_MAX)
+  {
+    return W5500_TX_OVERFLOW;
+  }
+
+  topic->len = (uint16_t)len;
+  topic->buf[MQTT_TOPIC_OFFSET + 0] = (topic->len & 0xFF00) >> 8;
+  topic->buf[MQTT_TOPIC_OFFSET + 1] = (topic->len & 0x00FF) >> 0;
+  memcpy(&topic->buf[MQTT_TOPIC_OFFSET + 2], name, len);
+
+  return W5500_OK;
+}
+
+/*!
+* @brief  Sends a PUBLISH packet from a topic template.
+* @param  client - MQTT client
+* @param  topic - topic template, patched in place
+* @param  payload - payload to publish
+* @param  payloadLen - payload length, the packet must fit in the TX buffer
+* @param  qos - QoS level, the packet identifier is only sent above zero
+* @param  dup - set when retransmitting
+* @param  id - packet identifier
+* @return W5500 status
+*/
+static w5500_status_t MQTT_SendPublish(mqtt_client_t* client, mqtt_topic_t* topic, const uint8_t* payload, uint16_t payloadLen, uint8_t qos, uint8_t dup, uint16_t id)
+{
+  mqtt_publish_t header __attribute__((aligned(16)));
+  w5500_iovec_t iov[3];
+  uint16_t prefixLen = 2 + topic->len;
+  uint8_t lenBytes;
+  uint8_t start;
+  uint8_t iovcnt = 0;
+  uint8_t i;
+
+  // packet identifier behind the topic
+  if (qos)
+  {
+    topic->buf[MQTT_TOPIC_OFFSET + prefixLen + 0] = (id & 0xFF00) >> 8;
+    topic->buf[MQTT_TOPIC_OFFSET + prefixLen + 1] = (id & 0x00FF) >> 0;
+    prefixLen += MQTT_PACKET_ID_LEN;
+  }
+
+  header.field.retain = 0;
+  header.field.qos    = qos;
+  header.field.dup    = dup;
+  header.field.type   = MQTT_PUBLISH;
+  lenBytes = MQTT_EncodeLength((uint32_t)prefixLen + payloadLen, header.field.length);
+
+  // segments must start on an even address, the fixed header is written
+  // in front of the topic length unless that would leave it odd
+  start = MQTT_TOPIC_OFFSET - 1 - lenBytes;
+  if (start & 1)
+  {
+    iov[iovcnt].data = header.buf;
+    iov[iovcnt].len  = 1 + lenBytes;
+    iovcnt++;
+    start = MQTT_TOPIC_OFFSET;
+  }
+  else
+  {
+    // two or four bytes, cheaper than a memcpy call
+    for (i = 0; i <= lenBytes; i++)
+    {
+      topic->buf[start + i] = header.buf[i];
+    }
+    prefixLen += 1 + lenBytes;
+  }
+
+  // template and payload in a single frame
+  iov[iovcnt].data = &topic->buf[start];
+  iov[iovcnt].len  = prefixLen;
+  iovcnt++;
+  iov[iovcnt].data = payload;
+  iov[iovcnt].len  = payloadLen;
+  iovcnt++;
+
+  return MQTT_Send(client, iov, iovcnt);
+}
+
+/*!
+* @brief  Gets the next packet identifier, identifiers are never zero
+*         [MQTT-2.3.1-1].
+* @param  client - MQTT client
+* @return packet identifier
+*/
+static uint16_t MQTT_NextId(mqtt_client_t* client)
+{
+  client->packetId++;
+  if (client->packetId == 0)
+  {
+    client->packetId = 1;
+  }
+  return client->packetId;
+}
+
+/*!
+* @brief  Connects to the MQTT server, resuming the session so that QoS 1
+*         publishes still in the window are retransmitted.
 * @param  client - MQTT client
 * @return W5500 status
 */
@@ -56,10 +269,21 @@ w5500_status_t MQTT_Connect(mqtt_client_t* client)
   w5500_status_t rc;
   mqtt_connect_t connect __attribute__((aligned(16)));
   mqtt_connack_t connack __attribute__((aligned(16)));
+  mqtt_inflight_t* slot;
+  w5500_rx_stream_t rx;
+  uint32_t remLen;
+  uint16_t idLen = strlen(client->clientId);
+  uint8_t i;
+
+  // a resumed session needs a client ID the server will accept
+  if (idLen == 0 || idLen > MQTT_CLIENT_ID_MAX)
+  {
+    return W5500_MQTT_BAD_PACKET;
+  }
 
   connect.field.rsvd              = 0;                // zero out reserved bits
   connect.field.type              = MQTT_CONNECT;     // connect packet
-  connect.field.msgLen            = MQTT_CONNECT_LEN; // fixed length
+  MQTT_EncodeLength(MQTT_CONNECT_LEN + idLen, &connect.field.msgLen); // one byte for short IDs
   connect.field.protoLen          = MQTT_PROTO_LEN;   // fixed protocol length
   connect.field.proto[0]          = 'M';              // protocol name
   connect.field.proto[1]          = 'Q';
@@ -67,14 +291,14 @@ w5500_status_t MQTT_Connect(mqtt_client_t* client)
   connect.field.proto[3]          = 'T';
   connect.field.protoLevel        = MQTT_PROTO_LEVEL; // fixed protocol level
   connect.field.flag.rsvd         = 0;                // zero out reserved flag   
-  connect.field.flag.cleanSession = 1;                // do not store session state
+  connect.field.flag.cleanSession = 0;                // keep QoS 1 state across reconnects
   connect.field.flag.willFlag     = 0;                // do not store will message
   connect.field.flag.willQos      = 0;                // must be zero with willFlag=0
   connect.field.flag.willRetain   = 0;                // must be zero with willFlag=0
   connect.field.flag.passwordFlag = 0;                // no password
   connect.field.flag.userName     = 0;                // no username
-  connect.field.keepAlive         = 3600;             // 3600 second keep alive
-  connect.field.clientIdLen       = 0;                // no client ID
+  connect.field.keepAlive         = client->keepAlive; // see MQTT_Process
+  connect.field.clientIdLen       = idLen;            // client ID follows the header
 
   // byte swap the 16-bit fields
   connect.field.protoLen    = BYTE_SWAP_16(connect.field.protoLen);
@@ -82,15 +306,31 @@ w5500_status_t MQTT_Connect(mqtt_client_t* client)
   connect.field.clientIdLen = BYTE_SWAP_16(connect.field.clientIdLen);
 
   // send CONNECT
-  rc = W5500_SocketSend(client->dev, client->sn, connect.buf, MQTT_CONNECT_BUF_LEN, MQTT_SEND_TIMEOUT);
+  w5500_iovec_t iov[] = {
+    { .data = connect.buf,                      .len = MQTT_CONNECT_BUF_LEN },
+    { .data = (const uint8_t*)client->clientId, .len = idLen                },
+  };
+  rc = MQTT_Send(client, iov, sizeof(iov) / sizeof(iov[0]));
   W5500_RETURN_NOT_OK(rc);
 
   // wait for CONNACK
-  rc = W5500_SocketRecieveTCP(client->dev, client->sn, connack.buf, MQTT_CONNACK_BUF_LEN, MQTT_ACK_TIMEOUT);
+  rc = W5500_SocketAvailable(client->dev, client->sn, &rx, MQTT_ACK_TIMEOUT);
+  W5500_RETURN_NOT_OK(rc);
+
+  // read CONNACK directly from the socket buffer
+  rc = W5500_SocketPeek(client->dev, client->sn, &rx, 0, connack.buf, MQTT_CONNACK_BUF_LEN);
+  if (rc == W5500_RX_OVERFLOW)
+  {
+    return W5500_MQTT_BAD_PACKET;
+  }
+  W5500_RETURN_NOT_OK(rc);
+  rc = W5500_SocketConsume(client->dev, client->sn, &rx, MQTT_CONNACK_BUF_LEN);
   W5500_RETURN_NOT_OK(rc);
 
   // check for correct packet
-  if (connack.field.type != MQTT_CONNACK || connack.field.len != 2)
+  if (connack.field.type != MQTT_CONNACK
+    || MQTT_DecodeLength(&connack.buf[1], MQTT_CONNACK_BUF_LEN - 1, &remLen) != 1
+    || remLen != 2)
   {
     return W5500_MQTT_BAD_PACKET;
   }
@@ -101,53 +341,567 @@ w5500_status_t MQTT_Connect(mqtt_client_t* client)
     return W5500_MQTT_CON_REFUSED;
   }
 
-  return rc;
+  client->lastActivity = xTaskGetTickCount();
+  client->pingPending  = 0;
+  client->pingTick     = client->lastActivity;
+
+  // retransmit unacknowledged publishes in their original order [MQTT-4.4.0-1]
+  if (client->inflightCount)
+  {
+    LOG_INFO(
+      "MQTT session %s, resending %u publishes",
+      connack.field.ackFlag & 0x01 ? "resumed" : "new",
+      client->inflightCount
+    );
+  }
+  for (i = 0; i < client->inflightCount; i++)
+  {
+    slot = &client->inflight[(client->inflightHead + i) & (MQTT_INFLIGHT_MAX - 1)];
+    if (slot->id)
+    {
+      rc = MQTT_SendPublish(client, slot->topic, slot->payload, slot->payloadLen, 1, 1, slot->id);
+      W5500_RETURN_NOT_OK(rc);
+    }
+  }
+
+  // resends queued behind the CONNECT would wait for the next publish
+  return MQTT_Flush(client);
 }
 
 /*!
-* @brief  Publishes a message to the server.
+* @brief  Records the round trip time of the outstanding PINGREQ.
 * @param  client - MQTT client
-* @param  topic - topic to publish to
-* @param  topicLen - length of the topic
-* @param  payload - payload to publish
-* @param  payloadLen - payload length
+*/
+static void MQTT_PingResponse(mqtt_client_t* client)
+{
+  uint32_t rtt;
+
+  if (!client->pingPending)
+  {
+    LOG_WARNING("MQTT unexpected PINGRESP");
+    return;
+  }
+
+  rtt = (xTaskGetTickCount() - client->pingTick) * portTICK_PERIOD_MS;
+  client->pingPending = 0;
+  Timing_StatsAdd(&client->rtt, rtt);
+  LOG_INFO(
+    "MQTT RTT %lu ms, min %lu avg %lu max %lu",
+    rtt,
+    client->rtt.min,
+    Timing_StatsAvg(&client->rtt),
+    client->rtt.max
+  );
+}
+
+/*!
+* @brief  Releases the acknowledged QoS 1 publish from the window.
+* @param  client - MQTT client
+* @param  id - packet identifier of the PUBACK
+*/
+static void MQTT_PublishAck(mqtt_client_t* client, uint16_t id)
+{
+  mqtt_inflight_t* slot;
+  uint8_t i;
+
+  for (i = 0; i < client->inflightCount; i++)
+  {
+    slot = &client->inflight[(client->inflightHead + i) & (MQTT_INFLIGHT_MAX - 1)];
+    if (slot->id == id)
+    {
+      slot->id = 0;
+      break;
+    }
+  }
+  if (i == client->inflightCount)
+  {
+    LOG_WARNING("MQTT unexpected PUBACK %u", id);
+    return;
+  }
+
+  // an out of order acknowledgment leaves a hole until the oldest is released
+  while (client->inflightCount && client->inflight[client->inflightHead].id == 0)
+  {
+    client->inflightHead = (client->inflightHead + 1) & (MQTT_INFLIGHT_MAX - 1);
+    client->inflightCount--;
+  }
+}
+
+/*!
+* @brief  Passes a received PUBLISH to the message handler and acknowledges
+*         it at QoS 1.
+* @param  client - MQTT client
+* @param  rx - RX stream state
+* @param  offset - offset of the variable header in the RX stream
+* @param  remLen - remaining length of the packet
+* @param  qos - QoS level from the fixed header
 * @return W5500 status
 */
-w5500_status_t MQTT_Publish(mqtt_client_t* client, const char* topic, uint16_t topicLen, const char* payload, uint16_t payloadLen)
+static w5500_status_t MQTT_ReceivePublish(mqtt_client_t* client, const w5500_rx_stream_t* rx, uint16_t offset, uint32_t remLen, uint8_t qos)
 {
-  static const uint16_t TOPIC_LEN_BYTES = 2;
+  uint8_t buf[MQTT_PUBACK_BUF_LEN] __attribute__((aligned(16)));
   w5500_status_t rc;
-  mqtt_publish_t header __attribute__((aligned(16)));
-  uint32_t fsr = UINT32_MAX;
-  uint32_t ptr = UINT32_MAX;
+  uint16_t topicLen;
+  uint16_t payloadAt;
+  uint16_t id = 0;
+  uint32_t payloadPos;
+  uint32_t payloadLen;
 
-  header.field.retain = 0;
-  header.field.qos    = 0;
-  header.field.dup    = 0;
-  header.field.type   = MQTT_PUBLISH;
-  header.field.length = topicLen + payloadLen + TOPIC_LEN_BYTES;
+  // we subscribe with QoS 1 at most
+  if (qos > 1 || remLen < 2)
+  {
+    return W5500_MQTT_BAD_PACKET;
+  }
 
-  // write header
-  rc = W5500_SocketWritePart(client->dev, client->sn, header.buf, MQTT_PUBLISH_BUF_LEN, &fsr, &ptr);
+  rc = W5500_SocketPeek(client->dev, client->sn, rx, offset, buf, 2);
   W5500_RETURN_NOT_OK(rc);
+  topicLen   = ((uint16_t)buf[0] << 8) | buf[1];
+  payloadPos = 2 + topicLen + (qos ? MQTT_PACKET_ID_LEN : 0);
+  if (payloadPos > remLen)
+  {
+    return W5500_MQTT_BAD_PACKET;
+  }
+  payloadLen = remLen - payloadPos;
 
-  // write topic length
-  topicLen = BYTE_SWAP_16(topicLen);
-  rc = W5500_SocketWritePart(client->dev, client->sn, (uint8_t*)&topicLen, TOPIC_LEN_BYTES, &fsr, &ptr);
+  if (qos)
+  {
+    rc = W5500_SocketPeek(client->dev, client->sn, rx, offset + 2 + topicLen, buf, MQTT_PACKET_ID_LEN);
+    W5500_RETURN_NOT_OK(rc);
+    id = ((uint16_t)buf[0] << 8) | buf[1];
+  }
+
+  // the payload follows the topic at the next even offset, SPI transfers
+  // must start on a 16-bit aligned address
+  payloadAt = (topicLen + 1) & ~1U;
+  if (payloadAt + payloadLen > MQTT_MESSAGE_MAX)
+  {
+    LOG_WARNING("MQTT dropped %lu byte message", remLen);
+  }
+  else if (client->onMessage != NULL)
+  {
+    rc = W5500_SocketPeek(client->dev, client->sn, rx, offset + 2, client->message, topicLen);
+    W5500_RETURN_NOT_OK(rc);
+    rc = W5500_SocketPeek(client->dev, client->sn, rx, offset + payloadPos, &client->message[payloadAt], payloadLen);
+    W5500_RETURN_NOT_OK(rc);
+    client->onMessage((const char*)client->message, topicLen, &client->message[payloadAt], payloadLen);
+  }
+
+  if (qos == 0)
+  {
+    return rc;
+  }
+
+  // a dropped message is acknowledged too, redelivery would not fit either
+  buf[0] = MQTT_PUBACK << 4;
+  buf[1] = MQTT_PUBACK_LEN;
+  buf[2] = (id & 0xFF00) >> 8;
+  buf[3] = (id & 0x00FF) >> 0;
+  w5500_iovec_t iov[] = {
+    { .data = buf, .len = MQTT_PUBACK_BUF_LEN },
+  };
+  return MQTT_Send(client, iov, sizeof(iov) / sizeof(iov[0]));
+}
+
+/*!
+* @brief  Reads the packets the server has sent without waiting.
+*         Incomplete packets are left in the socket buffer until the rest
+*         arrives.
+* @param  client - MQTT client
+* @return W5500 status
+*/
+static w5500_status_t MQTT_Receive(mqtt_client_t* client)
+{
+  uint8_t hdr[1 + MQTT_REM_LEN_BYTES] __attribute__((aligned(16)));
+  w5500_rx_stream_t rx;
+  w5500_status_t rc;
+  uint32_t remLen;
+  uint32_t packetLen;
+  uint16_t offset = 0;
+  uint16_t hdrLen;
+  uint8_t lenBytes;
+
+  // nothing arrived since the last call, skip the SPI traffic
+  if (!(xEventGroupGetBits(client->dev->snEvent[client->sn]) & W5500_SN_EVENT_RECV))
+  {
+    return W5500_OK;
+  }
+  xEventGroupClearBits(client->dev->snEvent[client->sn], W5500_SN_EVENT_RECV);
+
+  rc = W5500_SocketAvailable(client->dev, client->sn, &rx, 0);
+  if (rc == W5500_RECV_TIMEOUT)
+  {
+    return W5500_OK;
+  }
   W5500_RETURN_NOT_OK(rc);
 
-  // write topic
-  topicLen = BYTE_SWAP_16(topicLen);
-  rc = W5500_SocketWritePart(client->dev, client->sn, (uint8_t*)topic, topicLen, &fsr, &ptr);
+  // the smallest packet is a fixed header with a zero remaining length
+  while (rx.size - offset >= MQTT_PING_BUF_LEN)
+  {
+    hdrLen = rx.size - offset;
+    if (hdrLen > sizeof(hdr))
+    {
+      hdrLen = sizeof(hdr);
+    }
+    rc = W5500_SocketPeek(client->dev, client->sn, &rx, offset, hdr, hdrLen);
+    W5500_RETURN_NOT_OK(rc);
+
+    lenBytes = MQTT_DecodeLength(&hdr[1], hdrLen - 1, &remLen);
+    if (lenBytes == 0)
+    {
+      // every length byte is present and the encoding did not end
+      if (hdrLen == sizeof(hdr))
+      {
+        return W5500_MQTT_BAD_PACKET;
+      }
+      break;
+    }
+
+    packetLen = 1 + lenBytes + remLen;
+    if (packetLen > (uint32_t)(rx.size - offset))
+    {
+      // the packet can never be received in full
+      if (packetLen > ((uint32_t)client->dev->rxBufSize[client->sn] << 10))
+      {
+        return W5500_MQTT_BAD_PACKET;
+      }
+      break;
+    }
+
+    switch (hdr[0] >> 4)
+    {
+      case MQTT_PINGRESP:
+        if (remLen != 0)
+        {
+          return W5500_MQTT_BAD_PACKET;
+        }
+        MQTT_PingResponse(client);
+        break;
+      case MQTT_PUBACK:
+        if (remLen != MQTT_PUBACK_LEN)
+        {
+          return W5500_MQTT_BAD_PACKET;
+        }
+        MQTT_PublishAck(client, ((uint16_t)hdr[2] << 8) | hdr[3]);
+        break;
+      case MQTT_PUBLISH:
+        rc = MQTT_ReceivePublish(client, &rx, offset + 1 + lenBytes, remLen, (hdr[0] >> 1) & 0x03);
+        W5500_RETURN_NOT_OK(rc);
+        break;
+      case MQTT_SUBACK:
+        if (remLen != MQTT_SUBACK_LEN)
+        {
+          return W5500_MQTT_BAD_PACKET;
+        }
+        if ((((uint16_t)hdr[2] << 8) | hdr[3]) == client->subscribeId)
+        {
+          client->subscribeRc = hdr[4];
+          client->subscribeId = 0;
+        }
+        break;
+      default:
+        LOG_WARNING("MQTT ignored packet type %u", hdr[0] >> 4);
+        break;
+    }
+    offset += (uint16_t)packetLen;
+  }
+
+  // free every parsed packet with a single RECV command
+  if (offset)
+  {
+    rc = W5500_SocketConsume(client->dev, client->sn, &rx, offset);
+  }
+  return rc;
+}
+
+/*!
+* @brief  Sends queued packets and sleeps until the server sends more data.
+* @param  client - MQTT client
+* @param  startTick - tick the acknowledgment timeout is measured from
+* @return W5500 status
+*/
+static w5500_status_t MQTT_WaitReceive(mqtt_client_t* client, TickType_t startTick)
+{
+  TickType_t elapsed = xTaskGetTickCount() - startTick;
+
+  if (elapsed >= MQTT_ACK_TIMEOUT)
+  {
+    return W5500_MQTT_ACK_TIMEOUT;
+  }
+
+  xEventGroupWaitBits(
+    client->dev->snEvent[client->sn],
+    W5500_SN_EVENT_RECV | W5500_SN_EVENT_DISCON | W5500_SN_EVENT_TIMEOUT,
+    pdFALSE,
+    pdFALSE,
+    MQTT_ACK_TIMEOUT - elapsed
+  );
+  return MQTT_CheckAlive(client);
+}
+
+/*!
+* @brief  Waits for PUBACKs until the window holds at most limit publishes.
+* @param  client - MQTT client
+* @param  limit - publishes that may stay unacknowledged
+* @return W5500 status
+*/
+static w5500_status_t MQTT_WaitAcks(mqtt_client_t* client, uint8_t limit)
+{
+  TickType_t startTick = xTaskGetTickCount();
+  w5500_status_t rc;
+
+  while (1)
+  {
+    // publishes queued behind a SEND in flight are not on the wire yet
+    rc = MQTT_Flush(client);
+    W5500_RETURN_NOT_OK(rc);
+    rc = MQTT_Receive(client);
+    W5500_RETURN_NOT_OK(rc);
+    if (client->inflightCount <= limit)
+    {
+      return rc;
+    }
+
+    rc = MQTT_WaitReceive(client, startTick);
+    W5500_RETURN_NOT_OK(rc);
+  }
+}
+
+/*!
+* @brief  Checks if the W5500 has given up on the connection, either from a
+*         retransmission or keep alive timeout, or from the server closing it.
+*         This only reads the socket event bits and costs no SPI traffic.
+* @param  client - MQTT client
+* @return W5500 status
+*/
+w5500_status_t MQTT_CheckAlive(mqtt_client_t* client)
+{
+  EventBits_t event = xEventGroupGetBits(client->dev->snEvent[client->sn]);
+  if (event & W5500_SN_EVENT_TIMEOUT || event & W5500_SN_EVENT_DISCON)
+  {
+    return W5500_SOCKET_DISCONNECTED;
+  }
+  return W5500_OK;
+}
+
+/*!
+* @brief  Runs the keep alive engine. Reads packets from the server and sends
+*         a PINGREQ after half the keep alive interval without a send, or at
+*         least once per interval so the broker round trip time is sampled
+*         while publishing. Only blocks for a SEND in flight ahead of the
+*         PINGREQ.
+* @param  client - MQTT client
+* @return W5500 status, W5500_MQTT_PING_TIMEOUT if the PINGRESP is late
+*/
+w5500_status_t MQTT_Process(mqtt_client_t* client)
+{
+  static const uint8_t PINGREQ[MQTT_PING_BUF_LEN] __attribute__((aligned(16))) = {MQTT_PINGREQ << 4, 0};
+  const w5500_iovec_t iov[] = {
+    { .data = PINGREQ, .len = MQTT_PING_BUF_LEN },
+  };
+  TickType_t interval = (TickType_t)client->keepAlive * configTICK_RATE_HZ;
+  TickType_t now;
+  w5500_status_t rc;
+
+  rc = MQTT_CheckAlive(client);
+  W5500_RETURN_NOT_OK(rc);
+  rc = MQTT_Receive(client);
   W5500_RETURN_NOT_OK(rc);
+  if (interval == 0)
+  {
+    return rc;
+  }
+
+  // a late PINGRESP means the server is half-open or gone
+  now = xTaskGetTickCount();
+  if (client->pingPending)
+  {
+    return now - client->pingTick >= MQTT_PING_TIMEOUT ? W5500_MQTT_PING_TIMEOUT : W5500_OK;
+  }
+
+  if (now - client->lastActivity >= interval / 2 || now - client->pingTick >= interval)
+  {
+    // a PINGREQ queued behind the SEND in flight goes out with the flush,
+    // while idle nothing else commits it and the round trip starts there
+    rc = MQTT_Send(client, iov, sizeof(iov) / sizeof(iov[0]));
+    W5500_RETURN_NOT_OK(rc);
+    rc = MQTT_Flush(client);
+    W5500_RETURN_NOT_OK(rc);
+    client->pingPending = 1;
+    client->pingTick    = xTaskGetTickCount();
+  }
+
+  return rc;
+}
+
+/*!
+* @brief  Publishes a message to the server.
+* @param  client - MQTT client
+* @param  topic - template of the topic to publish to, see MQTT_TopicInit,
+*         patched in place so all publishes must come from one task
+* @param  payload - payload to publish
+* @param  payloadLen - payload length, the packet must fit in the TX buffer
+* @param  qos - QoS 0, or QoS 1 to keep the publish in the window until
+*         acknowledged, waiting for a PUBACK when the window is full
+* @return W5500 status
+*/
+w5500_status_t MQTT_Publish(mqtt_client_t* client, mqtt_topic_t* topic, const char* payload, uint16_t payloadLen, uint8_t qos)
+{
+  mqtt_inflight_t* slot;
+  w5500_status_t rc;
+
+  if (qos == 0)
+  {
+    return MQTT_SendPublish(client, topic, (const uint8_t*)payload, payloadLen, 0, 0, 0);
+  }
+  if (qos > 1 || payloadLen > MQTT_INFLIGHT_PAYLOAD)
+  {
+    return W5500_TX_OVERFLOW;
+  }
 
-  // write payload
-  rc = W5500_SocketWritePart(client->dev, client->sn, (uint8_t*)payload, payloadLen, &fsr, &ptr);
+  rc = MQTT_WaitAcks(client, MQTT_INFLIGHT_MAX - 1);
   W5500_RETURN_NOT_OK(rc);
 
-  // send data
-  rc = W5500_SocketSendBuffer(client->dev, client->sn, (uint16_t)ptr, MQTT_SEND_TIMEOUT);
+  // keep a copy for retransmission until the PUBACK arrives
+  slot = &client->inflight[(client->inflightHead + client->inflightCount) & (MQTT_INFLIGHT_MAX - 1)];
+  slot->topic      = topic;
+  slot->id         = MQTT_NextId(client);
+  slot->payloadLen = payloadLen;
+  memcpy(slot->payload, payload, payloadLen);
+  client->inflightCount++;
+
+  return MQTT_SendPublish(client, topic, slot->payload, payloadLen, 1, 0, slot->id);
+}
+
+/*!
+* @brief  Subscribes to a topic and waits for the SUBACK. Messages are passed
+*         to the client message handler from MQTT_Process.
+* @param  client - MQTT client
+* @param  topic - topic filter
+* @param  topicLen - length of the topic filter
+* @param  qos - maximum QoS of the messages, 0 or 1
+* @return W5500 status
+*/
+w5500_status_t MQTT_Subscribe(mqtt_client_t* client, const char* topic, uint16_t topicLen, uint8_t qos)
+{
+  uint8_t header[MQTT_SUBSCRIBE_BUF_LEN] __attribute__((aligned(16)));
+  uint8_t topicLenBuf[2] __attribute__((aligned(16)));
+  uint8_t qosBuf[1] __attribute__((aligned(16)));
+  TickType_t startTick = xTaskGetTickCount();
+  w5500_status_t rc;
+  uint16_t id = MQTT_NextId(client);
+  uint8_t lenBytes;
+
+  if (qos > 1)
+  {
+    return W5500_MQTT_BAD_PACKET;
+  }
+
+  // reserved flags are 0010 [MQTT-3.8.1-1]
+  header[0] = (MQTT_SUBSCRIBE << 4) | 0x02;
+  lenBytes  = MQTT_EncodeLength((uint32_t)MQTT_PACKET_ID_LEN + 2 + topicLen + 1, &header[1]);
+  header[1 + lenBytes] = (id & 0xFF00) >> 8;
+  header[2 + lenBytes] = (id & 0x00FF) >> 0;
+  topicLenBuf[0] = (topicLen & 0xFF00) >> 8;
+  topicLenBuf[1] = (topicLen & 0x00FF) >> 0;
+  qosBuf[0]      = qos;
+
+  // header, packet identifier, topic filter and requested QoS
+  w5500_iovec_t iov[] = {
+    { .data = header,                .len = 1 + lenBytes + MQTT_PACKET_ID_LEN },
+    { .data = topicLenBuf,           .len = 2                                 },
+    { .data = (const uint8_t*)topic, .len = topicLen                          },
+    { .data = qosBuf,                .len = 1                                 },
+  };
+  client->subscribeId = id;
+  rc = MQTT_Send(client, iov, sizeof(iov) / sizeof(iov[0]));
   W5500_RETURN_NOT_OK(rc);
 
+  while (1)
+  {
+    rc = MQTT_Flush(client);
+    W5500_RETURN_NOT_OK(rc);
+    rc = MQTT_Receive(client);
+    W5500_RETURN_NOT_OK(rc);
+    if (client->subscribeId == 0)
+    {
+      break;
+    }
+
+    rc = MQTT_WaitReceive(client, startTick);
+    W5500_RETURN_NOT_OK(rc);
+  }
+
+  return client->subscribeRc == MQTT_SUBACK_FAILURE ? W5500_MQTT_SUB_REFUSED : W5500_OK;
+}
+
+/*!
+* @brief  Sends publishes still waiting behind a SEND in flight.
+* @param  client - MQTT client
+* @return W5500 status
+*/
+w5500_status_t MQTT_Flush(mqtt_client_t* client)
+{
+#if MQTT_ASYNC_SEND
+  return W5500_SocketSendFlush(client->dev, client->sn, MQTT_SEND_TIMEOUT);
+#else
+  return W5500_OK;
+#endif
+}
+
+/*!
+* @brief  Publishes messages back to back and logs the sustained rate and
+*         the CPU cycles spent in each MQTT_Publish call.
+* @param  client - MQTT client
+* @param  topic - topic template to publish to
+* @param  count - number of messages to publish
+* @param  qos - QoS level of the messages
+* @return W5500 status
+*/
+w5500_status_t MQTT_Benchmark(mqtt_client_t* client, mqtt_topic_t* topic, uint16_t count, uint8_t qos)
+{
+  static const char PAYLOAD[] __attribute__((aligned(16))) = "00.000";
+  w5500_status_t rc = W5500_OK;
+  TickType_t startTick = xTaskGetTickCount();
+  timing_stats_t cycles;
+  uint32_t start;
+  uint32_t elapsed;
+  uint16_t i;
+
+  Timing_StatsReset(&cycles);
+  for (i = 0; i < count; i++)
+  {
+    start = Timing_GetCycles();
+    rc = MQTT_Publish(client, topic, PAYLOAD, sizeof(PAYLOAD) - 1, qos);
+    Timing_StatsAdd(&cycles, Timing_GetCycles() - start);
+    if (rc != W5500_OK)
+    {
+      break;
+    }
+  }
+  if (rc == W5500_OK)
+  {
+    rc = MQTT_WaitAcks(client, 0);
+  }
+
+  elapsed = (xTaskGetTickCount() - startTick) * portTICK_PERIOD_MS;
+  if (elapsed == 0)
+  {
+    elapsed = 1;
+  }
+  LOG_INFO(
+    "MQTT benchmark %s QoS %u %u publishes in %lu ms, %lu publishes/s",
+    MQTT_ASYNC_SEND ? "async" : "blocking",
+    qos,
+    i,
+    elapsed,
+    (uint32_t)i * 1000 / elapsed
+  );
+  LOG_INFO(
+    "MQTT benchmark cycles per publish min %lu avg %lu max %lu",
+    cycles.min,
+    Timing_StatsAvg(&cycles),
+    cycles.max
+  );
+
   return rc;
 }
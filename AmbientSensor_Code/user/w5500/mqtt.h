@@ -25,14 +25,40 @@
 
 #include "w5500/w5500.h"
 #include "logging/logging.h"
+#include "timing/timing.h"
 
 // constants
 #define MQTT_PROTO_LEN        4 //!< length of the protocol name
 #define MQTT_PROTO_LEVEL      4 //!< protocol level [MQTT-3.1.2-2]
 #define MQTT_CONNECT_BUF_LEN 14 //!< total length of MQTT CONNECT packet
 #define MQTT_CONNACK_BUF_LEN  4 //!< total length of MQTT CONNACK packet
-#define MQTT_PUBLISH_BUF_LEN  2 //!< total length of MQTT PUBLISH packet header
+#define MQTT_PUBLISH_BUF_LEN  5 //!< maximum length of MQTT PUBLISH packet fixed header
+#define MQTT_PING_BUF_LEN     2 //!< total length of MQTT PINGREQ and PINGRESP packets
+#define MQTT_PUBACK_LEN       2 //!< remaining length of MQTT PUBACK packet
+#define MQTT_PUBACK_BUF_LEN   4 //!< total length of MQTT PUBACK packet
+#define MQTT_SUBSCRIBE_BUF_LEN 7 //!< maximum length of MQTT SUBSCRIBE fixed header and packet identifier
+#define MQTT_SUBACK_LEN       3 //!< remaining length of MQTT SUBACK packet for one topic
+#define MQTT_SUBACK_FAILURE 0x80 //!< SUBACK return code of a refused subscription
+#define MQTT_MESSAGE_MAX     96 //!< longest received topic and payload, longer messages are dropped
+#define MQTT_TOPIC_MAX       48 //!< longest topic of a publish template
+#define MQTT_TOPIC_OFFSET     6 //!< template offset of the topic length, even with room for the fixed header
+#define MQTT_TOPIC_BUF_LEN   (MQTT_TOPIC_OFFSET + 2 + MQTT_TOPIC_MAX + MQTT_PACKET_ID_LEN) //!< length of a publish template
+#define MQTT_PACKET_ID_LEN    2 //!< length of a packet identifier
+#define MQTT_CLIENT_ID_MAX   23 //!< longest client ID every server accepts [MQTT-3.1.3-5]
+#define MQTT_INFLIGHT_MAX     2 //!< unacknowledged QoS 1 publishes, a power of two
+#define MQTT_INFLIGHT_PAYLOAD 128 //!< largest QoS 1 payload kept for retransmission
 #define MQTT_CONNECT_LEN     12 //!< remaining length of the MQTT connect packet
+#define MQTT_REM_LEN_BYTES    4 //!< maximum bytes in a remaining length field
+#define MQTT_REM_LEN_MAX      268435455UL //!< largest remaining length [MQTT-2.2.3]
+
+// the QoS 1 window is a ring indexed with & (MQTT_INFLIGHT_MAX - 1)
+#if MQTT_INFLIGHT_MAX < 1 || (MQTT_INFLIGHT_MAX & (MQTT_INFLIGHT_MAX - 1)) != 0
+#error "MQTT_INFLIGHT_MAX must be a power of two"
+#endif
+
+// compile options
+#define MQTT_ASYNC_SEND 1 //!< pipeline publishes instead of waiting for each SENDOK
+#define MQTT_BENCHMARK  0 //!< measure the sustained publish rate after connecting
 
 //! MQTT control packets
 typedef enum {
@@ -105,23 +131,67 @@ typedef union mqtt_publish_t {
     uint8_t qos    : 2; //!< QoS level
     uint8_t dup    : 1; //!< message may be a redelivery
     uint8_t type   : 4; //!< control packet type
-    uint8_t length;     //!< total length of the packet
+    uint8_t length[MQTT_REM_LEN_BYTES]; //!< remaining length, 1 to 4 bytes used
   } __attribute__((packed)) field;
   uint8_t buf[MQTT_PUBLISH_BUF_LEN];
 } mqtt_publish_t;
 
+//! PUBLISH template built once per topic with MQTT_TopicInit, each publish
+//! patches the fixed header in front of the topic length and the packet
+//! identifier behind the topic, 64 bytes with the alignment padding
+typedef struct mqtt_topic_t
+{
+  uint8_t  buf[MQTT_TOPIC_BUF_LEN] __attribute__((aligned(16))); //!< fixed header room, topic length, topic and packet identifier
+  uint16_t len;                                                  //!< topic length
+} mqtt_topic_t;
+
+//! QoS 1 publish waiting for its PUBACK
+typedef struct mqtt_inflight_t
+{
+  mqtt_topic_t* topic;                          //!< topic template, must stay valid until acknowledged
+  uint16_t      id;                             //!< packet identifier, zero once acknowledged
+  uint16_t      payloadLen;                     //!< payload length
+  uint8_t       payload[MQTT_INFLIGHT_PAYLOAD]; //!< copy of the payload
+} mqtt_inflight_t;
+
+//! called with each message received on a subscribed topic
+typedef void (*mqtt_message_handler_t)(const char* topic, uint16_t topicLen, const uint8_t* payload, uint16_t payloadLen);
+
 //! MQTT client
 typedef struct mqtt_client_t
 {
-  w5500_dev_t* dev;                                         //!< W5500 device to utilize 
-  uint8_t      sn;                                          //!< socket number
-  uint8_t      ip[IPV4_BYTES] __attribute__((aligned(16))); //!< server IP
-  uint16_t     destinationPort;                             //!< server port
-  uint16_t     sourcePort;                                  //!< our port
+  w5500_dev_t*     dev;                                         //!< W5500 device to utilize 
+  uint8_t          sn;                                          //!< socket number
+  uint8_t          ip[IPV4_BYTES] __attribute__((aligned(16))); //!< server IP
+  uint16_t         destinationPort;                             //!< server port
+  uint16_t         sourcePort;                                  //!< our port
+  w5500_liveness_t liveness;                                    //!< dead server detection profile
+  TickType_t       lastActivity;                                //!< tick of the last successful send
+  uint16_t         keepAlive;                                   //!< keep alive interval in seconds, zero disables pings
+  uint8_t          pingPending;                                 //!< PINGREQ sent and not answered yet
+  TickType_t       pingTick;                                    //!< tick of the last PINGREQ
+  timing_stats_t   rtt;                                         //!< broker round trip times in ms
+  const char*      clientId;                                    //!< client ID, identifies the session, 16-bit aligned
+  mqtt_inflight_t  inflight[MQTT_INFLIGHT_MAX];                 //!< QoS 1 window in send order
+  uint8_t          inflightHead;                                //!< oldest publish in the window
+  uint8_t          inflightCount;                               //!< publishes in the window
+  uint16_t         packetId;                                    //!< last packet identifier used
+  mqtt_message_handler_t onMessage;                             //!< handler for received messages, may be NULL
+  uint8_t          message[MQTT_MESSAGE_MAX] __attribute__((aligned(16))); //!< received topic and payload
+  uint16_t         subscribeId;                                 //!< SUBSCRIBE waiting for its SUBACK, zero if none
+  uint8_t          subscribeRc;                                 //!< return code of the last SUBACK
 } mqtt_client_t;
 
 // function prototypes
+uint8_t MQTT_EncodeLength(uint32_t len, uint8_t* buf);
+uint8_t MQTT_DecodeLength(const uint8_t* buf, uint8_t bufLen, uint32_t* len);
 w5500_status_t MQTT_Initialize(mqtt_client_t* client);
 w5500_status_t MQTT_Connect(mqtt_client_t* client);
-w5500_status_t MQTT_Publish(mqtt_client_t* client, const char* topic, uint16_t topicLen, const char* payload, uint16_t payloadLen);
+w5500_status_t MQTT_CheckAlive(mqtt_client_t* client);
+w5500_status_t MQTT_Process(mqtt_client_t* client);
+w5500_status_t MQTT_TopicInit(mqtt_topic_t* topic, const char* name);
+w5500_status_t MQTT_Publish(mqtt_client_t* client, mqtt_topic_t* topic, const char* payload, uint16_t payloadLen, uint8_t qos);
+w5500_status_t MQTT_Subscribe(mqtt_client_t* client, const char* topic, uint16_t topicLen, uint8_t qos);
+w5500_status_t MQTT_Flush(mqtt_client_t* client);
+w5500_status_t MQTT_Benchmark(mqtt_client_t* client, mqtt_topic_t* topic, uint16_t count, uint8_t qos);
 #endif // _MQTT_H_
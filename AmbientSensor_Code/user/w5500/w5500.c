@@ -22,9 +22,97 @@
 
 #include "w5500/w5500.h"
 
+// interrupt assert wait time, IAWT = (INTLEVEL + 1) * 4 / 150 MHz
+static const uint16_t INT_LEVEL = 3749; //!< ~100 us between interrupts to coalesce events
+
+static const TickType_t CMD_TIMEOUT    = 10; //!< socket command acceptance timeout in ticks
+static const TickType_t POLL_MAX_DELAY =  8; //!< maximum delay between register polls in ticks
+
+//! all socket event bits
+static const EventBits_t SN_EVENT_ALL = W5500_SN_EVENT_CON
+                                      | W5500_SN_EVENT_DISCON
+                                      | W5500_SN_EVENT_RECV
+                                      | W5500_SN_EVENT_TIMEOUT
+                                      | W5500_SN_EVENT_SENDOK;
+
+/*!
+* @brief  Sleeps between register polls, doubling the delay each time.
+* @param  delay - current delay in ticks, start at 1
+*/
+static void W5500_PollBackoff(TickType_t* delay)
+{
+  vTaskDelay(*delay);
+  if (*delay < POLL_MAX_DELAY)
+  {
+    *delay <<= 1;
+  }
+}
+
+static w5500_status_t W5500_SocketOpenMode(w5500_dev_t* dev, uint8_t sn, w5500_sn_mr_t mode, uint16_t port, TickType_t timeout);
+
+/*!
+* @brief  Checks that socket buffer sizes are valid and fit in the W5500
+*         memory.
+* @param  size - buffer size in KB for each socket
+* @return W5500 status
+*/
+static w5500_status_t W5500_CheckSocketMemory(const uint8_t* size)
+{
+  uint8_t total = 0;
+  uint8_t sn;
+
+  for (sn = 0; sn < W5500_NUM_SOCKETS; sn++)
+  {
+    // sizes must be 0, 1, 2, 4, 8 or 16 KB
+    if (size[sn] > W5500_MEMORY_KB || (size[sn] & (size[sn] - 1)))
+    {
+      return W5500_BAD_MEMORY_CFG;
+    }
+    total += size[sn];
+  }
+
+  if (total > W5500_MEMORY_KB)
+  {
+    return W5500_BAD_MEMORY_CFG;
+  }
+
+  return W5500_OK;
+}
+
+/*!
+* @brief  Applies the socket buffer sizes from the device structure.
+* @param  dev - W5500 device structure
+* @return W5500 status
+*/
+w5500_status_t W5500_SetSocketMemory(w5500_dev_t* dev)
+{
+  w5500_status_t rc;
+  uint8_t size __attribute__((aligned(16)));
+  uint8_t sn;
+
+  rc = W5500_CheckSocketMemory(dev->txBufSize);
+  W5500_RETURN_NOT_OK(rc);
+  rc = W5500_CheckSocketMemory(dev->rxBufSize);
+  W5500_RETURN_NOT_OK(rc);
+
+  for (sn = 0; sn < W5500_NUM_SOCKETS; sn++)
+  {
+    size = dev->txBufSize[sn];
+    rc = W5500_SetSnTxBUFSIZE(dev, sn, &size);
+    W5500_RETURN_NOT_OK(rc);
+
+    size = dev->rxBufSize[sn];
+    rc = W5500_SetSnRxBUFSIZE(dev, sn, &size);
+    W5500_RETURN_NOT_OK(rc);
+  }
+
+  return rc;
+}
+
 /*!
 * Initializes the W5500 device.
 * The correct MAC address must already be set in the device structure.
+* This does not wait for the link, see the link monitor.
 * @param  dev - W5500 device structure
 * @return W5500 status
 */
@@ -33,7 +121,7 @@ w5500_status_t W5500_Initialize(w5500_dev_t* dev)
   w5500_status_t rc;
   uint8_t reg __attribute__((aligned(16)));
   w5500_ir_t ir __attribute__((aligned(16)));
-  w5500_phycfgr_t phycfg __attribute__((aligned(16)));
+  uint16_t intLevel;
 
   W5500_HardReset(dev);
 
@@ -48,12 +136,9 @@ w5500_status_t W5500_Initialize(w5500_dev_t* dev)
     return W5500_RD_ERROR;
   }
 
-  // wait for link up
-  LOG_INFO("waiting for link up");
-  do {
-    rc = W5500_GetPHYCFGR(dev, &phycfg);
-    W5500_RETURN_NOT_OK(rc);
-  } while (phycfg.bits.lnk != W5500_LINK_UP);
+  // partition the socket buffer memory
+  rc = W5500_SetSocketMemory(dev);
+  W5500_RETURN_NOT_OK(rc);
 
   // source HW address
   rc = W5500_SetSHAR(dev, dev->mac); 
@@ -64,6 +149,11 @@ w5500_status_t W5500_Initialize(w5500_dev_t* dev)
   rc = W5500_SetSIMR(dev, &reg);
   W5500_RETURN_NOT_OK(rc);
 
+  // coalesce interrupts under load
+  intLevel = INT_LEVEL;
+  rc = W5500_SetINTLEVEL(dev, &intLevel);
+  W5500_RETURN_NOT_OK(rc);
+
   // enable generic interrupts
   ir.all = 0;
   ir.bits.conflict = 1;
@@ -74,6 +164,37 @@ w5500_status_t W5500_Initialize(w5500_dev_t* dev)
   return rc;
 }
 
+/*!
+* @brief  Logs socket owners and register cache counters.
+* @param  dev - W5500 device structure
+*/
+void W5500_LogStats(w5500_dev_t* dev)
+{
+  uint8_t sn;
+
+  for (sn = 0; sn < W5500_NUM_SOCKETS; sn++)
+  {
+    if (dev->snState[sn] != W5500_SN_FREE)
+    {
+      LOG_DEBUG(
+        "W5500 socket %u %s %s",
+        sn,
+        dev->snOwner[sn],
+        dev->snState[sn] == W5500_SN_OPEN ? "OPEN" : "CLOSED"
+      );
+    }
+  }
+
+  LOG_DEBUG("W5500 polls Sn_CR %lu Sn_SR %lu", dev->cmdPolls, dev->statusPolls);
+#if W5500_USE_SHADOW
+  LOG_DEBUG(
+    "W5500 shadow saved %lu writes %lu reads",
+    dev->shadow.writesSkipped,
+    dev->shadow.readsCached
+  );
+#endif
+}
+
 /*!
 * @brief  Logs the PHY status.
 * @param  dev - W5500 device structure
@@ -104,13 +225,111 @@ w5500_status_t W5500_LogPhyStatus(w5500_dev_t* dev)
 */
 w5500_status_t W5500_SocketClose(w5500_dev_t* dev, uint8_t sn, TickType_t timeout)
 {
-  if (dev->snEvent[sn] != NULL)
-  {
-    vEventGroupDelete(dev->snEvent[sn]);
-  }
   w5500_status_t rc = W5500_SocketCommand(dev, sn, W5500_SN_CMD_CLOSE);
   W5500_RETURN_NOT_OK(rc);
-  return W5500_SocketStatusWait(dev, sn, W5500_SN_STATUS_CLOSED, timeout);
+  rc = W5500_SocketStatusWait(dev, sn, W5500_SN_STATUS_CLOSED, timeout);
+  W5500_RETURN_NOT_OK(rc);
+  if (dev->snState[sn] == W5500_SN_OPEN)
+  {
+    dev->snState[sn] = W5500_SN_ALLOCATED;
+  }
+  return rc;
+}
+
+/*!
+* @brief  Allocates a free socket from the pool.
+*         The smallest socket with enough buffer memory is chosen, leaving
+*         the larger sockets for later requests.
+* @param  dev - W5500 device structure
+* @param  owner - owner name for diagnostics
+* @param  txKB - minimum TX buffer size in KB
+* @param  rxKB - minimum RX buffer size in KB
+* @param  sn - allocated socket index
+* @return W5500 status
+*/
+w5500_status_t W5500_SocketAlloc(w5500_dev_t* dev, const char* owner, uint8_t txKB, uint8_t rxKB, uint8_t* sn)
+{
+  EventGroupHandle_t event;
+  uint8_t best = W5500_SN_NONE;
+  uint8_t i;
+
+  vTaskSuspendAll();
+  for (i = 0; i < W5500_NUM_SOCKETS; i++)
+  {
+    if (dev->snState[i] != W5500_SN_FREE
+        || dev->txBufSize[i] < txKB
+        || dev->rxBufSize[i] < rxKB)
+    {
+      continue;
+    }
+    if (best == W5500_SN_NONE
+        || dev->txBufSize[i] + dev->rxBufSize[i] < dev->txBufSize[best] + dev->rxBufSize[best])
+    {
+      best = i;
+    }
+  }
+  if (best != W5500_SN_NONE)
+  {
+    dev->snState[best] = W5500_SN_ALLOCATED;
+    dev->snOwner[best] = owner;
+  }
+  xTaskResumeAll();
+
+  if (best == W5500_SN_NONE)
+  {
+    return W5500_NO_SOCKET;
+  }
+
+  // event groups are never deleted, the interrupt task may be using them
+  if (dev->snEvent[best] == NULL)
+  {
+    event = xEventGroupCreate();
+    if (event == NULL)
+    {
+      W5500_SocketFree(dev, &best, 0);
+      return W5500_OS_MEMORY_ERROR;
+    }
+    dev->snEvent[best] = event;
+  }
+  else
+  {
+    xEventGroupClearBits(dev->snEvent[best], SN_EVENT_ALL);
+  }
+
+  *sn = best;
+  return W5500_OK;
+}
+
+/*!
+* @brief  Closes a socket if it is open and returns it to the pool.
+*         The socket is reclaimed even if closing fails, the next open
+*         closes it again.
+* @param  dev - W5500 device structure
+* @param  sn - socket index, set to W5500_SN_NONE
+* @param  timeout - timeout duration in ticks
+* @return W5500 status
+*/
+w5500_status_t W5500_SocketFree(w5500_dev_t* dev, uint8_t* sn, TickType_t timeout)
+{
+  w5500_status_t rc = W5500_OK;
+
+  if (*sn == W5500_SN_NONE)
+  {
+    return rc;
+  }
+
+  if (dev->snState[*sn] == W5500_SN_OPEN)
+  {
+    rc = W5500_SocketClose(dev, *sn, timeout);
+  }
+
+  vTaskSuspendAll();
+  dev->snState[*sn] = W5500_SN_FREE;
+  dev->snOwner[*sn] = NULL;
+  xTaskResumeAll();
+
+  *sn = W5500_SN_NONE;
+  return rc;
 }
 
 /*!
@@ -123,14 +342,94 @@ w5500_status_t W5500_SocketClose(w5500_dev_t* dev, uint8_t sn, TickType_t timeou
 * @return W5500 status
 */
 w5500_status_t W5500_SocketOpen(w5500_dev_t* dev, uint8_t sn, w5500_socket_proto_t protocol, uint16_t port, TickType_t timeout)
+{
+  w5500_sn_mr_t mode;
+  mode.all = 0;
+  mode.bits.proto = protocol;
+  return W5500_SocketOpenMode(dev, sn, mode, port, timeout);
+}
+
+/*!
+* @brief  Opens a UDP socket in multicast mode and joins the group.
+*         The W5500 sends the IGMP join when the socket opens and the
+*         leave when it closes.
+* @param  dev - W5500 device structure
+* @param  sn - socket index
+* @param  group - multicast group IP
+* @param  groupPort - multicast group port
+* @param  port - socket source port
+* @param  ttl - IP time to live of sent datagrams
+* @param  timeout - timeout duration in ticks
+* @return W5500 status
+*/
+w5500_status_t W5500_SocketOpenMulticast(
+  w5500_dev_t* dev,
+  uint8_t      sn,
+  uint8_t*     group,
+  uint16_t     groupPort,
+  uint16_t     port,
+  uint8_t      ttl,
+  TickType_t   timeout
+)
+{
+  w5500_status_t rc;
+  w5500_sn_mr_t mode;
+  uint8_t mac[MAC_BYTES] __attribute__((aligned(16)));
+  uint8_t ttlCopy __attribute__((aligned(16))) = ttl;
+
+  // group MAC is 01:00:5E followed by the low 23 bits of the group IP
+  mac[0] = 0x01;
+  mac[1] = 0x00;
+  mac[2] = 0x5E;
+  mac[3] = group[1] & 0x7F;
+  mac[4] = group[2];
+  mac[5] = group[3];
+
+  // group registers must be set before the socket is opened
+  rc = W5500_SetSnDHAR(dev, sn, mac);
+  W5500_RETURN_NOT_OK(rc);
+  rc = W5500_SocketDestination(dev, sn, group, groupPort);
+  W5500_RETURN_NOT_OK(rc);
+  rc = W5500_SetSnTTL(dev, sn, &ttlCopy);
+  W5500_RETURN_NOT_OK(rc);
+
+  mode.all = 0;
+  mode.bits.proto = W5500_SN_PROTO_UDP;
+  mode.bits.multi = 1;
+  return W5500_SocketOpenMode(dev, sn, mode, port, timeout);
+}
+
+/*!
+* @brief  Opens a socket with the given mode register.
+* @param  dev - W5500 device structure
+* @param  sn - socket index
+* @param  mode - socket mode register
+* @param  port - socket port to listen on
+* @param  timeout - timeout duration in ticks
+* @return W5500 status
+*/
+static w5500_status_t W5500_SocketOpenMode(w5500_dev_t* dev, uint8_t sn, w5500_sn_mr_t mode, uint16_t port, TickType_t timeout)
 {
   w5500_status_t rc;
-  w5500_sn_mr_t mode __attribute__((aligned(16)));
+  w5500_sn_mr_t modeCopy __attribute__((aligned(16))) = mode;
   w5500_sn_ir_t ir __attribute__((aligned(16)));
+  uint8_t protocol = mode.bits.proto;
 
   // MACRAW can only be used on socket 0
   ASSERT(!(protocol == W5500_SN_PROTO_MACRAW && sn != 0));
 
+  // socket must be allocated from the pool
+  if (sn >= W5500_NUM_SOCKETS || dev->snState[sn] == W5500_SN_FREE)
+  {
+    return W5500_NO_SOCKET;
+  }
+
+  // socket has no buffer memory
+  if (dev->txBufSize[sn] == 0 || dev->rxBufSize[sn] == 0)
+  {
+    return W5500_BAD_MEMORY_CFG;
+  }
+
   // close socket
   rc = W5500_SocketClose(dev, sn, timeout);
   W5500_RETURN_NOT_OK(rc);
@@ -145,12 +444,10 @@ w5500_status_t W5500_SocketOpen(w5500_dev_t* dev, uint8_t sn, w5500_socket_proto
     W5500_RETURN_NOT_OK(rc);
   }
 
-  // create socket event group
-  dev->snEvent[sn] = xEventGroupCreate();
-  if (dev->snEvent[sn] == NULL)
-  {
-    return W5500_OS_MEMORY_ERROR;
-  }
+  // discard events and sends from the previous connection
+  xEventGroupClearBits(dev->snEvent[sn], SN_EVENT_ALL);
+  dev->txAsync[sn].pending  = 0;
+  dev->txAsync[sn].inFlight = 0;
 
   // enable socket interrupts
   ir.all = 0;
@@ -163,9 +460,7 @@ w5500_status_t W5500_SocketOpen(w5500_dev_t* dev, uint8_t sn, w5500_socket_proto
   W5500_RETURN_NOT_OK(rc);
 
   // set socket mode
-  mode.all = 0;
-  mode.bits.proto = protocol;
-  rc = W5500_SetSnMR(dev, sn, &mode);
+  rc = W5500_SetSnMR(dev, sn, &modeCopy);
   W5500_RETURN_NOT_OK(rc);
 
   // set socket source port
@@ -190,6 +485,10 @@ w5500_status_t W5500_SocketOpen(w5500_dev_t* dev, uint8_t sn, w5500_socket_proto
     rc = W5500_SocketStatusWait(dev, sn, W5500_SN_STATUS_MACRAW, timeout);
   }
 
+  if (rc == W5500_OK)
+  {
+    dev->snState[sn] = W5500_SN_OPEN;
+  }
   return rc;
 }
 
@@ -239,6 +538,59 @@ w5500_status_t W5500_SocketConnect(w5500_dev_t* dev, uint8_t sn, uint8_t* ip, ui
   return rc;
 }
 
+/*!
+* @brief  Applies a TCP liveness profile.
+*         The retry time and count are common registers and also set the ARP
+*         timeout of every socket.
+* @param  dev - W5500 device structure
+* @param  sn - socket index
+* @param  profile - liveness profile to apply
+* @return W5500 status
+*/
+w5500_status_t W5500_SetLiveness(w5500_dev_t* dev, uint8_t sn, const w5500_liveness_t* profile)
+{
+  uint16_t rtr __attribute__((aligned(16))) = profile->rtr;
+  uint8_t  rcr __attribute__((aligned(16))) = profile->rcr;
+  uint8_t  kpalvtr __attribute__((aligned(16))) = profile->kpalvtr;
+  w5500_status_t rc;
+
+  rc = W5500_SetRTR(dev, &rtr);
+  W5500_RETURN_NOT_OK(rc);
+  rc = W5500_SetRCR(dev, &rcr);
+  W5500_RETURN_NOT_OK(rc);
+  rc = W5500_SetSnKPALVTR(dev, sn, &kpalvtr);
+  W5500_RETURN_NOT_OK(rc);
+
+  return rc;
+}
+
+/*!
+* @brief  Calculates the worst case time for a liveness profile to detect a
+*         dead peer, an idle keep alive period followed by the TCP
+*         retransmission timeout from the datasheet.
+* @param  profile - liveness profile
+* @return detection bound in milliseconds
+*/
+uint32_t W5500_LivenessBound(const w5500_liveness_t* profile)
+{
+  static const uint32_t RTR_MAX = 0xFFFF; //!< retry time doubling stops here
+  uint32_t timeout = 0;                   // retransmission timeout in 100 us
+  uint32_t rtr = profile->rtr;
+  uint8_t  n;
+
+  // the retry time doubles each retransmission until it would overflow
+  for (n = 0; n <= profile->rcr; n++)
+  {
+    timeout += rtr;
+    if ((rtr << 1) <= RTR_MAX)
+    {
+      rtr <<= 1;
+    }
+  }
+
+  return (uint32_t)profile->kpalvtr * 5000 + timeout / 10;
+}
+
 /*!
 * @brief  Sends a command to a socket.
 * @param  dev - W5500 device structure
@@ -249,15 +601,28 @@ w5500_status_t W5500_SocketConnect(w5500_dev_t* dev, uint8_t sn, uint8_t* ip, ui
 w5500_status_t W5500_SocketCommand(w5500_dev_t* dev, uint8_t sn, uint8_t cmd)
 {
   uint8_t cmdCopy __attribute__((aligned(16))) = cmd;
+  TickType_t startTick = xTaskGetTickCount();
+  TickType_t delay = 1;
   w5500_status_t rc = W5500_SetSnCR(dev, sn, &cmdCopy);
   W5500_RETURN_NOT_OK(rc);
 
-  // register will auto-clear when command has been accepted
-  do {
+  // register will auto-clear when command has been accepted, usually by the
+  // first read, afterwards yield to other tasks between reads
+  while (1)
+  {
     rc = W5500_GetSnCR(dev, sn, &cmdCopy);
     W5500_RETURN_NOT_OK(rc);
-  } while (cmdCopy);
-  return rc;
+    dev->cmdPolls++;
+    if (!cmdCopy)
+    {
+      return rc;
+    }
+    if (xTaskGetTickCount() - startTick >= CMD_TIMEOUT)
+    {
+      return W5500_CMD_TIMEOUT;
+    }
+    W5500_PollBackoff(&delay);
+  }
 }
 
 /*!
@@ -273,71 +638,159 @@ w5500_status_t W5500_SocketStatusWait(w5500_dev_t* dev, uint8_t sn, uint8_t stat
   uint8_t currentStatus __attribute__((aligned(16)));
   w5500_status_t rc;
   TickType_t startTick = xTaskGetTickCount();
-  do {
+  TickType_t delay = 1;
+
+  // OPEN and CLOSE status changes do not raise an interrupt, poll with a
+  // yielding backoff
+  while (1)
+  {
     rc = W5500_GetSnSR(dev, sn, &currentStatus);
     W5500_RETURN_NOT_OK(rc);
+    dev->statusPolls++;
+    if (currentStatus == status)
+    {
+      return rc;
+    }
     if (xTaskGetTickCount() - startTick >= timeout)
     {
       return W5500_STATUS_TIMEOUT;
     }
-  } while (currentStatus != status);
-  return rc;
+    W5500_PollBackoff(&delay);
+  }
 }
 
 /*!
-* @brief  Receives data from a TCP socket.
+* @brief  Waits for received data and starts reading the socket RX buffer.
 * @param  dev - W5500 device structure
 * @param  sn - socket index
-* @param  data - buffer to receive data into
-* @param  len - length of data buffer
+* @param  rx - RX stream state, filled with the read pointer and received size
 * @param  timeout - timeout duration in ticks
 * @return W5500 status
 */
-w5500_status_t W5500_SocketRecieveTCP(w5500_dev_t* dev, uint8_t sn, uint8_t* data, uint16_t len, TickType_t timeout)
+w5500_status_t W5500_SocketAvailable(w5500_dev_t* dev, uint8_t sn, w5500_rx_stream_t* rx, TickType_t timeout)
 {
+  w5500_sn_snapshot_t snap;
   w5500_status_t rc;
   EventBits_t event;
-  uint16_t ptr;
-  uint16_t rsr;
+  TickType_t startTick = xTaskGetTickCount();
+  TickType_t elapsed;
 
-  // wait for RECV event
-  event = xEventGroupWaitBits(dev->snEvent[sn], W5500_SN_EVENT_RECV | W5500_SN_EVENT_DISCON, pdTRUE, pdFALSE, timeout);
-  if (event & W5500_SN_EVENT_DISCON)
+  while (1)
   {
-    return W5500_SOCKET_DISCONNECTED;
+    rc = W5500_GetSnSnapshot(dev, sn, &snap);
+    W5500_RETURN_NOT_OK(rc);
+    if (snap.rxRsr)
+    {
+      rx->ptr  = snap.rxRd;
+      rx->size = snap.rxRsr;
+      return rc;
+    }
+
+    // DISCON is left set so that senders also see the disconnect
+    event = xEventGroupGetBits(dev->snEvent[sn]);
+    if (event & W5500_SN_EVENT_DISCON)
+    {
+      return W5500_SOCKET_DISCONNECTED;
+    }
+
+    elapsed = xTaskGetTickCount() - startTick;
+    if (elapsed >= timeout)
+    {
+      return W5500_RECV_TIMEOUT;
+    }
+
+    // wait for RECV event
+    xEventGroupWaitBits(dev->snEvent[sn], W5500_SN_EVENT_RECV | W5500_SN_EVENT_DISCON, pdFALSE, pdFALSE, timeout - elapsed);
+    xEventGroupClearBits(dev->snEvent[sn], W5500_SN_EVENT_RECV);
+  }
+}
+
+/*!
+* @brief  Reads from the socket RX buffer without consuming the data.
+* @param  dev - W5500 device structure
+* @param  sn - socket index
+* @param  rx - RX stream state from W5500_SocketAvailable
+* @param  offset - offset from the start of the unconsumed data
+* @param  data - buffer to receive data into
+* @param  len - length of data to read
+* @return W5500 status
+*/
+w5500_status_t W5500_SocketPeek(w5500_dev_t* dev, uint8_t sn, const w5500_rx_stream_t* rx, uint16_t offset, uint8_t* data, uint16_t len)
+{
+  if ((uint32_t)offset + len > rx->size)
+  {
+    return W5500_RX_OVERFLOW;
   }
-  else if (!(event & W5500_SN_EVENT_RECV))
+  if (len == 0)
   {
-    return W5500_RECV_TIMEOUT;
+    return W5500_OK;
   }
+  return W5500_GetSnRxBuf(dev, sn, rx->ptr + offset, data, len);
+}
 
-  rc = W5500_GetSnRxRSR(dev, sn, &rsr);
-  W5500_RETURN_NOT_OK(rc);
-  if (rsr > len)
+/*!
+* @brief  Consumes data from the socket RX buffer, freeing the space for
+*         new data.
+* @param  dev - W5500 device structure
+* @param  sn - socket index
+* @param  rx - RX stream state from W5500_SocketAvailable
+* @param  len - length of data to consume
+* @return W5500 status
+*/
+w5500_status_t W5500_SocketConsume(w5500_dev_t* dev, uint8_t sn, w5500_rx_stream_t* rx, uint16_t len)
+{
+  w5500_status_t rc;
+
+  if (len > rx->size)
   {
     return W5500_RX_OVERFLOW;
   }
 
-  // get read pointer location
-  rc = W5500_GetSnRxRD(dev, sn, &ptr);
-  W5500_RETURN_NOT_OK(rc);
+  // increment pointer
+  rx->ptr  += len;
+  rx->size -= len;
 
-  // read from W5500 into local buffer
-  rc = W5500_GetSnRxBuf(dev, sn, ptr, data, rsr);
+  // set read pointer location
+  rc = W5500_SetSnRxRD(dev, sn, &rx->ptr);
   W5500_RETURN_NOT_OK(rc);
 
-  // increment pointer
-  ptr += rsr;
+  // notify the W5500 that the data has been read
+  return W5500_SocketCommand(dev, sn, W5500_SN_CMD_RECV);
+}
 
-  // set read pointer location
-  rc = W5500_SetSnRxRD(dev, sn, &ptr);
+/*!
+* @brief  Receives data from a TCP socket.
+* @param  dev - W5500 device structure
+* @param  sn - socket index
+* @param  data - buffer to receive data into
+* @param  len - length of data buffer
+* @param  timeout - timeout duration in ticks
+* @return W5500 status
+*/
+w5500_status_t W5500_SocketRecieveTCP(w5500_dev_t* dev, uint8_t sn, uint8_t* data, uint16_t len, TickType_t timeout)
+{
+  w5500_rx_stream_t rx;
+  w5500_status_t rc;
+  uint16_t size;
+
+  rc = W5500_SocketAvailable(dev, sn, &rx, timeout);
   W5500_RETURN_NOT_OK(rc);
+  if (rx.size > len)
+  {
+    return W5500_RX_OVERFLOW;
+  }
 
-  return rc;
+  // read from W5500 into local buffer
+  size = rx.size;
+  rc = W5500_SocketPeek(dev, sn, &rx, 0, data, size);
+  W5500_RETURN_NOT_OK(rc);
+
+  return W5500_SocketConsume(dev, sn, &rx, size);
 }
 
 /*!
 * @brief  Receives data from a UDP socket.
+*         Datagrams larger than the buffer are dropped.
 * @param  dev - W5500 device structure
 * @param  sn - socket index
 * @param  data - buffer to receive data into
@@ -350,24 +803,15 @@ w5500_status_t W5500_SocketRecieveTCP(w5500_dev_t* dev, uint8_t sn, uint8_t* dat
 w5500_status_t W5500_SocketRecieveUDP(w5500_dev_t* dev, uint8_t sn, uint8_t* data, uint16_t len, TickType_t timeout, uint8_t* sourceIp, uint16_t* sourcePort)
 {
   w5500_packet_header_t header;
+  w5500_rx_stream_t rx;
   w5500_status_t rc;
-  EventBits_t event;
   size_t segment;
-  uint16_t ptr;
 
-  // wait for RECV event
-  event = xEventGroupWaitBits(dev->snEvent[sn], W5500_SN_EVENT_RECV, pdTRUE, pdFALSE, timeout);
-  if (!(event & W5500_SN_EVENT_RECV))
-  {
-    return W5500_RECV_TIMEOUT;
-  }
-
-  // get read pointer location
-  rc = W5500_GetSnRxRD(dev, sn, &ptr);
+  rc = W5500_SocketAvailable(dev, sn, &rx, timeout);
   W5500_RETURN_NOT_OK(rc);
 
   // read header
-  rc = W5500_GetSnRxBuf(dev, sn, ptr, header.buf, W5500_PACKET_HEADER_SIZE);
+  rc = W5500_SocketPeek(dev, sn, &rx, 0, header.buf, W5500_PACKET_HEADER_SIZE);
   W5500_RETURN_NOT_OK(rc);
   header.field.size = BYTE_SWAP_16(header.field.size);
 
@@ -384,27 +828,19 @@ w5500_status_t W5500_SocketRecieveUDP(w5500_dev_t* dev, uint8_t sn, uint8_t* dat
     }
   }
 
-  // ensure local buffer can receive all data
+  // ensure local buffer can receive all data, otherwise drop the datagram
   if (header.field.size > len)
   {
+    rc = W5500_SocketConsume(dev, sn, &rx, W5500_PACKET_HEADER_SIZE + header.field.size);
+    W5500_RETURN_NOT_OK(rc);
     return W5500_RX_OVERFLOW;
   }
 
-  // increment pointer by header length
-  ptr += W5500_PACKET_HEADER_SIZE;
-
   // read from W5500 into local buffer
-  rc = W5500_GetSnRxBuf(dev, sn, ptr, data, header.field.size);
-  W5500_RETURN_NOT_OK(rc);
-
-  // increment pointer
-  ptr += header.field.size;
-
-  // set read pointer location
-  rc = W5500_SetSnRxRD(dev, sn, &ptr);
+  rc = W5500_SocketPeek(dev, sn, &rx, W5500_PACKET_HEADER_SIZE, data, header.field.size);
   W5500_RETURN_NOT_OK(rc);
 
-  return rc;
+  return W5500_SocketConsume(dev, sn, &rx, W5500_PACKET_HEADER_SIZE + header.field.size);
 }
 
 /*!
@@ -418,9 +854,9 @@ w5500_status_t W5500_SocketRecieveUDP(w5500_dev_t* dev, uint8_t sn, uint8_t* dat
 */
 w5500_status_t W5500_SocketSend(w5500_dev_t* dev, uint8_t sn, uint8_t* data, uint16_t len, TickType_t timeout)
 {
+  w5500_sn_snapshot_t snap;
   w5500_status_t rc;
   EventBits_t event;
-  uint16_t size;
   uint16_t ptr;
 
   event = xEventGroupGetBits(dev->snEvent[sn]);
@@ -434,20 +870,17 @@ w5500_status_t W5500_SocketSend(w5500_dev_t* dev, uint8_t sn, uint8_t* data, uin
     return W5500_OK;
   }
 
-  // get buffer free size
-  rc = W5500_GetSnTxFSR(dev, sn, &size);
+  // get buffer free size and the starting address for the transmitting data
+  rc = W5500_GetSnSnapshot(dev, sn, &snap);
   W5500_RETURN_NOT_OK(rc);
+  ptr = snap.txWr;
 
   // message is larger than buffer free size
-  if (len > size)
+  if (len > snap.txFsr)
   {
     return W5500_TX_OVERFLOW;
   }
 
-  // read the starting address for saving the transmitting data
-  rc = W5500_GetSnTxWR(dev, sn, &ptr);
-  W5500_RETURN_NOT_OK(rc);
-
   // save the transmitting data at the starting address
   rc = W5500_SetSnTxBuf(dev, sn, ptr, data, len);
   W5500_RETURN_NOT_OK(rc);
@@ -474,16 +907,48 @@ w5500_status_t W5500_SocketSend(w5500_dev_t* dev, uint8_t sn, uint8_t* data, uin
 */
 w5500_status_t W5500_SocketWritePart(w5500_dev_t* dev, uint8_t sn, uint8_t* data, uint16_t len, uint32_t* fsr, uint32_t* ptr)
 {
-  w5500_status_t rc;
+  w5500_iovec_t iov = {
+    .data = data,
+    .len  = len,
+  };
+  return W5500_SocketWritev(dev, sn, &iov, 1, fsr, ptr);
+}
+
+/*!
+* @brief  Writes multiple segments to the socket in a single SPI frame.
+* @param  dev - W5500 device structure
+* @param  sn - socket index
+* @param  iov - segments to write
+* @param  iovcnt - number of segments
+* @param  fsr - free size register value, must start as UINT32_MAX
+* @param  ptr - position of the write pointer, must start as UINT32_MAX
+* @return W5500 status
+*/
+w5500_status_t W5500_SocketWritev(w5500_dev_t* dev, uint8_t sn, const w5500_iovec_t* iov, uint8_t iovcnt, uint32_t* fsr, uint32_t* ptr)
+{
+  w5500_sn_snapshot_t snap;
+  w5500_status_t rc = W5500_OK;
+  uint32_t len = 0;
   uint16_t _ptr;
   uint16_t _fsr;
+  uint8_t i;
 
-  // initialize fsr
-  if (*fsr == UINT32_MAX)
+  for (i = 0; i < iovcnt; i++)
   {
-    rc = W5500_GetSnTxFSR(dev, sn, &_fsr);
+    len += iov[i].len;
+  }
+
+  // initialize fsr and ptr from a single read of the socket registers
+  if (*fsr == UINT32_MAX || *ptr == UINT32_MAX)
+  {
+    rc = W5500_GetSnSnapshot(dev, sn, &snap);
     W5500_RETURN_NOT_OK(rc);
   }
+
+  if (*fsr == UINT32_MAX)
+  {
+    _fsr = snap.txFsr;
+  }
   else
   {
     _fsr = (uint16_t)(*fsr & UINT16_MAX);
@@ -495,29 +960,24 @@ w5500_status_t W5500_SocketWritePart(w5500_dev_t* dev, uint8_t sn, uint8_t* data
     return W5500_TX_OVERFLOW;
   }
 
-  // initialize ptr
   if (*ptr == UINT32_MAX)
   {
-    rc = W5500_GetSnTxWR(dev, sn, &_ptr);
-    W5500_RETURN_NOT_OK(rc);
+    _ptr = snap.txWr;
   }
   else
   {
     _ptr = (uint16_t)(*ptr & UINT16_MAX);
   }
 
-  if (len == 0)
-  {
-    rc = W5500_OK;
-  }
-  else
+  if (len)
   {
-    // save the transmitting data at the starting address
-    rc = W5500_SetSnTxBuf(dev, sn, _ptr, data, len);
+    // save the transmitting data at the starting address, the W5500 wraps
+    // the address within the socket buffer
+    rc = W5500_SetSnTxBufv(dev, sn, _ptr, iov, iovcnt);
     W5500_RETURN_NOT_OK(rc);
   }
 
-  // increment pointer
+  // increment pointer, wraps with the 16-bit register
   _ptr += len;
 
   // decrement free size
@@ -566,3 +1026,199 @@ w5500_status_t W5500_SocketSendBuffer(w5500_dev_t* dev, uint8_t sn, uint16_t ptr
 
   return rc;
 }
+
+/*!
+* @brief  Collects the SENDOK of an asynchronous send.
+* @param  dev - W5500 device structure
+* @param  sn - socket index
+* @param  timeout - time to wait in ticks, zero to only check
+* @return W5500 status, W5500_SEND_TIMEOUT while the SEND is in flight
+*/
+static w5500_status_t W5500_SocketSendReap(w5500_dev_t* dev, uint8_t sn, TickType_t timeout)
+{
+  EventBits_t event;
+
+  if (!dev->txAsync[sn].inFlight)
+  {
+    return W5500_OK;
+  }
+
+  event = xEventGroupWaitBits(
+    dev->snEvent[sn],
+    W5500_SN_EVENT_SENDOK | W5500_SN_EVENT_TIMEOUT | W5500_SN_EVENT_DISCON,
+    pdFALSE,
+    pdFALSE,
+    timeout
+  );
+  if (event & W5500_SN_EVENT_TIMEOUT || event & W5500_SN_EVENT_DISCON)
+  {
+    return W5500_SOCKET_DISCONNECTED;
+  }
+  if (!(event & W5500_SN_EVENT_SENDOK))
+  {
+    return W5500_SEND_TIMEOUT;
+  }
+
+  xEventGroupClearBits(dev->snEvent[sn], W5500_SN_EVENT_SENDOK);
+  dev->txAsync[sn].inFlight = 0;
+  return W5500_OK;
+}
+
+/*!
+* @brief  Hands data written behind a completed SEND to the W5500.
+* @param  dev - W5500 device structure
+* @param  sn - socket index
+* @return W5500 status
+*/
+static w5500_status_t W5500_SocketSendCommit(w5500_dev_t* dev, uint8_t sn)
+{
+  w5500_tx_async_t* tx = &dev->txAsync[sn];
+  uint16_t wr __attribute__((aligned(16))) = tx->wr;
+  w5500_status_t rc;
+
+  rc = W5500_SetSnTxWR(dev, sn, &wr);
+  W5500_RETURN_NOT_OK(rc);
+
+  xEventGroupClearBits(dev->snEvent[sn], W5500_SN_EVENT_SENDOK);
+  rc = W5500_SocketCommand(dev, sn, W5500_SN_CMD_SEND);
+  W5500_RETURN_NOT_OK(rc);
+
+  tx->inFlight = 1;
+  tx->pending  = 0;
+  return rc;
+}
+
+/*!
+* @brief  Sends multiple segments without waiting for SENDOK.
+*         Data is appended to the TX ring behind a SEND that is still in
+*         flight and sent with the next SEND, so back to back calls are
+*         coalesced into larger segments. When the ring is full this waits
+*         for the server to acknowledge data instead of failing.
+*         Do not mix with the blocking sends while a SEND is in flight.
+* @param  dev - W5500 device structure
+* @param  sn - socket index
+* @param  iov - segments to send
+* @param  iovcnt - number of segments
+* @param  timeout - time to wait for free space in ticks
+* @return W5500 status
+*/
+w5500_status_t W5500_SocketSendAsync(w5500_dev_t* dev, uint8_t sn, const w5500_iovec_t* iov, uint8_t iovcnt, TickType_t timeout)
+{
+  w5500_tx_async_t* tx = &dev->txAsync[sn];
+  TickType_t startTick = xTaskGetTickCount();
+  TickType_t elapsed;
+  TickType_t delay = 1;
+  w5500_status_t rc;
+  EventBits_t event;
+  uint32_t len = 0;
+  uint16_t fsr;
+  uint8_t i;
+
+  for (i = 0; i < iovcnt; i++)
+  {
+    len += iov[i].len;
+  }
+  if (len == 0)
+  {
+    return W5500_OK;
+  }
+
+  // message can never fit in the socket buffer
+  if (len > ((uint32_t)dev->txBufSize[sn] << 10))
+  {
+    return W5500_TX_OVERFLOW;
+  }
+
+  while (1)
+  {
+    event = xEventGroupGetBits(dev->snEvent[sn]);
+    if (event & W5500_SN_EVENT_TIMEOUT || event & W5500_SN_EVENT_DISCON)
+    {
+      return W5500_SOCKET_DISCONNECTED;
+    }
+
+    // collect a finished SEND and start the next one
+    rc = W5500_SocketSendReap(dev, sn, 0);
+    if (rc == W5500_SOCKET_DISCONNECTED)
+    {
+      return rc;
+    }
+    if (!tx->inFlight && tx->pending)
+    {
+      rc = W5500_SocketSendCommit(dev, sn);
+      W5500_RETURN_NOT_OK(rc);
+    }
+
+    // nothing outstanding, resynchronize with the write pointer
+    if (!tx->inFlight && !tx->pending)
+    {
+      rc = W5500_GetSnTxWR(dev, sn, &tx->wr);
+      W5500_RETURN_NOT_OK(rc);
+    }
+
+    // free size does not count data written behind the SEND in flight
+    rc = W5500_GetSnTxFSR(dev, sn, &fsr);
+    W5500_RETURN_NOT_OK(rc);
+    if (fsr >= tx->pending + len)
+    {
+      break;
+    }
+
+    elapsed = xTaskGetTickCount() - startTick;
+    if (elapsed >= timeout)
+    {
+      return W5500_SEND_TIMEOUT;
+    }
+
+    // free size grows as the server acknowledges data
+    if (tx->inFlight)
+    {
+      rc = W5500_SocketSendReap(dev, sn, timeout - elapsed);
+      if (rc == W5500_SOCKET_DISCONNECTED)
+      {
+        return rc;
+      }
+    }
+    else
+    {
+      W5500_PollBackoff(&delay);
+    }
+  }
+
+  // append to the ring, the W5500 wraps the address within the socket buffer
+  rc = W5500_SetSnTxBufv(dev, sn, tx->wr, iov, iovcnt);
+  W5500_RETURN_NOT_OK(rc);
+  tx->wr      += len;
+  tx->pending += len;
+
+  if (!tx->inFlight)
+  {
+    rc = W5500_SocketSendCommit(dev, sn);
+    W5500_RETURN_NOT_OK(rc);
+  }
+
+  return rc;
+}
+
+/*!
+* @brief  Sends data left behind by asynchronous sends, waiting for the SEND
+*         in flight to finish first. The final SEND is not waited on.
+* @param  dev - W5500 device structure
+* @param  sn - socket index
+* @param  timeout - time to wait for the SEND in flight in ticks
+* @return W5500 status
+*/
+w5500_status_t W5500_SocketSendFlush(w5500_dev_t* dev, uint8_t sn, TickType_t timeout)
+{
+  w5500_status_t rc = W5500_OK;
+
+  if (dev->txAsync[sn].pending)
+  {
+    rc = W5500_SocketSendReap(dev, sn, timeout);
+    W5500_RETURN_NOT_OK(rc);
+    rc = W5500_SocketSendCommit(dev, sn);
+    W5500_RETURN_NOT_OK(rc);
+  }
+
+  return rc;
+}
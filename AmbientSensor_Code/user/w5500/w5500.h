@@ -41,18 +41,46 @@ typedef union w5500_packet_header_t
   uint8_t buf[W5500_PACKET_HEADER_SIZE] __attribute__((aligned(16)));
 } w5500_packet_header_t;
 
+//! W5500 socket RX stream state
+typedef struct w5500_rx_stream_t
+{
+  uint16_t ptr;  //!< RX read pointer
+  uint16_t size; //!< received data that has not been consumed
+} w5500_rx_stream_t;
+
+//! TCP liveness profile, RTR and RCR are common to every socket
+typedef struct w5500_liveness_t
+{
+  uint16_t rtr;     //!< initial retransmission timeout in 100 us units
+  uint8_t  rcr;     //!< retransmissions before a timeout
+  uint8_t  kpalvtr; //!< idle keep alive period in 5 s units, zero disables
+} w5500_liveness_t;
+
 w5500_status_t W5500_Initialize(w5500_dev_t* dev);
+w5500_status_t W5500_SetSocketMemory(w5500_dev_t* dev);
 w5500_status_t W5500_LogPhyStatus(w5500_dev_t* dev);
+void W5500_LogStats(w5500_dev_t* dev);
+w5500_status_t W5500_SocketAlloc(w5500_dev_t* dev, const char* owner, uint8_t txKB, uint8_t rxKB, uint8_t* sn);
+w5500_status_t W5500_SocketFree(w5500_dev_t* dev, uint8_t* sn, TickType_t timeout);
 w5500_status_t W5500_SocketClose(w5500_dev_t* dev, uint8_t sn, TickType_t timeout);
 w5500_status_t W5500_SocketOpen(w5500_dev_t* dev, uint8_t sn, w5500_socket_proto_t protocol, uint16_t port, TickType_t timeout);
+w5500_status_t W5500_SocketOpenMulticast(w5500_dev_t* dev, uint8_t sn, uint8_t* group, uint16_t groupPort, uint16_t port, uint8_t ttl, TickType_t timeout);
 w5500_status_t W5500_SocketDestination(w5500_dev_t* dev, uint8_t sn, uint8_t* ip, uint16_t port);
 w5500_status_t W5500_SocketConnect(w5500_dev_t* dev, uint8_t sn, uint8_t* ip, uint16_t port, TickType_t timeout);
+w5500_status_t W5500_SetLiveness(w5500_dev_t* dev, uint8_t sn, const w5500_liveness_t* profile);
+uint32_t W5500_LivenessBound(const w5500_liveness_t* profile);
 w5500_status_t W5500_SocketCommand(w5500_dev_t* dev, uint8_t sn, uint8_t cmd);
 w5500_status_t W5500_SocketStatusWait(w5500_dev_t* dev, uint8_t sn, uint8_t status, TickType_t timeout);
+w5500_status_t W5500_SocketAvailable(w5500_dev_t* dev, uint8_t sn, w5500_rx_stream_t* rx, TickType_t timeout);
+w5500_status_t W5500_SocketPeek(w5500_dev_t* dev, uint8_t sn, const w5500_rx_stream_t* rx, uint16_t offset, uint8_t* data, uint16_t len);
+w5500_status_t W5500_SocketConsume(w5500_dev_t* dev, uint8_t sn, w5500_rx_stream_t* rx, uint16_t len);
 w5500_status_t W5500_SocketRecieveTCP(w5500_dev_t* dev, uint8_t sn, uint8_t* data, uint16_t len, TickType_t timeout);
 w5500_status_t W5500_SocketRecieveUDP(w5500_dev_t* dev, uint8_t sn, uint8_t* data, uint16_t len, TickType_t timeout, uint8_t* sourceIp, uint16_t* sourcePort);
 w5500_status_t W5500_SocketSend(w5500_dev_t* dev, uint8_t sn, uint8_t* data, uint16_t len, TickType_t timeout);
 w5500_status_t W5500_SocketWritePart(w5500_dev_t* dev, uint8_t sn, uint8_t* data, uint16_t len, uint32_t* fsr, uint32_t* ptr);
+w5500_status_t W5500_SocketWritev(w5500_dev_t* dev, uint8_t sn, const w5500_iovec_t* iov, uint8_t iovcnt, uint32_t* fsr, uint32_t* ptr);
 w5500_status_t W5500_SocketSendBuffer(w5500_dev_t* dev, uint8_t sn, uint16_t ptr, TickType_t timeout);
+w5500_status_t W5500_SocketSendAsync(w5500_dev_t* dev, uint8_t sn, const w5500_iovec_t* iov, uint8_t iovcnt, TickType_t timeout);
+w5500_status_t W5500_SocketSendFlush(w5500_dev_t* dev, uint8_t sn, TickType_t timeout);
 
 #endif // _W5500_H_
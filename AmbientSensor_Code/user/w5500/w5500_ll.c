@@ -21,14 +21,19 @@
 ******************************************************************************/
 
 #include "w5500/w5500_ll.h"
+#include "profiler/profiler.h"
 
 // extern definitions
 const uint8_t W5500_CHIP_VERSION = 4;
 
 // private constants
 #define               SPI_FRAME_BYTES       3  //!< length of the frame header for a SPI transfer
+#define               SPI_SHORT_MAX_BYTES   4  //!< longest data phase sent in the same SPI call as the header
 static const uint32_t RST_HOLD         =   10; //!< duration to hold a hardware reset for in ms
 static const uint32_t SPI_TIMEOUT      =   50; //!< SPI transfer timeout in ms
+#if W5500_USE_DMA
+static const uint16_t DMA_THRESHOLD    =   16; //!< minimum data length in bytes to transfer with DMA
+#endif
 static const uint8_t  COMMON_BLOCK     = 0x00; //!< common block select bits
 static const uint8_t  SOCKET_BLOCK     = 0x01; //!< socket block base address
 static const uint8_t  SOCKET_TX_BUF    = 0x02; //!< socket TX buffer base address
@@ -82,8 +87,73 @@ static const uint8_t REG_SN_IMR        = 0x2C; //!< [1] [RW] interrupt mask
 static const uint8_t REG_SN_FRAG       = 0x2D; //!< [2] [RW] fragment offset in IP header
 static const uint8_t REG_SN_KPALVTR    = 0x2F; //!< [1] [RW] keep alive timer
 
+#if W5500_USE_SHADOW
+// shadow valid flags for common registers
+static const uint8_t SHADOW_SHAR       = (1U << 0); //!< SHAR is valid
+static const uint8_t SHADOW_SIPR       = (1U << 1); //!< SIPR is valid
+static const uint8_t SHADOW_GAR        = (1U << 2); //!< GAR is valid
+static const uint8_t SHADOW_SUBR       = (1U << 3); //!< SUBR is valid
+
+// shadow valid flags for socket registers
+static const uint8_t SHADOW_SN_MR      = (1U << 0); //!< Sn_MR is valid
+static const uint8_t SHADOW_SN_IMR     = (1U << 1); //!< Sn_IMR is valid
+static const uint8_t SHADOW_SN_PORT    = (1U << 2); //!< Sn_PORT is valid
+static const uint8_t SHADOW_SN_DPORT   = (1U << 3); //!< Sn_DPORT is valid
+static const uint8_t SHADOW_SN_DIPR    = (1U << 4); //!< Sn_DIPR is valid
+
+//! returns from a register setter if the shadow already holds the value
+#define SHADOW_WRITE_SKIP(dev, valid, flag, cache, data, len)                 \
+  do                                                                          \
+  {                                                                           \
+    if (((valid) & (flag))                                                    \
+      && W5500_ShadowEqual((uint8_t*)(cache), (uint8_t*)(data), (len)))       \
+    {                                                                         \
+      (dev)->shadow.writesSkipped++;                                          \
+      return W5500_OK;                                                        \
+    }                                                                         \
+  } while (0)
+
+//! returns from a register getter with the shadow value if it is valid
+#define SHADOW_READ_HIT(dev, valid, flag, cache, data, len)                   \
+  do                                                                          \
+  {                                                                           \
+    if ((valid) & (flag))                                                     \
+    {                                                                         \
+      W5500_ShadowCopy((uint8_t*)(data), (uint8_t*)(cache), (len));           \
+      (dev)->shadow.readsCached++;                                            \
+      return W5500_OK;                                                        \
+    }                                                                         \
+  } while (0)
+
+//! updates the shadow after a successful register access
+#define SHADOW_STORE(rc, valid, flag, cache, data, len)                       \
+  do                                                                          \
+  {                                                                           \
+    if ((rc) == W5500_OK)                                                     \
+    {                                                                         \
+      W5500_ShadowCopy((uint8_t*)(cache), (uint8_t*)(data), (len));           \
+      (valid) |= (flag);                                                      \
+    }                                                                         \
+  } while (0)
+#else
+#define SHADOW_WRITE_SKIP(dev, valid, flag, cache, data, len) ((void) 0U)
+#define SHADOW_READ_HIT(dev, valid, flag, cache, data, len)   ((void) 0U)
+#define SHADOW_STORE(rc, valid, flag, cache, data, len)       ((void) 0U)
+#endif
+
 // private function prototypes
 static inline w5500_status_t W5500_Transfer(w5500_dev_t* dev, uint8_t* data, uint16_t len, uint16_t addr, uint8_t bsb, uint8_t access);
+static w5500_status_t W5500_TransferV(w5500_dev_t* dev, const w5500_iovec_t* iov, uint8_t iovcnt, uint16_t addr, uint8_t bsb);
+static HAL_StatusTypeDef W5500_TransferData(w5500_dev_t* dev, uint8_t* data, uint16_t len, uint8_t access);
+#if W5500_USE_DMA
+static HAL_StatusTypeDef W5500_TransferDMA(w5500_dev_t* dev, uint8_t* data, uint16_t len, uint8_t access);
+#endif
+static HAL_StatusTypeDef W5500_TransferShort(w5500_dev_t* dev, const uint8_t* header, uint8_t* data, uint16_t len, uint8_t access);
+static inline uint16_t W5500_Unpack16(const uint8_t* buf);
+#if W5500_USE_SHADOW
+static inline uint8_t W5500_ShadowEqual(const uint8_t* shadow, const uint8_t* data, uint8_t len);
+static inline void W5500_ShadowCopy(uint8_t* dst, const uint8_t* src, uint8_t len);
+#endif
 
 //! W5500 SPI access modes
 typedef enum 
@@ -102,6 +172,39 @@ void W5500_HardReset(w5500_dev_t* dev)
   vTaskDelay((configTICK_RATE_HZ * RST_HOLD) / 1000);
   HAL_GPIO_WritePin(dev->rstPort, dev->rstPin, GPIO_PIN_SET);
   vTaskDelay((configTICK_RATE_HZ * RST_HOLD) / 1000);
+#if W5500_USE_SHADOW
+  W5500_ShadowInvalidate(dev);
+#endif
+}
+
+#if W5500_USE_SHADOW
+/*!
+* @brief  Invalidates the register shadow, call after the W5500 has been reset.
+* @param  dev - W5500 device structure
+*/
+void W5500_ShadowInvalidate(w5500_dev_t* dev)
+{
+  uint8_t sn;
+  dev->shadow.valid = 0;
+  for (sn = 0; sn < W5500_NUM_SOCKETS; sn++)
+  {
+    dev->shadow.sn[sn].valid = 0;
+  }
+}
+#endif
+
+/*!
+* @brief  Wakes the task waiting on a DMA transfer, call from the SPI
+*         complete and error callbacks.
+* @param  dev                      - W5500 device structure
+* @param  xHigherPriorityTaskWoken - set to pdTRUE if a context switch is required
+*/
+void W5500_TransferCompleteFromISR(w5500_dev_t* dev, BaseType_t* xHigherPriorityTaskWoken)
+{
+  if (dev->xferTask != NULL)
+  {
+    xTaskNotifyFromISR(dev->xferTask, W5500_NOTIFY_XFER, eSetBits, xHigherPriorityTaskWoken);
+  }
 }
 
 /*!
@@ -153,6 +256,20 @@ const char* W5500_StatusString(w5500_status_t status)
       return "MQTT_BAD_PACKET";
     case W5500_MQTT_CON_REFUSED:
       return "MQTT_CON_REFUSED";
+    case W5500_BAD_MEMORY_CFG:
+      return "BAD_MEMORY_CFG";
+    case W5500_CMD_TIMEOUT:
+      return "CMD_TIMEOUT";
+    case W5500_NO_SOCKET:
+      return "NO_SOCKET";
+    case W5500_NO_LINK:
+      return "NO_LINK";
+    case W5500_MQTT_PING_TIMEOUT:
+      return "MQTT_PING_TIMEOUT";
+    case W5500_MQTT_ACK_TIMEOUT:
+      return "MQTT_ACK_TIMEOUT";
+    case W5500_MQTT_SUB_REFUSED:
+      return "MQTT_SUB_REFUSED";
     default:
       return "UNKNOWN";
   }
@@ -168,39 +285,71 @@ w5500_status_t W5500_GetMR(w5500_dev_t* dev, w5500_mr_t* mr)
 }
 w5500_status_t W5500_SetMR(w5500_dev_t* dev, w5500_mr_t* mr)
 {
-  return W5500_Transfer(dev, &mr->all, 1, REG_MR, COMMON_BLOCK, W5500_SPI_WR);
+  w5500_status_t rc = W5500_Transfer(dev, &mr->all, 1, REG_MR, COMMON_BLOCK, W5500_SPI_WR);
+#if W5500_USE_SHADOW
+  // software reset returns all registers to their defaults
+  if (mr->bits.rst)
+  {
+    W5500_ShadowInvalidate(dev);
+  }
+#endif
+  return rc;
 }
 w5500_status_t W5500_GetGAR(w5500_dev_t* dev, uint8_t* ip)
 {
-  return W5500_Transfer(dev, ip, IPV4_BYTES, REG_GAR, COMMON_BLOCK, W5500_SPI_RD);
+  SHADOW_READ_HIT(dev, dev->shadow.valid, SHADOW_GAR, dev->shadow.gar, ip, IPV4_BYTES);
+  w5500_status_t rc = W5500_Transfer(dev, ip, IPV4_BYTES, REG_GAR, COMMON_BLOCK, W5500_SPI_RD);
+  SHADOW_STORE(rc, dev->shadow.valid, SHADOW_GAR, dev->shadow.gar, ip, IPV4_BYTES);
+  return rc;
 }
 w5500_status_t W5500_SetGAR(w5500_dev_t* dev, uint8_t* ip)
 {
-  return W5500_Transfer(dev, ip, IPV4_BYTES, REG_GAR, COMMON_BLOCK, W5500_SPI_WR);
+  SHADOW_WRITE_SKIP(dev, dev->shadow.valid, SHADOW_GAR, dev->shadow.gar, ip, IPV4_BYTES);
+  w5500_status_t rc = W5500_Transfer(dev, ip, IPV4_BYTES, REG_GAR, COMMON_BLOCK, W5500_SPI_WR);
+  SHADOW_STORE(rc, dev->shadow.valid, SHADOW_GAR, dev->shadow.gar, ip, IPV4_BYTES);
+  return rc;
 }
 w5500_status_t W5500_GetSUBR(w5500_dev_t* dev, uint8_t* ip)
 {
-  return W5500_Transfer(dev, ip, IPV4_BYTES, REG_SUBR, COMMON_BLOCK, W5500_SPI_RD);
+  SHADOW_READ_HIT(dev, dev->shadow.valid, SHADOW_SUBR, dev->shadow.subr, ip, IPV4_BYTES);
+  w5500_status_t rc = W5500_Transfer(dev, ip, IPV4_BYTES, REG_SUBR, COMMON_BLOCK, W5500_SPI_RD);
+  SHADOW_STORE(rc, dev->shadow.valid, SHADOW_SUBR, dev->shadow.subr, ip, IPV4_BYTES);
+  return rc;
 }
 w5500_status_t W5500_SetSUBR(w5500_dev_t* dev, uint8_t* ip)
 {
-  return W5500_Transfer(dev, ip, IPV4_BYTES, REG_SUBR, COMMON_BLOCK, W5500_SPI_WR);
+  SHADOW_WRITE_SKIP(dev, dev->shadow.valid, SHADOW_SUBR, dev->shadow.subr, ip, IPV4_BYTES);
+  w5500_status_t rc = W5500_Transfer(dev, ip, IPV4_BYTES, REG_SUBR, COMMON_BLOCK, W5500_SPI_WR);
+  SHADOW_STORE(rc, dev->shadow.valid, SHADOW_SUBR, dev->shadow.subr, ip, IPV4_BYTES);
+  return rc;
 }
 w5500_status_t W5500_GetSHAR(w5500_dev_t* dev, uint8_t* mac)
 {
-  return W5500_Transfer(dev, mac, MAC_BYTES, REG_SHAR, COMMON_BLOCK, W5500_SPI_RD);
+  SHADOW_READ_HIT(dev, dev->shadow.valid, SHADOW_SHAR, dev->shadow.shar, mac, MAC_BYTES);
+  w5500_status_t rc = W5500_Transfer(dev, mac, MAC_BYTES, REG_SHAR, COMMON_BLOCK, W5500_SPI_RD);
+  SHADOW_STORE(rc, dev->shadow.valid, SHADOW_SHAR, dev->shadow.shar, mac, MAC_BYTES);
+  return rc;
 }
 w5500_status_t W5500_SetSHAR(w5500_dev_t* dev, uint8_t* mac)
 {
-  return W5500_Transfer(dev, mac, MAC_BYTES, REG_SHAR, COMMON_BLOCK, W5500_SPI_WR);
+  SHADOW_WRITE_SKIP(dev, dev->shadow.valid, SHADOW_SHAR, dev->shadow.shar, mac, MAC_BYTES);
+  w5500_status_t rc = W5500_Transfer(dev, mac, MAC_BYTES, REG_SHAR, COMMON_BLOCK, W5500_SPI_WR);
+  SHADOW_STORE(rc, dev->shadow.valid, SHADOW_SHAR, dev->shadow.shar, mac, MAC_BYTES);
+  return rc;
 }
 w5500_status_t W5500_GetSIPR(w5500_dev_t* dev, uint8_t* ip)
 {
-  return W5500_Transfer(dev, ip, IPV4_BYTES, REG_SIPR, COMMON_BLOCK, W5500_SPI_RD);
+  SHADOW_READ_HIT(dev, dev->shadow.valid, SHADOW_SIPR, dev->shadow.sipr, ip, IPV4_BYTES);
+  w5500_status_t rc = W5500_Transfer(dev, ip, IPV4_BYTES, REG_SIPR, COMMON_BLOCK, W5500_SPI_RD);
+  SHADOW_STORE(rc, dev->shadow.valid, SHADOW_SIPR, dev->shadow.sipr, ip, IPV4_BYTES);
+  return rc;
 }
 w5500_status_t W5500_SetSIPR(w5500_dev_t* dev, uint8_t* ip)
 {
-  return W5500_Transfer(dev, ip, IPV4_BYTES, REG_SIPR, COMMON_BLOCK, W5500_SPI_WR);
+  SHADOW_WRITE_SKIP(dev, dev->shadow.valid, SHADOW_SIPR, dev->shadow.sipr, ip, IPV4_BYTES);
+  w5500_status_t rc = W5500_Transfer(dev, ip, IPV4_BYTES, REG_SIPR, COMMON_BLOCK, W5500_SPI_WR);
+  SHADOW_STORE(rc, dev->shadow.valid, SHADOW_SIPR, dev->shadow.sipr, ip, IPV4_BYTES);
+  return rc;
 }
 w5500_status_t W5500_GetINTLEVEL(w5500_dev_t* dev, uint16_t* intlevel)
 {
@@ -248,6 +397,17 @@ w5500_status_t W5500_SetSIMR(w5500_dev_t* dev, uint8_t* simr)
 {
   return W5500_Transfer(dev, simr, 1, REG_SIMR, COMMON_BLOCK, W5500_SPI_WR);
 }
+w5500_status_t W5500_GetIntStatus(w5500_dev_t* dev, w5500_int_status_t* status)
+{
+  // IR, IMR, SIR and SIMR are contiguous
+  uint8_t buf[4] __attribute__((aligned(16)));
+  w5500_status_t rc = W5500_Transfer(dev, buf, 4, REG_IR, COMMON_BLOCK, W5500_SPI_RD);
+  status->ir.all  = buf[REG_IR   - REG_IR];
+  status->imr.all = buf[REG_IMR  - REG_IR];
+  status->sir     = buf[REG_SIR  - REG_IR];
+  status->simr    = buf[REG_SIMR - REG_IR];
+  return rc;
+}
 w5500_status_t W5500_GetRTR(w5500_dev_t* dev, uint16_t* rtr)
 {
   uint8_t buf[2] __attribute__((aligned(16)));
@@ -349,12 +509,18 @@ w5500_status_t W5500_GetVERSIONR(w5500_dev_t* dev, uint8_t* ver)
 w5500_status_t W5500_GetSnMR(w5500_dev_t* dev, uint8_t sn, w5500_sn_mr_t* mr)
 {
   ASSERT(sn < W5500_NUM_SOCKETS);
-  return W5500_Transfer(dev, &mr->all, 1, REG_SN_MR, SOCKET_BLOCK + sn * SOCKET_SPACING, W5500_SPI_RD);
+  SHADOW_READ_HIT(dev, dev->shadow.sn[sn].valid, SHADOW_SN_MR, &dev->shadow.sn[sn].mr.all, &mr->all, 1);
+  w5500_status_t rc = W5500_Transfer(dev, &mr->all, 1, REG_SN_MR, SOCKET_BLOCK + sn * SOCKET_SPACING, W5500_SPI_RD);
+  SHADOW_STORE(rc, dev->shadow.sn[sn].valid, SHADOW_SN_MR, &dev->shadow.sn[sn].mr.all, &mr->all, 1);
+  return rc;
 }
 w5500_status_t W5500_SetSnMR(w5500_dev_t* dev, uint8_t sn, w5500_sn_mr_t* mr)
 {
   ASSERT(sn < W5500_NUM_SOCKETS);
-  return W5500_Transfer(dev, &mr->all, 1, REG_SN_MR, SOCKET_BLOCK + sn * SOCKET_SPACING, W5500_SPI_WR);
+  SHADOW_WRITE_SKIP(dev, dev->shadow.sn[sn].valid, SHADOW_SN_MR, &dev->shadow.sn[sn].mr.all, &mr->all, 1);
+  w5500_status_t rc = W5500_Transfer(dev, &mr->all, 1, REG_SN_MR, SOCKET_BLOCK + sn * SOCKET_SPACING, W5500_SPI_WR);
+  SHADOW_STORE(rc, dev->shadow.sn[sn].valid, SHADOW_SN_MR, &dev->shadow.sn[sn].mr.all, &mr->all, 1);
+  return rc;
 }
 w5500_status_t W5500_GetSnCR(w5500_dev_t* dev, uint8_t sn, uint8_t* cr)
 {
@@ -364,6 +530,13 @@ w5500_status_t W5500_GetSnCR(w5500_dev_t* dev, uint8_t sn, uint8_t* cr)
 w5500_status_t W5500_SetSnCR(w5500_dev_t* dev, uint8_t sn, uint8_t* cr)
 {
   ASSERT(sn < W5500_NUM_SOCKETS);
+#if W5500_USE_SHADOW
+  // the W5500 fills in the destination when a peer connects to a listening socket
+  if (*cr == W5500_SN_CMD_LISTEN)
+  {
+    dev->shadow.sn[sn].valid &= ~(SHADOW_SN_DIPR | SHADOW_SN_DPORT);
+  }
+#endif
   return W5500_Transfer(dev, cr, 1, REG_SN_CR, SOCKET_BLOCK + sn * SOCKET_SPACING, W5500_SPI_WR);
 }
 w5500_status_t W5500_GetSnIR(w5500_dev_t* dev, uint8_t sn, w5500_sn_ir_t* ir)
@@ -384,18 +557,23 @@ w5500_status_t W5500_GetSnSR(w5500_dev_t* dev, uint8_t sn, uint8_t* sr)
 w5500_status_t W5500_GetSnPORT(w5500_dev_t* dev, uint8_t sn, uint16_t* port)
 {
   ASSERT(sn < W5500_NUM_SOCKETS);
+  SHADOW_READ_HIT(dev, dev->shadow.sn[sn].valid, SHADOW_SN_PORT, &dev->shadow.sn[sn].port, port, PORT_BYTES);
   uint8_t buf[PORT_BYTES] __attribute__((aligned(16)));
   w5500_status_t rc = W5500_Transfer(dev, buf, PORT_BYTES, REG_SN_PORT, SOCKET_BLOCK + sn * SOCKET_SPACING, W5500_SPI_RD);
   *port = (buf[0] << 8) | buf[1];  
+  SHADOW_STORE(rc, dev->shadow.sn[sn].valid, SHADOW_SN_PORT, &dev->shadow.sn[sn].port, port, PORT_BYTES);
   return rc;
 }
 w5500_status_t W5500_SetSnPORT(w5500_dev_t* dev, uint8_t sn, uint16_t* port)
 {
   ASSERT(sn < W5500_NUM_SOCKETS);
+  SHADOW_WRITE_SKIP(dev, dev->shadow.sn[sn].valid, SHADOW_SN_PORT, &dev->shadow.sn[sn].port, port, PORT_BYTES);
   uint8_t buf[PORT_BYTES] __attribute__((aligned(16)));
   buf[0] = (*port & 0xFF00) >> 8;
   buf[1] = (*port & 0x00FF) >> 0;
-  return W5500_Transfer(dev, buf, PORT_BYTES, REG_SN_PORT, SOCKET_BLOCK + sn * SOCKET_SPACING, W5500_SPI_WR);
+  w5500_status_t rc = W5500_Transfer(dev, buf, PORT_BYTES, REG_SN_PORT, SOCKET_BLOCK + sn * SOCKET_SPACING, W5500_SPI_WR);
+  SHADOW_STORE(rc, dev->shadow.sn[sn].valid, SHADOW_SN_PORT, &dev->shadow.sn[sn].port, port, PORT_BYTES);
+  return rc;
 }
 w5500_status_t W5500_GetSnDHAR(w5500_dev_t* dev, uint8_t sn, uint8_t* mac)
 {
@@ -410,28 +588,39 @@ w5500_status_t W5500_SetSnDHAR(w5500_dev_t* dev, uint8_t sn, uint8_t* mac)
 w5500_status_t W5500_GetSnDIPR(w5500_dev_t* dev, uint8_t sn, uint8_t* ip)
 {
   ASSERT(sn < W5500_NUM_SOCKETS);
-  return W5500_Transfer(dev, ip, IPV4_BYTES, REG_SN_DIPR, SOCKET_BLOCK + sn * SOCKET_SPACING, W5500_SPI_RD);
+  SHADOW_READ_HIT(dev, dev->shadow.sn[sn].valid, SHADOW_SN_DIPR, dev->shadow.sn[sn].dipr, ip, IPV4_BYTES);
+  w5500_status_t rc = W5500_Transfer(dev, ip, IPV4_BYTES, REG_SN_DIPR, SOCKET_BLOCK + sn * SOCKET_SPACING, W5500_SPI_RD);
+  SHADOW_STORE(rc, dev->shadow.sn[sn].valid, SHADOW_SN_DIPR, dev->shadow.sn[sn].dipr, ip, IPV4_BYTES);
+  return rc;
 }
 w5500_status_t W5500_SetSnDIPR(w5500_dev_t* dev, uint8_t sn, uint8_t* ip)
 {
   ASSERT(sn < W5500_NUM_SOCKETS);
-  return W5500_Transfer(dev, ip, IPV4_BYTES, REG_SN_DIPR, SOCKET_BLOCK + sn * SOCKET_SPACING, W5500_SPI_WR);
+  SHADOW_WRITE_SKIP(dev, dev->shadow.sn[sn].valid, SHADOW_SN_DIPR, dev->shadow.sn[sn].dipr, ip, IPV4_BYTES);
+  w5500_status_t rc = W5500_Transfer(dev, ip, IPV4_BYTES, REG_SN_DIPR, SOCKET_BLOCK + sn * SOCKET_SPACING, W5500_SPI_WR);
+  SHADOW_STORE(rc, dev->shadow.sn[sn].valid, SHADOW_SN_DIPR, dev->shadow.sn[sn].dipr, ip, IPV4_BYTES);
+  return rc;
 }
 w5500_status_t W5500_GetSnDPORT(w5500_dev_t* dev, uint8_t sn, uint16_t* port)
 {
   ASSERT(sn < W5500_NUM_SOCKETS);
+  SHADOW_READ_HIT(dev, dev->shadow.sn[sn].valid, SHADOW_SN_DPORT, &dev->shadow.sn[sn].dport, port, PORT_BYTES);
   uint8_t buf[PORT_BYTES] __attribute__((aligned(16)));
   w5500_status_t rc = W5500_Transfer(dev, buf, PORT_BYTES, REG_SN_DPORT, SOCKET_BLOCK + sn * SOCKET_SPACING, W5500_SPI_RD);
   *port = (buf[0] << 8) | buf[1];  
+  SHADOW_STORE(rc, dev->shadow.sn[sn].valid, SHADOW_SN_DPORT, &dev->shadow.sn[sn].dport, port, PORT_BYTES);
   return rc;
 }
 w5500_status_t W5500_SetSnDPORT(w5500_dev_t* dev, uint8_t sn, uint16_t* port)
 {
   ASSERT(sn < W5500_NUM_SOCKETS);
+  SHADOW_WRITE_SKIP(dev, dev->shadow.sn[sn].valid, SHADOW_SN_DPORT, &dev->shadow.sn[sn].dport, port, PORT_BYTES);
   uint8_t buf[PORT_BYTES] __attribute__((aligned(16)));
   buf[0] = (*port & 0xFF00) >> 8;
   buf[1] = (*port & 0x00FF) >> 0;
-  return W5500_Transfer(dev, buf, PORT_BYTES, REG_SN_DPORT, SOCKET_BLOCK + sn * SOCKET_SPACING, W5500_SPI_WR);
+  w5500_status_t rc = W5500_Transfer(dev, buf, PORT_BYTES, REG_SN_DPORT, SOCKET_BLOCK + sn * SOCKET_SPACING, W5500_SPI_WR);
+  SHADOW_STORE(rc, dev->shadow.sn[sn].valid, SHADOW_SN_DPORT, &dev->shadow.sn[sn].dport, port, PORT_BYTES);
+  return rc;
 }
 w5500_status_t W5500_GetSnMSSR(w5500_dev_t* dev, uint8_t sn, uint16_t* mssr)
 {
@@ -556,12 +745,18 @@ w5500_status_t W5500_GetSnRxWR(w5500_dev_t* dev, uint8_t sn, uint16_t* ptr)
 w5500_status_t W5500_GetSnIMR(w5500_dev_t* dev, uint8_t sn, w5500_sn_ir_t* ir)
 {
   ASSERT(sn < W5500_NUM_SOCKETS);
-  return W5500_Transfer(dev, &ir->all, 1, REG_SN_IMR, SOCKET_BLOCK + sn * SOCKET_SPACING, W5500_SPI_RD);
+  SHADOW_READ_HIT(dev, dev->shadow.sn[sn].valid, SHADOW_SN_IMR, &dev->shadow.sn[sn].imr.all, &ir->all, 1);
+  w5500_status_t rc = W5500_Transfer(dev, &ir->all, 1, REG_SN_IMR, SOCKET_BLOCK + sn * SOCKET_SPACING, W5500_SPI_RD);
+  SHADOW_STORE(rc, dev->shadow.sn[sn].valid, SHADOW_SN_IMR, &dev->shadow.sn[sn].imr.all, &ir->all, 1);
+  return rc;
 }
 w5500_status_t W5500_SetSnIMR(w5500_dev_t* dev, uint8_t sn, w5500_sn_ir_t* ir)
 {
   ASSERT(sn < W5500_NUM_SOCKETS);
-  return W5500_Transfer(dev, &ir->all, 1, REG_SN_IMR, SOCKET_BLOCK + sn * SOCKET_SPACING, W5500_SPI_WR);
+  SHADOW_WRITE_SKIP(dev, dev->shadow.sn[sn].valid, SHADOW_SN_IMR, &dev->shadow.sn[sn].imr.all, &ir->all, 1);
+  w5500_status_t rc = W5500_Transfer(dev, &ir->all, 1, REG_SN_IMR, SOCKET_BLOCK + sn * SOCKET_SPACING, W5500_SPI_WR);
+  SHADOW_STORE(rc, dev->shadow.sn[sn].valid, SHADOW_SN_IMR, &dev->shadow.sn[sn].imr.all, &ir->all, 1);
+  return rc;
 }
 w5500_status_t W5500_GetSnFRAG(w5500_dev_t* dev, uint8_t sn, uint16_t* frag)
 {
@@ -590,6 +785,53 @@ w5500_status_t W5500_SetSnKPALVTR(w5500_dev_t* dev, uint8_t sn, uint8_t* kpalvtr
   return W5500_Transfer(dev, kpalvtr, 1, REG_SN_KPALVTR, SOCKET_BLOCK + sn * SOCKET_SPACING, W5500_SPI_WR);
 }
 
+/*!
+* @brief  Reads the entire socket register block in a single SPI frame.
+* @param  dev  - W5500 device structure
+* @param  sn   - socket index
+* @param  snap - decoded socket registers
+* @return W5500 status
+*/
+w5500_status_t W5500_GetSnSnapshot(w5500_dev_t* dev, uint8_t sn, w5500_sn_snapshot_t* snap)
+{
+  ASSERT(sn < W5500_NUM_SOCKETS);
+  uint8_t buf[W5500_SN_SNAPSHOT_BYTES] __attribute__((aligned(16)));
+  uint8_t i;
+  w5500_status_t rc = W5500_Transfer(dev, buf, W5500_SN_SNAPSHOT_BYTES, REG_SN_MR, SOCKET_BLOCK + sn * SOCKET_SPACING, W5500_SPI_RD);
+  W5500_RETURN_NOT_OK(rc);
+
+  snap->mr.all     = buf[REG_SN_MR];
+  snap->cr         = buf[REG_SN_CR];
+  snap->ir.all     = buf[REG_SN_IR];
+  snap->sr         = buf[REG_SN_SR];
+  snap->port       = W5500_Unpack16(&buf[REG_SN_PORT]);
+  for (i = 0; i < MAC_BYTES; i++)
+  {
+    snap->dhar[i] = buf[REG_SN_DHAR + i];
+  }
+  for (i = 0; i < IPV4_BYTES; i++)
+  {
+    snap->dipr[i] = buf[REG_SN_DIPR + i];
+  }
+  snap->dport      = W5500_Unpack16(&buf[REG_SN_DPORT]);
+  snap->mssr       = W5500_Unpack16(&buf[REG_SN_MSSR]);
+  snap->tos        = buf[REG_SN_TOS];
+  snap->ttl        = buf[REG_SN_TTL];
+  snap->rxBufSize  = buf[REG_SN_RXBUF_SIZE];
+  snap->txBufSize  = buf[REG_SN_TXBUF_SIZE];
+  snap->txFsr      = W5500_Unpack16(&buf[REG_SN_TX_FSR]);
+  snap->txRd       = W5500_Unpack16(&buf[REG_SN_TX_RD]);
+  snap->txWr       = W5500_Unpack16(&buf[REG_SN_TX_WR]);
+  snap->rxRsr      = W5500_Unpack16(&buf[REG_SN_RX_RSR]);
+  snap->rxRd       = W5500_Unpack16(&buf[REG_SN_RX_RD]);
+  snap->rxWr       = W5500_Unpack16(&buf[REG_SN_RX_WR]);
+  snap->imr.all    = buf[REG_SN_IMR];
+  snap->frag       = W5500_Unpack16(&buf[REG_SN_FRAG]);
+  snap->kpalvtr    = buf[REG_SN_KPALVTR];
+
+  return rc;
+}
+
 /******************************************************************************
 * SOCKET BUFFER PUBLIC FUNCTIONS
 ******************************************************************************/
@@ -599,6 +841,11 @@ w5500_status_t W5500_SetSnTxBuf(w5500_dev_t* dev, uint8_t sn, uint16_t ptr, uint
   ASSERT(sn < W5500_NUM_SOCKETS);
   return W5500_Transfer(dev, data, len, ptr, SOCKET_TX_BUF + sn * SOCKET_SPACING, W5500_SPI_WR);
 }
+w5500_status_t W5500_SetSnTxBufv(w5500_dev_t* dev, uint8_t sn, uint16_t ptr, const w5500_iovec_t* iov, uint8_t iovcnt)
+{
+  ASSERT(sn < W5500_NUM_SOCKETS);
+  return W5500_TransferV(dev, iov, iovcnt, ptr, SOCKET_TX_BUF + sn * SOCKET_SPACING);
+}
 w5500_status_t W5500_SetSnRxBuf(w5500_dev_t* dev, uint8_t sn, uint16_t ptr, uint8_t* data, uint16_t len)
 {
   ASSERT(sn < W5500_NUM_SOCKETS);
@@ -644,6 +891,81 @@ typedef enum
   W5500_SPI_FDM_4 = 3, //!< 4-byte fixed data length mode
 } w5500_spi_op_mode_t;
 
+/*!
+* @brief  Converts a big endian 16-bit register value from a buffer.
+* @param  buf - register bytes
+* @return register value
+*/
+static inline uint16_t W5500_Unpack16(const uint8_t* buf)
+{
+  return (buf[0] << 8) | buf[1];
+}
+
+#if W5500_USE_SHADOW
+/*!
+* @brief  Compares a shadow register with new data.
+* @param  shadow - shadow register
+* @param  data   - register data
+* @param  len    - register length
+* @return 1 if equal, 0 otherwise
+*/
+static inline uint8_t W5500_ShadowEqual(const uint8_t* shadow, const uint8_t* data, uint8_t len)
+{
+  uint8_t i;
+  for (i = 0; i < len; i++)
+  {
+    if (shadow[i] != data[i])
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*!
+* @brief  Copies register data to or from the shadow.
+* @param  dst - destination
+* @param  src - source
+* @param  len - register length
+*/
+static inline void W5500_ShadowCopy(uint8_t* dst, const uint8_t* src, uint8_t len)
+{
+  uint8_t i;
+  for (i = 0; i < len; i++)
+  {
+    dst[i] = src[i];
+  }
+}
+#endif
+
+/*!
+* @brief  Takes the SPI bus for a frame. Without DMA the frame runs in a
+*         timed critical section like the original polled driver, so the
+*         interrupt-masked time of both builds can be compared.
+* @param  dev - W5500 device structure
+*/
+static inline void W5500_BusLock(w5500_dev_t* dev)
+{
+#if W5500_USE_DMA
+  xSemaphoreTake(dev->busMutex, portMAX_DELAY);
+#else
+  PROFILER_ENTER_CRITICAL();
+#endif
+}
+
+/*!
+* @brief  Releases the SPI bus taken with W5500_BusLock.
+* @param  dev - W5500 device structure
+*/
+static inline void W5500_BusUnlock(w5500_dev_t* dev)
+{
+#if W5500_USE_DMA
+  xSemaphoreGive(dev->busMutex);
+#else
+  PROFILER_EXIT_CRITICAL();
+#endif
+}
+
 /*!
 * @brief  Transfers data to and from the W5500
 * @param  dev    - W5500 device structure
@@ -674,29 +996,260 @@ inline w5500_status_t W5500_Transfer(
   // check for correct alignment
   ASSERT(IS_SPI_16BIT_ALIGNED_ADDRESS(data));
 
-  taskENTER_CRITICAL();
+  // the bus mutex replaces the critical section, other tasks and interrupts
+  // continue to run while the transfer is in progress
+  W5500_BusLock(dev);
+  PROFILER_START(start);
   HAL_GPIO_WritePin(dev->csPort, dev->csPin, GPIO_PIN_RESET);
 
+  // short register accesses send the header and data in a single call
+  if (len <= SPI_SHORT_MAX_BYTES)
+  {
+    rc = W5500_TransferShort(dev, header.buf, data, len, access);
+    goto cleanup; // forgive me
+  }
+
   // send header
-  rc = HAL_SPI_Transmit(&dev->hspix, header.buf, SPI_FRAME_BYTES, SPI_TIMEOUT);
+  rc = HAL_SPI_Transmit(dev->hspix, header.buf, SPI_FRAME_BYTES, SPI_TIMEOUT);
   if (rc != HAL_OK)
   {
     goto cleanup; // forgive me
   }
 
   // do the data transfer
-  if (access == W5500_SPI_RD)
+  rc = W5500_TransferData(dev, data, len, access);
+
+cleanup:
+  HAL_GPIO_WritePin(dev->csPort, dev->csPin, GPIO_PIN_SET);
+  PROFILER_STOP(access ? PROFILER_W5500_WRITE : PROFILER_W5500_READ, start, len);
+  W5500_BusUnlock(dev);
+
+  return (w5500_status_t)rc;
+}
+
+/*!
+* @brief  Writes multiple segments to the W5500 in a single SPI frame.
+* @param  dev    - W5500 device structure
+* @param  iov    - segments to write
+* @param  iovcnt - number of segments
+* @param  addr   - 16-bit offset address for the transfer
+* @param  bsb    - block selection bits
+* @return HAL status
+*/
+static w5500_status_t W5500_TransferV(
+  w5500_dev_t*         dev,
+  const w5500_iovec_t* iov,
+  uint8_t              iovcnt,
+  uint16_t             addr,
+  uint8_t              bsb
+)
+{
+  HAL_StatusTypeDef rc;
+  uint16_t len = 0;
+  uint8_t i;
+  w5500_spi_header_t header __attribute__((aligned(16))) = {
+    .field.addr     = BYTE_SWAP_16(addr),
+    .field.ctrl.om  = W5500_SPI_VDM,
+    .field.ctrl.rw  = W5500_SPI_WR,
+    .field.ctrl.bsb = bsb,
+  };
+
+  // check for correct alignment
+  for (i = 0; i < iovcnt; i++)
   {
-    rc = HAL_SPI_Receive(&dev->hspix, data, len, SPI_TIMEOUT);
+    ASSERT(IS_SPI_16BIT_ALIGNED_ADDRESS(iov[i].data));
+    len += iov[i].len;
   }
-  else if (access == W5500_SPI_WR)
+
+  W5500_BusLock(dev);
+  PROFILER_START(start);
+  HAL_GPIO_WritePin(dev->csPort, dev->csPin, GPIO_PIN_RESET);
+
+  // send header
+  rc = HAL_SPI_Transmit(dev->hspix, header.buf, SPI_FRAME_BYTES, SPI_TIMEOUT);
+
+  // the address auto-increments across segments while CS is held low
+  for (i = 0; i < iovcnt && rc == HAL_OK; i++)
   {
-    rc = HAL_SPI_Transmit(&dev->hspix, data, len, SPI_TIMEOUT);
+    if (iov[i].len)
+    {
+      rc = W5500_TransferData(dev, (uint8_t*)iov[i].data, iov[i].len, W5500_SPI_WR);
+    }
   }
 
-cleanup:
   HAL_GPIO_WritePin(dev->csPort, dev->csPin, GPIO_PIN_SET);
-  taskEXIT_CRITICAL();
+  PROFILER_STOP(PROFILER_W5500_WRITE, start, len);
+  W5500_BusUnlock(dev);
 
   return (w5500_status_t)rc;
 }
+
+/*!
+* @brief  Transfers the data phase of a variable length frame.
+* @param  dev    - W5500 device structure
+* @param  data   - read or write buffer
+* @param  len    - length of data
+* @param  access - access mode, either read or write
+* @return HAL status
+*/
+static HAL_StatusTypeDef W5500_TransferData(
+  w5500_dev_t* dev,
+  uint8_t*     data,
+  uint16_t     len,
+  uint8_t      access
+)
+{
+#if W5500_USE_DMA
+  if (len >= DMA_THRESHOLD)
+  {
+    return W5500_TransferDMA(dev, data, len, access);
+  }
+#endif
+  if (access == W5500_SPI_RD)
+  {
+    // short register accesses complete faster by polling than the DMA setup
+    return HAL_SPI_Receive(dev->hspix, data, len, SPI_TIMEOUT);
+  }
+  else
+  {
+    return HAL_SPI_Transmit(dev->hspix, data, len, SPI_TIMEOUT);
+  }
+}
+
+/*!
+* @brief  Transfers a short variable length frame with the header and data
+*         in a single SPI call instead of one call for each.
+*         The frame stays in VDM. The datasheet defines the fixed length
+*         modes for SCSn tied low, and chip select is still framed around
+*         every access here. The saving comes from the single HAL call,
+*         which does not depend on the operation mode.
+* @param  dev    - W5500 device structure
+* @param  header - SPI frame header
+* @param  data   - read or write buffer
+* @param  len    - length of data, at most SPI_SHORT_MAX_BYTES
+* @param  access - access mode, either read or write
+* @return HAL status
+*/
+static HAL_StatusTypeDef W5500_TransferShort(
+  w5500_dev_t*   dev,
+  const uint8_t* header,
+  uint8_t*       data,
+  uint16_t       len,
+  uint8_t        access
+)
+{
+  HAL_StatusTypeDef rc;
+  uint8_t frame[SPI_FRAME_BYTES + SPI_SHORT_MAX_BYTES] __attribute__((aligned(16)));
+  uint16_t i;
+
+  ASSERT(len <= SPI_SHORT_MAX_BYTES);
+
+  for (i = 0; i < SPI_FRAME_BYTES; i++)
+  {
+    frame[i] = header[i];
+  }
+
+  if (access == W5500_SPI_WR)
+  {
+    for (i = 0; i < len; i++)
+    {
+      frame[SPI_FRAME_BYTES + i] = data[i];
+    }
+    rc = HAL_SPI_Transmit(dev->hspix, frame, SPI_FRAME_BYTES + len, SPI_TIMEOUT);
+  }
+  else
+  {
+    rc = HAL_SPI_TransmitReceive(dev->hspix, frame, frame, SPI_FRAME_BYTES + len, SPI_TIMEOUT);
+    for (i = 0; i < len; i++)
+    {
+      data[i] = frame[SPI_FRAME_BYTES + i];
+    }
+  }
+
+  return rc;
+}
+
+#if W5500_USE_DMA
+/*!
+* @brief  Transfers the data phase of a frame with DMA, blocking the calling
+*         task until the transfer completes.
+* @param  dev    - W5500 device structure
+* @param  data   - read or write buffer
+* @param  len    - length of data
+* @param  access - access mode, either read or write
+* @return HAL status
+*/
+static HAL_StatusTypeDef W5500_TransferDMA(
+  w5500_dev_t* dev,
+  uint8_t*     data,
+  uint16_t     len,
+  uint8_t      access
+)
+{
+  HAL_StatusTypeDef rc;
+  const TickType_t  timeout = (configTICK_RATE_HZ * SPI_TIMEOUT) / 1000;
+  const TickType_t  start   = xTaskGetTickCount();
+  TickType_t        elapsed;
+  uint32_t          notify  = 0;
+  uint32_t          other   = 0;
+
+  // discard a stale completion from a previously aborted transfer. The wait
+  // only clears bits on entry while no notification is pending, so the
+  // pending state is cleared first and the clear repeated if a notification
+  // arrived in between. No new completion can arrive, xferTask is NULL.
+  do
+  {
+    xTaskNotifyStateClear(NULL);
+    xTaskNotifyWait(W5500_NOTIFY_XFER, 0, &notify, 0);
+    other |= notify & ~W5500_NOTIFY_XFER;
+  } while (notify & W5500_NOTIFY_XFER);
+  notify = 0;
+
+  dev->xferTask = xTaskGetCurrentTaskHandle();
+
+  if (access == W5500_SPI_RD)
+  {
+    rc = HAL_SPI_Receive_DMA(dev->hspix, data, len);
+  }
+  else
+  {
+    rc = HAL_SPI_Transmit_DMA(dev->hspix, data, len);
+  }
+
+  if (rc != HAL_OK)
+  {
+    dev->xferTask = NULL;
+    notify = W5500_NOTIFY_XFER; // skip the wait
+  }
+
+  // wait for the complete callback, other notification bits (e.g. the W5500
+  // interrupt for the W5500 task) are left pending in the notification value
+  while (!(notify & W5500_NOTIFY_XFER))
+  {
+    elapsed = xTaskGetTickCount() - start;
+    if (elapsed >= timeout)
+    {
+      HAL_SPI_Abort(dev->hspix);
+      rc = HAL_TIMEOUT;
+      break;
+    }
+    xTaskNotifyWait(0, W5500_NOTIFY_XFER, &notify, timeout - elapsed);
+    other |= notify & ~W5500_NOTIFY_XFER;
+  }
+
+  dev->xferTask = NULL;
+
+  // re-arm the notification state for bits received during the transfer
+  if (other)
+  {
+    xTaskNotify(xTaskGetCurrentTaskHandle(), 0, eNoAction);
+  }
+
+  if (rc == HAL_OK && dev->hspix->ErrorCode != HAL_SPI_ERROR_NONE)
+  {
+    rc = HAL_ERROR;
+  }
+
+  return rc;
+}
+#endif
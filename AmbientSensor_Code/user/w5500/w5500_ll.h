@@ -29,9 +29,16 @@
 #include "w5500/w5500_common_regs.h"
 #include "w5500/w5500_socket_regs.h"
 #include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
 #include "event_groups.h"
 
-#define W5500_NUM_SOCKETS 8 //!< number of sockets on the W5500
+#define W5500_NUM_SOCKETS       8    //!< number of sockets on the W5500
+#define W5500_MEMORY_KB         16   //!< size of both the TX and RX memory in KB
+#define W5500_SN_SNAPSHOT_BYTES 0x30 //!< length of the socket register block
+#define W5500_SN_NONE           0xFF //!< socket number when no socket is allocated
+#define W5500_USE_SHADOW        1    //!< cache registers that are only written by the firmware
+#define W5500_USE_DMA           1    //!< DMA transfers under the bus mutex, 0 for polled transfers in a critical section
 extern const uint8_t W5500_CHIP_VERSION; //!< chip version
 
 //! helper macro to return on non-zero status codes
@@ -54,10 +61,63 @@ typedef enum
   W5500_SN_EVENT_SENDOK  = (1U << 4),
 } w5500_sn_event_t;
 
+//! W5500 task notification bits
+typedef enum
+{
+  W5500_NOTIFY_INT   = (1U << 0), //!< interrupt pin asserted
+  W5500_NOTIFY_XFER  = (1U << 1), //!< SPI DMA transfer complete
+  W5500_NOTIFY_LINK  = (1U << 2), //!< PHY link went up or down
+  W5500_NOTIFY_BOUND = (1U << 3), //!< DHCP lease bound
+} w5500_notify_t;
+
+#if W5500_USE_SHADOW
+//! W5500 socket register shadow
+typedef struct w5500_sn_shadow_t
+{
+  uint8_t       valid;            //!< bitmask of valid registers
+  w5500_sn_mr_t mr;               //!< mode
+  w5500_sn_ir_t imr;              //!< interrupt mask
+  uint16_t      port;             //!< source port
+  uint16_t      dport;            //!< destination port
+  uint8_t       dipr[IPV4_BYTES]; //!< destination IP address
+} w5500_sn_shadow_t;
+
+//! W5500 register shadow
+typedef struct w5500_shadow_t
+{
+  uint8_t           valid;                   //!< bitmask of valid registers
+  uint8_t           shar[MAC_BYTES];         //!< source hardware address
+  uint8_t           sipr[IPV4_BYTES];        //!< source IP address
+  uint8_t           gar[IPV4_BYTES];         //!< gateway address
+  uint8_t           subr[IPV4_BYTES];        //!< subnet mask address
+  w5500_sn_shadow_t sn[W5500_NUM_SOCKETS];   //!< socket registers
+  uint32_t          writesSkipped;           //!< SPI transactions saved by redundant writes
+  uint32_t          readsCached;             //!< SPI transactions saved by cached reads
+} w5500_shadow_t;
+#endif
+
+//! W5500 socket pool states
+typedef enum
+{
+  W5500_SN_FREE      = 0U, //!< available for allocation
+  W5500_SN_ALLOCATED = 1U, //!< owned and closed
+  W5500_SN_OPEN      = 2U, //!< owned and open
+} w5500_sn_state_t;
+
+//! W5500 asynchronous send state of a socket
+typedef struct w5500_tx_async_t
+{
+  uint16_t wr;       //!< end of the data written to the TX ring
+  uint16_t pending;  //!< bytes written behind the SEND in flight
+  uint8_t  inFlight; //!< SEND issued and SENDOK not yet seen
+} w5500_tx_async_t;
+
 //! W5500 device structure
 typedef struct w5500_dev_t
 {
-  SPI_HandleTypeDef hspix;   //!< SPI port
+  SPI_HandleTypeDef* hspix;    //!< SPI port
+  SemaphoreHandle_t  busMutex; //!< SPI bus mutex
+  TaskHandle_t       xferTask; //!< task waiting on a DMA transfer
   GPIO_TypeDef*      csPort;  //!< GPIO CS port
   uint16_t           csPin;   //!< GPIO CS pin
   GPIO_TypeDef*      rstPort; //!< GPIO rest port
@@ -66,9 +126,62 @@ typedef struct w5500_dev_t
   uint16_t           intPin;  //!< GPIO interrupt pin
   w5500_sn_ir_t      snInt;   //!< socket N interrupt status
   uint8_t            mac[MAC_BYTES] __attribute__((aligned(16))); //!< MAC address
-  EventGroupHandle_t snEvent[W5500_NUM_SOCKETS]; //! socket events
+  EventGroupHandle_t snEvent[W5500_NUM_SOCKETS]; //! socket events, created on first allocation
+  const char*        snOwner[W5500_NUM_SOCKETS]; //!< socket owner names, NULL when free
+  uint8_t            snState[W5500_NUM_SOCKETS]; //!< socket pool states
+  uint8_t            txBufSize[W5500_NUM_SOCKETS]; //!< socket TX buffer sizes in KB
+  uint8_t            rxBufSize[W5500_NUM_SOCKETS]; //!< socket RX buffer sizes in KB
+  w5500_tx_async_t   txAsync[W5500_NUM_SOCKETS];   //!< asynchronous send state
+  uint32_t           cmdPolls;    //!< Sn_CR reads waiting for command completion
+  uint32_t           statusPolls; //!< Sn_SR reads waiting for a socket status
+#if W5500_USE_SHADOW
+  w5500_shadow_t     shadow;  //!< register shadow
+#endif
 } w5500_dev_t;
 
+//! W5500 socket register block, decoded from a single burst read
+typedef struct w5500_sn_snapshot_t
+{
+  w5500_sn_mr_t mr;                //!< mode
+  uint8_t       cr;                //!< command
+  w5500_sn_ir_t ir;                //!< interrupt
+  uint8_t       sr;                //!< status
+  uint16_t      port;              //!< source port
+  uint8_t       dhar[MAC_BYTES];   //!< destination HW address
+  uint8_t       dipr[IPV4_BYTES];  //!< destination IP address
+  uint16_t      dport;             //!< destination port
+  uint16_t      mssr;              //!< maximum segment size
+  uint8_t       tos;               //!< IP TOS
+  uint8_t       ttl;               //!< IP TTL
+  uint8_t       rxBufSize;         //!< RX buffer size
+  uint8_t       txBufSize;         //!< TX buffer size
+  uint16_t      txFsr;             //!< TX free size
+  uint16_t      txRd;              //!< TX read pointer
+  uint16_t      txWr;              //!< TX write pointer
+  uint16_t      rxRsr;             //!< RX received size
+  uint16_t      rxRd;              //!< RX read pointer
+  uint16_t      rxWr;              //!< RX write pointer
+  w5500_sn_ir_t imr;               //!< interrupt mask
+  uint16_t      frag;              //!< fragment offset in IP header
+  uint8_t       kpalvtr;           //!< keep alive timer
+} w5500_sn_snapshot_t;
+
+//! W5500 interrupt and interrupt mask registers, read in a single frame
+typedef struct w5500_int_status_t
+{
+  w5500_ir_t ir;   //!< interrupt
+  w5500_ir_t imr;  //!< interrupt mask
+  uint8_t    sir;  //!< socket interrupt
+  uint8_t    simr; //!< socket interrupt mask
+} w5500_int_status_t;
+
+//! W5500 scatter-gather segment
+typedef struct w5500_iovec_t
+{
+  const uint8_t* data; //!< segment data
+  uint16_t       len;  //!< segment length
+} w5500_iovec_t;
+
 //! W5500 device return codes
 typedef enum 
 {
@@ -92,6 +205,13 @@ typedef enum
   W5500_SOCKET_DISCONNECTED = 17U,
   W5500_MQTT_BAD_PACKET     = 18U,
   W5500_MQTT_CON_REFUSED    = 19U,
+  W5500_BAD_MEMORY_CFG      = 20U,
+  W5500_CMD_TIMEOUT         = 21U,
+  W5500_NO_SOCKET           = 22U,
+  W5500_NO_LINK             = 23U,
+  W5500_MQTT_PING_TIMEOUT   = 24U,
+  W5500_MQTT_ACK_TIMEOUT    = 25U,
+  W5500_MQTT_SUB_REFUSED    = 26U,
 } w5500_status_t;
 
 //! W5500 link status
@@ -121,6 +241,7 @@ w5500_status_t W5500_GetSIR(w5500_dev_t* dev, uint8_t* sir);
 w5500_status_t W5500_SetSIR(w5500_dev_t* dev, uint8_t* sir);
 w5500_status_t W5500_GetSIMR(w5500_dev_t* dev, uint8_t* simr);
 w5500_status_t W5500_SetSIMR(w5500_dev_t* dev, uint8_t* simr);
+w5500_status_t W5500_GetIntStatus(w5500_dev_t* dev, w5500_int_status_t* status);
 w5500_status_t W5500_GetRTR(w5500_dev_t* dev, uint16_t* rtr);
 w5500_status_t W5500_SetRTR(w5500_dev_t* dev, uint16_t* rtr);
 w5500_status_t W5500_GetRCR(w5500_dev_t* dev, uint8_t* rcr);
@@ -178,13 +299,19 @@ w5500_status_t W5500_GetSnFRAG(w5500_dev_t* dev, uint8_t sn, uint16_t* frag);
 w5500_status_t W5500_SetSnFRAG(w5500_dev_t* dev, uint8_t sn, uint16_t* frag);
 w5500_status_t W5500_GetSnKPALVTR(w5500_dev_t* dev, uint8_t sn, uint8_t* kpalvtr);
 w5500_status_t W5500_SetSnKPALVTR(w5500_dev_t* dev, uint8_t sn, uint8_t* kpalvtr);
+w5500_status_t W5500_GetSnSnapshot(w5500_dev_t* dev, uint8_t sn, w5500_sn_snapshot_t* snap);
 
 w5500_status_t W5500_SetSnTxBuf(w5500_dev_t* dev, uint8_t sn, uint16_t ptr, uint8_t* data, uint16_t len);
+w5500_status_t W5500_SetSnTxBufv(w5500_dev_t* dev, uint8_t sn, uint16_t ptr, const w5500_iovec_t* iov, uint8_t iovcnt);
 w5500_status_t W5500_SetSnRxBuf(w5500_dev_t* dev, uint8_t sn, uint16_t ptr, uint8_t* data, uint16_t len);
 w5500_status_t W5500_GetSnTxBuf(w5500_dev_t* dev, uint8_t sn, uint16_t ptr, uint8_t* data, uint16_t len);
 w5500_status_t W5500_GetSnRxBuf(w5500_dev_t* dev, uint8_t sn, uint16_t ptr, uint8_t* data, uint16_t len);
 
 void W5500_HardReset(w5500_dev_t* dev);
+#if W5500_USE_SHADOW
+void W5500_ShadowInvalidate(w5500_dev_t* dev);
+#endif
+void W5500_TransferCompleteFromISR(w5500_dev_t* dev, BaseType_t* xHigherPriorityTaskWoken);
 const char* W5500_StatusString(w5500_status_t status);
 
 #endif // _W5500_LL_H_
@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+"""
+Receives AmbientSensor multicast sample datagrams and reports the
+inter-arrival jitter of each sample type.
+
+Datagram format (big endian, see user/w5500/mcast.h):
+    uint8  version
+    uint8  type
+    uint16 sequence number
+    uint32 sender tick count in ms
+    float  value
+"""
+
+import argparse
+import collections
+import socket
+import statistics
+import struct
+import time
+
+DATAGRAM = struct.Struct(">BBHIf")
+VERSION = 1
+SAMPLE_TYPES = ["temperature", "humidity", "pressure", "luminosity"]
+
+
+class Stream:
+    """Arrival statistics of a single sample type."""
+
+    def __init__(self):
+        self.last_arrival = None
+        self.last_tick = None
+        self.intervals = collections.deque(maxlen=10000)
+        self.count = 0
+        self.jitter = 0.0
+        self.value = None
+
+    def add(self, arrival, tick, value):
+        if self.last_arrival is not None:
+            interval = arrival - self.last_arrival
+            self.intervals.append(interval)
+
+            # RFC 3550 interarrival jitter against the sender clock
+            transit = (arrival - self.last_arrival) - (tick - self.last_tick) / 1000.0
+            self.jitter += (abs(transit) - self.jitter) / 16.0
+
+        self.count += 1
+        self.last_arrival = arrival
+        self.last_tick = tick
+        self.value = value
+
+    def report(self, name):
+        if len(self.intervals) < 2:
+            return "{:<12} waiting for samples".format(name)
+        ms = [i * 1000.0 for i in self.intervals]
+        return "{:<12} n={:<6} value={:<10.3f} interval ms mean={:.2f} min={:.2f} max={:.2f} stdev={:.2f} jitter={:.2f}".format(
+            name,
+            self.count,
+            self.value,
+            statistics.mean(ms),
+            min(ms),
+            max(ms),
+            statistics.stdev(ms),
+            self.jitter * 1000.0,
+        )
+
+
+def open_socket(group, port, iface):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind(("", port))
+    mreq = socket.inet_aton(group) + socket.inet_aton(iface)
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, mreq)
+    return sock
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--group", default="239.255.0.1", help="multicast group")
+    parser.add_argument("--port", type=int, default=5007, help="multicast port")
+    parser.add_argument("--iface", default="0.0.0.0", help="IP of the interface to join on")
+    parser.add_argument("--period", type=float, default=10.0, help="seconds between reports")
+    args = parser.parse_args()
+
+    sock = open_socket(args.group, args.port, args.iface)
+    streams = {}
+    last_seq = None
+    lost = 0
+    next_report = time.monotonic() + args.period
+
+    while True:
+        sock.settimeout(max(next_report - time.monotonic(), 0.001))
+        try:
+            data, source = sock.recvfrom(64)
+            arrival = time.monotonic()
+        except socket.timeout:
+            data = None
+
+        if data is not None:
+            if len(data) != DATAGRAM.size:
+                print("ignoring {} byte datagram from {}".format(len(data), source[0]))
+                continue
+            version, kind, seq, tick, value = DATAGRAM.unpack(data)
+            if version != VERSION:
+                print("ignoring version {} datagram from {}".format(version, source[0]))
+                continue
+
+            # sequence numbers count every datagram the sensor sends
+            if last_seq is not None:
+                gap = (seq - last_seq) & 0xFFFF
+                if 1 < gap < 0x8000:
+                    lost += gap - 1
+            last_seq = seq
+
+            streams.setdefault(kind, Stream()).add(arrival, tick, value)
+
+        if time.monotonic() >= next_report:
+            next_report += args.period
+            print("lost {}".format(lost))
+            for kind in sorted(streams):
+                name = SAMPLE_TYPES[kind] if kind < len(SAMPLE_TYPES) else "type {}".format(kind)
+                print(streams[kind].report(name))
+
+
+if __name__ == "__main__":
+    main()
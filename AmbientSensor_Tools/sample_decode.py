@@ -0,0 +1,86 @@
+#!/usr/bin/env python3
+"""
+Decodes AmbientSensor packed sample payloads published on the
+/home/bedroom/<device>/state/packed topic.
+
+Payload format (big endian, see user/codec/codec.h):
+    uint8  version
+    uint8  record count
+    records of
+        uint8  sample type
+        int32  value in thousandths of the sample unit
+        uint32 sender tick count in ms
+
+Payloads are read as hex strings from the command line, as raw bytes
+from stdin, or by subscribing to a broker when paho-mqtt is installed.
+"""
+
+import argparse
+import struct
+import sys
+
+HEADER = struct.Struct(">BB")
+RECORD = struct.Struct(">BiI")
+VERSION = 1
+SAMPLE_TYPES = ["temperature", "humidity", "pressure", "luminosity"]
+
+
+class DecodeError(ValueError):
+    """Raised for payloads that do not match the packed format."""
+
+
+def decode(payload):
+    """Returns a list of (name, value, tick) tuples from a packed payload."""
+    if len(payload) < HEADER.size:
+        raise DecodeError("payload of {} bytes is shorter than the header".format(len(payload)))
+    version, count = HEADER.unpack_from(payload)
+    if version != VERSION:
+        raise DecodeError("unsupported version {}".format(version))
+    if len(payload) != HEADER.size + count * RECORD.size:
+        raise DecodeError("{} records do not fit {} bytes".format(count, len(payload)))
+
+    samples = []
+    for offset in range(HEADER.size, len(payload), RECORD.size):
+        kind, milli, tick = RECORD.unpack_from(payload, offset)
+        name = SAMPLE_TYPES[kind] if kind < len(SAMPLE_TYPES) else "type {}".format(kind)
+        samples.append((name, milli / 1000.0, tick))
+    return samples
+
+
+def report(payload):
+    try:
+        for name, value, tick in decode(payload):
+            print("{:>10} ms {:<12} {:.3f}".format(tick, name, value))
+    except DecodeError as e:
+        print("bad payload: {}".format(e), file=sys.stderr)
+
+
+def subscribe(host, port, topic):
+    import paho.mqtt.client as mqtt
+
+    client = mqtt.Client()
+    client.on_connect = lambda c, userdata, flags, rc: c.subscribe(topic)
+    client.on_message = lambda c, userdata, msg: report(msg.payload)
+    client.connect(host, port)
+    client.loop_forever()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("payload", nargs="*", help="payloads as hex strings, raw bytes are read from stdin if omitted")
+    parser.add_argument("--mqtt", metavar="HOST", help="subscribe to the packed topic on this broker")
+    parser.add_argument("--port", type=int, default=1883, help="broker port")
+    parser.add_argument("--topic", default="/home/bedroom/ambient1/state/packed", help="packed sample topic")
+    args = parser.parse_args()
+
+    if args.mqtt:
+        subscribe(args.mqtt, args.port, args.topic)
+    elif args.payload:
+        for text in args.payload:
+            report(bytes.fromhex(text))
+    else:
+        report(sys.stdin.buffer.read())
+
+
+if __name__ == "__main__":
+    main()